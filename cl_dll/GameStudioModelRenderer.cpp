@@ -28,6 +28,7 @@
 #include "Exports.h"
 
 #include "svd_render.h"
+#include "studio_jobs.h"
 
 //
 // Override the StudioModelRender virtual member functions here to implement custom bone
@@ -49,6 +50,18 @@ CGameStudioModelRenderer::CGameStudioModelRenderer()
 {
 }
 
+/*
+====================
+StudioCreateBoneWorker
+
+Workers are of this class too, so they run the overrides above
+====================
+*/
+CStudioModelRenderer* CGameStudioModelRenderer::StudioCreateBoneWorker()
+{
+	return new CGameStudioModelRenderer;
+}
+
 ////////////////////////////////////
 // Hooks to class implementation
 ////////////////////////////////////
@@ -75,6 +88,28 @@ int R_StudioDrawModel(int flags)
 	return static_cast<int>(g_StudioRenderer.StudioDrawModel(flags));
 }
 
+/*
+====================
+R_StudioQueueBoneSetup
+
+====================
+*/
+void R_StudioQueueBoneSetup(cl_entity_t* pentity)
+{
+	g_StudioRenderer.StudioQueueBoneSetup(pentity);
+}
+
+/*
+====================
+R_StudioSetupQueuedBones
+
+====================
+*/
+void R_StudioSetupQueuedBones()
+{
+	g_StudioRenderer.StudioSetupQueuedBones();
+}
+
 /*
 ====================
 R_StudioInit
@@ -87,6 +122,19 @@ void R_StudioInit()
 	SVD_Init();
 }
 
+/*
+====================
+R_StudioShutdown
+
+Called from HUD_Shutdown, while the engine and GL context are still up
+====================
+*/
+void R_StudioShutdown()
+{
+	StudioJobs_Shutdown();
+	SVD_Shutdown();
+}
+
 // The simple drawing interface we'll pass back to the engine
 r_studio_interface_t studio =
 	{
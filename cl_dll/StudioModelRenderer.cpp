@@ -14,12 +14,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <memory.h>
+#include <chrono>
 
 #include "studio_util.h"
 #include "r_studioint.h"
 
 #include "StudioModelRenderer.h"
+#include "studio_jobs.h"
 #include "GameStudioModelRenderer.h"
+#include "svd_render.h"
 
 #define GLEW_STATIC 1
 #include "GL/glew.h"
@@ -34,11 +37,82 @@ extern extra_player_info_t g_PlayerExtraInfo[MAX_PLAYERS_HUD + 1];
 #define TEAM3_COLOR 45
 #define TEAM4_COLOR 100
 
+// Padding on the bone pre-pass culling, which uses the previous frame's view
+#define STUDIO_QUEUE_CULL_MARGIN 64
+
 int m_nPlayerGaitSequences[MAX_PLAYERS];
 
 // Global engine <-> studio model rendering code interface
 engine_studio_api_t IEngineStudio;
 
+/*
+====================
+StudioBenchmarkBones_f
+
+Times the per-bone quaternion math against the batched kernels
+====================
+*/
+static void StudioBenchmarkBones_f()
+{
+	const int numIterations = 2000;
+
+	static float angle1[MAXSTUDIOBONES][3];
+	static float angle2[MAXSTUDIOBONES][3];
+	static float pos[MAXSTUDIOBONES][3];
+	static vec4_t q1[MAXSTUDIOBONES];
+	static vec4_t q2[MAXSTUDIOBONES];
+	static vec4_t q[MAXSTUDIOBONES];
+	static float matrices[MAXSTUDIOBONES][3][4];
+
+	// Neighbouring frames, so the blends look like the ones in StudioCalcRotations
+	for (int i = 0; i < MAXSTUDIOBONES; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			angle1[i][j] = gEngfuncs.pfnRandomFloat(-M_PI, M_PI);
+			angle2[i][j] = angle1[i][j] + gEngfuncs.pfnRandomFloat(-0.05, 0.05);
+			pos[i][j] = gEngfuncs.pfnRandomFloat(-32, 32);
+		}
+	}
+
+	float checksum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (int n = 0; n < numIterations; n++)
+	{
+		for (int i = 0; i < MAXSTUDIOBONES; i++)
+		{
+			AngleQuaternion(angle1[i], q1[i]);
+			AngleQuaternion(angle2[i], q2[i]);
+			QuaternionSlerp(q1[i], q2[i], 0.3f, q[i]);
+			QuaternionMatrix(q[i], matrices[i]);
+		}
+
+		checksum += matrices[n % MAXSTUDIOBONES][0][0];
+	}
+
+	auto middle = std::chrono::high_resolution_clock::now();
+
+	for (int n = 0; n < numIterations; n++)
+	{
+		AngleQuaternionBones(angle1, q1, MAXSTUDIOBONES);
+		AngleQuaternionBones(angle2, q2, MAXSTUDIOBONES);
+		QuaternionSlerpBones(q1, q2, 0.3f, q, MAXSTUDIOBONES);
+		QuaternionMatrixBones(q, pos, matrices, MAXSTUDIOBONES);
+
+		checksum += matrices[n % MAXSTUDIOBONES][0][0];
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double numBones = (double)numIterations * MAXSTUDIOBONES;
+	double scalar = std::chrono::duration<double, std::nano>(middle - start).count() / numBones;
+	double batched = std::chrono::duration<double, std::nano>(end - middle).count() / numBones;
+
+	gEngfuncs.Con_Printf("Bone quaternions, %d bones x %d: scalar %.1f ns/bone, batched %.1f ns/bone (%.2fx) [%g]\n",
+		MAXSTUDIOBONES, numIterations, scalar, batched, batched > 0 ? scalar / batched : 0.0, checksum);
+}
+
 /////////////////////
 // Implementation of CStudioModelRenderer.h
 
@@ -75,6 +149,22 @@ void CStudioModelRenderer::Init()
 
 	m_pCvarDrawStencilShadows = CVAR_CREATE("r_shadows_stencil", "1", FCVAR_ARCHIVE);
 	m_pCvarShadowVolumeExtrudeDistance = CVAR_CREATE("r_shadow_extrude_distance", "2048", FCVAR_ARCHIVE);
+	m_pCvarShadowSIMD = CVAR_CREATE("r_shadow_simd", "1", FCVAR_ARCHIVE);
+	m_pCvarShadowVBO = CVAR_CREATE("r_shadow_vbo", "1", FCVAR_ARCHIVE);
+	m_pCvarShadowWorldVBO = CVAR_CREATE("r_shadow_world_vbo", "1", FCVAR_ARCHIVE);
+	m_pCvarShadowResolve = CVAR_CREATE("r_shadow_resolve", "0", FCVAR_ARCHIVE);
+	m_pCvarShadowFBOStats = CVAR_CREATE("r_shadow_fbo_stats", "0", 0);
+	m_pCvarShadowCache = CVAR_CREATE("r_shadow_cache", "1", FCVAR_ARCHIVE);
+	m_pCvarShadowLOD = CVAR_CREATE("r_shadow_lod", "1", FCVAR_ARCHIVE);
+	m_pCvarShadowLODPixels = CVAR_CREATE("r_shadow_lod_pixels", "64", FCVAR_ARCHIVE);
+	m_pCvarShadowFadeDistance = CVAR_CREATE("r_shadow_fade_distance", "3072", FCVAR_ARCHIVE);
+	m_pCvarShadowBudget = CVAR_CREATE("r_shadow_budget", "200000", FCVAR_ARCHIVE);
+	m_pCvarShadowLODStats = CVAR_CREATE("r_shadow_lod_stats", "0", 0);
+	m_pCvarPoseCache = CVAR_CREATE("r_studio_pose_cache", "1", FCVAR_ARCHIVE);
+	m_pCvarPoseCacheStats = CVAR_CREATE("r_studio_pose_stats", "0", 0);
+	m_pCvarBoneJobs = CVAR_CREATE("r_studio_bone_jobs", "1", FCVAR_ARCHIVE);
+
+	gEngfuncs.pfnAddCommand("r_studio_bench", StudioBenchmarkBones_f);
 }
 
 /*
@@ -87,6 +177,7 @@ CStudioModelRenderer::CStudioModelRenderer()
 {
 	m_fDoInterp = true;
 	m_fGaitEstimation = true;
+	m_bIsHardware = true;
 	m_pCurrentEntity = NULL;
 	m_pCvarHiModels = NULL;
 	m_pCvarDeveloper = NULL;
@@ -106,6 +197,36 @@ CStudioModelRenderer::CStudioModelRenderer()
 
 	m_pCvarDrawStencilShadows = NULL;
 	m_pCvarShadowVolumeExtrudeDistance = NULL;
+	m_pCvarShadowSIMD = NULL;
+	m_pCvarShadowVBO = NULL;
+	m_pCvarShadowWorldVBO = NULL;
+	m_pCvarShadowResolve = NULL;
+	m_pCvarShadowFBOStats = NULL;
+	m_pCvarShadowCache = NULL;
+	m_pShadowCache = NULL;
+	m_shadowCacheKey = 0;
+	m_iShadowBodyPart = 0;
+	m_flShadowCachePruneTime = 0;
+	m_pCvarShadowLOD = NULL;
+	m_pCvarShadowLODPixels = NULL;
+	m_pCvarShadowFadeDistance = NULL;
+	m_pCvarShadowBudget = NULL;
+	m_pCvarShadowLODStats = NULL;
+	m_iShadowLOD = 0;
+	m_iShadowStatsFrame = -1;
+	memset(m_iShadowLODCounts, 0, sizeof(m_iShadowLODCounts));
+	m_iShadowsFaded = 0;
+	m_iShadowsOverBudget = 0;
+	m_iShadowTriangles = 0;
+	m_pCvarPoseCache = NULL;
+	m_pCvarPoseCacheStats = NULL;
+	m_flPoseStatsTime = -1;
+	m_flPoseCachePruneTime = 0;
+	m_iPoseCacheHits = 0;
+	m_iPoseCacheMisses = 0;
+	m_iBoundsCacheHits = 0;
+	m_iBoundsCacheMisses = 0;
+	m_pCvarBoneJobs = NULL;
 	m_iClosestLight = 0;
 	m_iNumEntityLights = 0;
 	m_pSkylightColorR = NULL;
@@ -121,6 +242,7 @@ CStudioModelRenderer::CStudioModelRenderer()
 	memset(m_pEntityLights, 0, sizeof(m_pEntityLights));
 
 	m_bTwoSideSupported = glActiveStencilFaceEXT != nullptr;
+	m_bShadowBuffersBound = false;
 }
 
 /*
@@ -131,6 +253,8 @@ CStudioModelRenderer::CStudioModelRenderer()
 */
 CStudioModelRenderer::~CStudioModelRenderer()
 {
+	for (CStudioModelRenderer* pworker : m_boneWorkers)
+		delete pworker;
 }
 
 /*
@@ -205,15 +329,13 @@ void CStudioModelRenderer::StudioCalcBoneAdj(float dadt, float* adj, const byte*
 
 /*
 ====================
-StudioCalcBoneQuaterion
+StudioCalcBoneAngles
 
 ====================
 */
-void CStudioModelRenderer::StudioCalcBoneQuaterion(int frame, float s, mstudiobone_t* pbone, mstudioanim_t* panim, float* adj, float* q)
+void CStudioModelRenderer::StudioCalcBoneAngles(int frame, mstudiobone_t* pbone, mstudioanim_t* panim, float* adj, float* angle1, float* angle2)
 {
 	int j, k;
-	vec4_t q1, q2;
-	Vector angle1, angle2;
 	mstudioanimvalue_t* panimvalue;
 
 	for (j = 0; j < 3; j++)
@@ -276,17 +398,24 @@ void CStudioModelRenderer::StudioCalcBoneQuaterion(int frame, float s, mstudiobo
 			angle2[j] += adj[pbone->bonecontroller[j + 3]];
 		}
 	}
+}
 
-	if (!VectorCompare(angle1, angle2))
-	{
-		AngleQuaternion(angle1, q1);
-		AngleQuaternion(angle2, q2);
-		QuaternionSlerp(q1, q2, s, q);
-	}
-	else
-	{
-		AngleQuaternion(angle1, q);
-	}
+/*
+====================
+StudioCalcBoneQuaterion
+
+====================
+*/
+void CStudioModelRenderer::StudioCalcBoneQuaterion(int frame, float s, mstudiobone_t* pbone, mstudioanim_t* panim, float* adj, float* q)
+{
+	float angles[2][3];
+	vec4_t q1, q2;
+
+	StudioCalcBoneAngles(frame, pbone, panim, adj, angles[0], angles[1]);
+
+	AngleQuaternionBones(&angles[0], &q1, 1);
+	AngleQuaternionBones(&angles[1], &q2, 1);
+	QuaternionSlerpBones(&q1, &q2, s, (vec4_t*)q, 1);
 }
 
 /*
@@ -366,7 +495,6 @@ StudioSlerpBones
 void CStudioModelRenderer::StudioSlerpBones(vec4_t q1[], float pos1[][3], vec4_t q2[], float pos2[][3], float s)
 {
 	int i;
-	vec4_t q3;
 	float s1;
 
 	if (s < 0)
@@ -376,13 +504,10 @@ void CStudioModelRenderer::StudioSlerpBones(vec4_t q1[], float pos1[][3], vec4_t
 
 	s1 = 1.0 - s;
 
+	QuaternionSlerpBones(q1, q2, s, q1, m_pStudioHeader->numbones);
+
 	for (i = 0; i < m_pStudioHeader->numbones; i++)
 	{
-		QuaternionSlerp(q1[i], q2[i], s, q3);
-		q1[i][0] = q3[0];
-		q1[i][1] = q3[1];
-		q1[i][2] = q3[2];
-		q1[i][3] = q3[3];
 		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s;
 		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s;
 		pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s;
@@ -630,6 +755,11 @@ void CStudioModelRenderer::StudioCalcRotations(float pos[][3], vec4_t* q, mstudi
 	float adj[MAXSTUDIOCONTROLLERS];
 	float dadt;
 
+	float angle1[MAXSTUDIOBONES][3];
+	float angle2[MAXSTUDIOBONES][3];
+	vec4_t q1[MAXSTUDIOBONES];
+	vec4_t q2[MAXSTUDIOBONES];
+
 	if (f > pseqdesc->numframes - 1)
 	{
 		f = 0; // bah, fix this bug with changing sequences too fast
@@ -661,13 +791,19 @@ void CStudioModelRenderer::StudioCalcRotations(float pos[][3], vec4_t* q, mstudi
 
 	for (i = 0; i < m_pStudioHeader->numbones; i++, pbone++, panim++)
 	{
-		StudioCalcBoneQuaterion(frame, s, pbone, panim, adj, q[i]);
+		StudioCalcBoneAngles(frame, pbone, panim, adj, angle1[i], angle2[i]);
 
 		StudioCalcBonePosition(frame, s, pbone, panim, adj, pos[i]);
 		// if (0 && i == 0)
 		//	Con_DPrintf("%d %d %d %d\n", m_pCurrentEntity->curstate.sequence, frame, j, k );
 	}
 
+	// Quaternions for all bones at once, bones with the same
+	// angles on both frames come out of the blend unchanged
+	AngleQuaternionBones(angle1, q1, m_pStudioHeader->numbones);
+	AngleQuaternionBones(angle2, q2, m_pStudioHeader->numbones);
+	QuaternionSlerpBones(q1, q2, s, q, m_pStudioHeader->numbones);
+
 	if ((pseqdesc->motiontype & STUDIO_X) != 0)
 	{
 		pos[pseqdesc->motionbone][0] = 0.0;
@@ -818,16 +954,17 @@ void CStudioModelRenderer::StudioSetupBones()
 	mstudioseqdesc_t* pseqdesc;
 	mstudioanim_t* panim;
 
-	static float pos[MAXSTUDIOBONES][3];
-	static vec4_t q[MAXSTUDIOBONES];
-	float bonematrix[3][4];
+	// Per thread, bones are also set up on the job pool
+	static thread_local float pos[MAXSTUDIOBONES][3];
+	static thread_local vec4_t q[MAXSTUDIOBONES];
+	float bonematrices[MAXSTUDIOBONES][3][4];
 
-	static float pos2[MAXSTUDIOBONES][3];
-	static vec4_t q2[MAXSTUDIOBONES];
-	static float pos3[MAXSTUDIOBONES][3];
-	static vec4_t q3[MAXSTUDIOBONES];
-	static float pos4[MAXSTUDIOBONES][3];
-	static vec4_t q4[MAXSTUDIOBONES];
+	static thread_local float pos2[MAXSTUDIOBONES][3];
+	static thread_local vec4_t q2[MAXSTUDIOBONES];
+	static thread_local float pos3[MAXSTUDIOBONES][3];
+	static thread_local vec4_t q3[MAXSTUDIOBONES];
+	static thread_local float pos4[MAXSTUDIOBONES][3];
+	static thread_local vec4_t q4[MAXSTUDIOBONES];
 
 	if (m_pCurrentEntity->curstate.sequence >= m_pStudioHeader->numseq)
 	{
@@ -859,6 +996,25 @@ void CStudioModelRenderer::StudioSetupBones()
 		//Con_DPrintf("%f %f\n", m_pCurrentEntity->prevframe, f );
 	}
 
+	const bool blendPrevSequence = StudioBlendsPrevSequence();
+
+	// bounds checking
+	if (m_pPlayerInfo)
+	{
+		if (m_pPlayerInfo->gaitsequence >= m_pStudioHeader->numseq)
+		{
+			m_pPlayerInfo->gaitsequence = 0;
+		}
+	}
+
+	uint64_t poseKey = StudioPoseKey(f, blendPrevSequence);
+	if (StudioRestorePose(poseKey))
+	{
+		if (!blendPrevSequence)
+			m_pCurrentEntity->latched.prevframe = f;
+		return;
+	}
+
 	panim = StudioGetAnim(m_pRenderModel, pseqdesc);
 	StudioCalcRotations(pos, q, pseqdesc, panim, f);
 
@@ -891,14 +1047,11 @@ void CStudioModelRenderer::StudioSetupBones()
 		}
 	}
 
-	if (m_fDoInterp &&
-		0 != m_pCurrentEntity->latched.sequencetime &&
-		(m_pCurrentEntity->latched.sequencetime + 0.2 > m_clTime) &&
-		(m_pCurrentEntity->latched.prevsequence < m_pStudioHeader->numseq))
+	if (blendPrevSequence)
 	{
 		// blend from last sequence
-		static float pos1b[MAXSTUDIOBONES][3];
-		static vec4_t q1b[MAXSTUDIOBONES];
+		static thread_local float pos1b[MAXSTUDIOBONES][3];
+		static thread_local vec4_t q1b[MAXSTUDIOBONES];
 		float s;
 
 		if (m_pCurrentEntity->latched.prevsequence >= m_pStudioHeader->numseq)
@@ -946,15 +1099,6 @@ void CStudioModelRenderer::StudioSetupBones()
 
 	pbones = (mstudiobone_t*)((byte*)m_pStudioHeader + m_pStudioHeader->boneindex);
 
-	// bounds checking
-	if (m_pPlayerInfo)
-	{
-		if (m_pPlayerInfo->gaitsequence >= m_pStudioHeader->numseq)
-		{
-			m_pPlayerInfo->gaitsequence = 0;
-		}
-	}
-
 	// calc gait animation
 	if (m_pPlayerInfo && m_pPlayerInfo->gaitsequence != 0)
 	{
@@ -993,19 +1137,16 @@ void CStudioModelRenderer::StudioSetupBones()
 		}
 	}
 
+	QuaternionMatrixBones(q, pos, bonematrices, m_pStudioHeader->numbones);
+
 	for (i = 0; i < m_pStudioHeader->numbones; i++)
 	{
 		const int parent = pbones[i].parent;
-
-		QuaternionMatrix(q[i], bonematrix);
-
-		bonematrix[0][3] = pos[i][0];
-		bonematrix[1][3] = pos[i][1];
-		bonematrix[2][3] = pos[i][2];
+		float (*bonematrix)[4] = bonematrices[i];
 
 		if (parent == -1)
 		{
-			if (0 != IEngineStudio.IsHardware())
+			if (m_bIsHardware)
 			{
 				ConcatTransforms((*m_protationmatrix), bonematrix, (*m_pbonetransform)[i]);
 
@@ -1028,8 +1169,351 @@ void CStudioModelRenderer::StudioSetupBones()
 			ConcatTransforms((*m_plighttransform)[parent], bonematrix, (*m_plighttransform)[i]);
 		}
 	}
+
+	StudioStorePose(poseKey);
+}
+
+/*
+====================
+StudioBlendsPrevSequence
+
+====================
+*/
+bool CStudioModelRenderer::StudioBlendsPrevSequence()
+{
+	return m_fDoInterp &&
+		   0 != m_pCurrentEntity->latched.sequencetime &&
+		   (m_pCurrentEntity->latched.sequencetime + 0.2 > m_clTime) &&
+		   (m_pCurrentEntity->latched.prevsequence < m_pStudioHeader->numseq);
+}
+
+/*
+====================
+StudioPoseKey
+
+====================
+*/
+uint64_t CStudioModelRenderer::StudioPoseKey(float frame, bool blendPrevSequence)
+{
+	// FNV-1a over the animation state and the entity transform
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	auto hashBytes = [&hash](const void* pdata, size_t size)
+	{
+		const byte* pbytes = (const byte*)pdata;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= pbytes[i];
+			hash *= 0x100000001B3ULL;
+		}
+	};
+
+	entity_state_t* pstate = &m_pCurrentEntity->curstate;
+	latchedvars_t* platched = &m_pCurrentEntity->latched;
+
+	// Controllers and effects are interpolated against the clock
+	hashBytes(&m_clTime, sizeof(m_clTime));
+	hashBytes(&m_pRenderModel, sizeof(m_pRenderModel));
+	hashBytes(&pstate->sequence, sizeof(pstate->sequence));
+	hashBytes(&frame, sizeof(frame));
+	hashBytes(pstate->blending, sizeof(pstate->blending));
+	hashBytes(platched->prevblending, sizeof(platched->prevblending));
+	hashBytes(pstate->controller, sizeof(pstate->controller));
+	hashBytes(platched->prevcontroller, sizeof(platched->prevcontroller));
+	hashBytes(&m_pCurrentEntity->mouth.mouthopen, sizeof(m_pCurrentEntity->mouth.mouthopen));
+	hashBytes(&pstate->renderfx, sizeof(pstate->renderfx));
+	hashBytes(*m_protationmatrix, sizeof(float) * 12);
+
+	if (!m_bIsHardware)
+		hashBytes(*m_paliastransform, sizeof(float) * 12);
+
+	if (blendPrevSequence)
+	{
+		hashBytes(&platched->prevsequence, sizeof(platched->prevsequence));
+		hashBytes(&platched->prevframe, sizeof(platched->prevframe));
+		hashBytes(&platched->sequencetime, sizeof(platched->sequencetime));
+		hashBytes(platched->prevseqblending, sizeof(platched->prevseqblending));
+	}
+
+	if (m_pPlayerInfo)
+	{
+		hashBytes(&m_pPlayerInfo->gaitsequence, sizeof(m_pPlayerInfo->gaitsequence));
+		hashBytes(&m_pPlayerInfo->gaitframe, sizeof(m_pPlayerInfo->gaitframe));
+	}
+
+	return hash;
+}
+
+/*
+====================
+StudioRestorePose
+
+====================
+*/
+bool CStudioModelRenderer::StudioRestorePose(uint64_t key)
+{
+	StudioPoseCacheFrame();
+
+	if (m_pCvarPoseCache->value < 1)
+	{
+		if (!m_poseCache.empty())
+			m_poseCache.clear();
+
+		return false;
+	}
+
+	auto it = m_poseCache.find(StudioCacheKey());
+	if (it == m_poseCache.end() || it->second.key != key || it->second.numbones != m_pStudioHeader->numbones)
+	{
+		m_iPoseCacheMisses++;
+		return false;
+	}
+
+	studioposecache_t& pose = it->second;
+	pose.lastused = m_clTime;
+
+	memcpy(*m_pbonetransform, pose.bonetransform, sizeof(float) * 12 * pose.numbones);
+	memcpy(*m_plighttransform, pose.lighttransform, sizeof(float) * 12 * pose.numbones);
+
+	m_iPoseCacheHits++;
+	return true;
+}
+
+/*
+====================
+StudioStorePose
+
+====================
+*/
+void CStudioModelRenderer::StudioStorePose(uint64_t key)
+{
+	if (m_pCvarPoseCache->value < 1)
+		return;
+
+	studioposecache_t& pose = m_poseCache[StudioCacheKey()];
+	pose.lastused = m_clTime;
+	pose.key = key;
+	pose.numbones = m_pStudioHeader->numbones;
+
+	memcpy(pose.bonetransform, *m_pbonetransform, sizeof(float) * 12 * pose.numbones);
+	memcpy(pose.lighttransform, *m_plighttransform, sizeof(float) * 12 * pose.numbones);
+}
+
+/*
+====================
+StudioPoseCacheFrame
+
+====================
+*/
+void CStudioModelRenderer::StudioPoseCacheFrame()
+{
+	// The clock, not the frame count, since mirrors render the same frame again
+	if (m_flPoseStatsTime == m_clTime)
+		return;
+
+	if (m_pCvarPoseCacheStats->value > 0 && m_flPoseStatsTime != -1)
+	{
+		int poses = m_iPoseCacheHits + m_iPoseCacheMisses;
+		int bounds = m_iBoundsCacheHits + m_iBoundsCacheMisses;
+
+		gEngfuncs.Con_NPrintf(22, "Pose cache: %d hits, %d misses (%d%%)", m_iPoseCacheHits, m_iPoseCacheMisses, poses ? m_iPoseCacheHits * 100 / poses : 0);
+		gEngfuncs.Con_NPrintf(23, "Bounds cache: %d hits, %d misses (%d%%)", m_iBoundsCacheHits, m_iBoundsCacheMisses, bounds ? m_iBoundsCacheHits * 100 / bounds : 0);
+	}
+
+	m_iPoseCacheHits = 0;
+	m_iPoseCacheMisses = 0;
+	m_iBoundsCacheHits = 0;
+	m_iBoundsCacheMisses = 0;
+	m_flPoseStatsTime = m_clTime;
+
+	// Drop entities that stopped drawing once a second
+	if (m_clTime >= m_flPoseCachePruneTime && m_clTime < m_flPoseCachePruneTime + 1.0)
+		return;
+
+	for (auto it = m_poseCache.begin(); it != m_poseCache.end();)
+	{
+		// Also catches the clock going backwards on a map change
+		if (it->second.lastused < m_clTime - 1.0 || it->second.lastused > m_clTime)
+			it = m_poseCache.erase(it);
+		else
+			++it;
+	}
+
+	m_flPoseCachePruneTime = m_clTime;
+}
+
+/*
+====================
+StudioQueueBoneSetup
+
+====================
+*/
+void CStudioModelRenderer::StudioQueueBoneSetup(cl_entity_t* pentity)
+{
+	if (!pentity->model || pentity->model->type != mod_studio)
+		return;
+
+	m_boneSetupQueue.push_back(pentity);
+}
+
+/*
+====================
+StudioSetupQueuedBones
+
+Runs after HUD_CreateEntities, the draw calls then find
+the bones in the pose cache
+====================
+*/
+void CStudioModelRenderer::StudioSetupQueuedBones()
+{
+	if (m_boneSetupQueue.empty())
+		return;
+
+	m_bIsHardware = 0 != IEngineStudio.IsHardware();
+
+	if (m_pCvarBoneJobs->value < 1 || m_pCvarPoseCache->value < 1 || IEngineStudio.IsHardware() != 1)
+	{
+		m_boneSetupQueue.clear();
+		return;
+	}
+
+	IEngineStudio.GetTimes(&m_nFrameCount, &m_clTime, &m_clOldTime);
+	StudioPoseCacheFrame();
+
+	float(*protationmatrix)[3][4] = m_protationmatrix;
+	m_pPlayerInfo = NULL;
+	m_boneJobs.clear();
+	m_boneJobs.reserve(m_boneSetupQueue.size());
+
+	for (cl_entity_t* pentity : m_boneSetupQueue)
+	{
+		// Players need their gait, followers their parent's bones and some
+		// effects call the engine's random number generator, leave them to the draw
+		if (pentity->player || pentity->curstate.movetype == MOVETYPE_FOLLOW)
+			continue;
+
+		int renderfx = pentity->curstate.renderfx;
+		if (renderfx == kRenderFxDeadPlayer || renderfx == kRenderFxDistort || renderfx == kRenderFxHologram)
+			continue;
+
+		m_pCurrentEntity = pentity;
+		m_pRenderModel = pentity->model;
+		m_pStudioHeader = (studiohdr_t*)IEngineStudio.Mod_Extradata(m_pRenderModel);
+		if (!m_pStudioHeader || m_pStudioHeader->numbodyparts == 0)
+			continue;
+
+		if (m_pCurrentEntity->curstate.sequence >= m_pStudioHeader->numseq)
+			m_pCurrentEntity->curstate.sequence = 0;
+
+		// Demand loaded sequence groups go through the engine cache
+		mstudioseqdesc_t* pseqdesc = (mstudioseqdesc_t*)((byte*)m_pStudioHeader + m_pStudioHeader->seqindex) + m_pCurrentEntity->curstate.sequence;
+		if (pseqdesc->seqgroup != 0)
+			continue;
+
+		// The view isn't set up until after this, so cull against the last one with some
+		// padding. Anything it gets wrong still has its bones set up when drawn
+		float minsradius = Vector(pseqdesc->bbmin).Length();
+		float maxsradius = Vector(pseqdesc->bbmax).Length();
+		float radius = V_max(minsradius, maxsradius);
+		if (m_pCurrentEntity->curstate.scale > 0)
+			radius *= m_pCurrentEntity->curstate.scale;
+		radius += STUDIO_QUEUE_CULL_MARGIN;
+
+		Vector extents(radius, radius, radius);
+		if (SVD_CullViewBox(m_pCurrentEntity->origin - extents, m_pCurrentEntity->origin + extents))
+			continue;
+
+		const bool blendPrevSequence = StudioBlendsPrevSequence();
+		if (blendPrevSequence)
+		{
+			mstudioseqdesc_t* pprevseqdesc = (mstudioseqdesc_t*)((byte*)m_pStudioHeader + m_pStudioHeader->seqindex) + m_pCurrentEntity->latched.prevsequence;
+			if (pprevseqdesc->seqgroup != 0)
+				continue;
+		}
+
+		studiobonejob_t job;
+		job.pentity = pentity;
+		job.pstudiohdr = m_pStudioHeader;
+
+		// Same transform StudioDrawModel sets up, so the keys match
+		m_protationmatrix = &job.rotationmatrix;
+		StudioSetUpTransform(false);
+
+		uint64_t key = StudioPoseKey(StudioEstimateFrame(pseqdesc), blendPrevSequence);
+
+		// Listed twice, or already set up
+		studioposecache_t& pose = m_poseCache[{pentity, pentity->model}];
+		if (pose.key == key)
+			continue;
+
+		pose.key = key;
+		pose.numbones = 0;
+		pose.lastused = m_clTime;
+
+		job.ppose = &pose;
+		m_boneJobs.push_back(job);
+	}
+
+	m_protationmatrix = protationmatrix;
+	m_boneSetupQueue.clear();
+
+	if (m_boneJobs.empty())
+		return;
+
+	int numthreads = StudioJobs_NumThreads();
+	while ((int)m_boneWorkers.size() < numthreads)
+		m_boneWorkers.push_back(StudioCreateBoneWorker());
+
+	// Workers only build bones, their own pose cache stays off
+	static cvar_t disabled;
+	for (CStudioModelRenderer* pworker : m_boneWorkers)
+	{
+		pworker->m_clTime = m_clTime;
+		pworker->m_fDoInterp = m_fDoInterp;
+		pworker->m_bIsHardware = m_bIsHardware;
+		pworker->m_pPlayerInfo = NULL;
+		pworker->m_pCvarPoseCache = &disabled;
+		pworker->m_pCvarPoseCacheStats = &disabled;
+		pworker->m_flPoseStatsTime = m_clTime;
+	}
+
+	StudioJobs_Run(m_boneJobs.size(), &CStudioModelRenderer::StudioBoneJob, this);
+
+	for (studiobonejob_t& job : m_boneJobs)
+		job.ppose->numbones = job.pstudiohdr->numbones;
 }
 
+/*
+====================
+StudioBoneJob
+
+====================
+*/
+void CStudioModelRenderer::StudioBoneJob(int index, int thread, void* pdata)
+{
+	CStudioModelRenderer* prenderer = (CStudioModelRenderer*)pdata;
+	CStudioModelRenderer* pworker = prenderer->m_boneWorkers[thread];
+	studiobonejob_t& job = prenderer->m_boneJobs[index];
+
+	pworker->m_pCurrentEntity = job.pentity;
+	pworker->m_pRenderModel = job.pentity->model;
+	pworker->m_pStudioHeader = job.pstudiohdr;
+	pworker->m_protationmatrix = &job.rotationmatrix;
+	pworker->m_pbonetransform = &job.ppose->bonetransform;
+	pworker->m_plighttransform = &job.ppose->lighttransform;
+
+	pworker->StudioSetupBones();
+}
+
+/*
+====================
+StudioCreateBoneWorker
+
+====================
+*/
+CStudioModelRenderer* CStudioModelRenderer::StudioCreateBoneWorker()
+{
+	return new CStudioModelRenderer;
+}
 
 /*
 ====================
@@ -1155,6 +1639,7 @@ bool CStudioModelRenderer::StudioDrawModel(int flags)
 
 	m_pCurrentEntity = IEngineStudio.GetCurrentEntity();
 	IEngineStudio.GetTimes(&m_nFrameCount, &m_clTime, &m_clOldTime);
+	m_bIsHardware = 0 != IEngineStudio.IsHardware();
 	IEngineStudio.GetViewInfo(m_vRenderOrigin, m_vUp, m_vRight, m_vNormal);
 	IEngineStudio.GetAliasScale(&m_fSoftwareXScale, &m_fSoftwareYScale);
 
@@ -1444,6 +1929,7 @@ bool CStudioModelRenderer::StudioDrawPlayer(int flags, entity_state_t* pplayer)
 
 	m_pCurrentEntity = IEngineStudio.GetCurrentEntity();
 	IEngineStudio.GetTimes(&m_nFrameCount, &m_clTime, &m_clOldTime);
+	m_bIsHardware = 0 != IEngineStudio.IsHardware();
 	IEngineStudio.GetViewInfo(m_vRenderOrigin, m_vUp, m_vRight, m_vNormal);
 	IEngineStudio.GetAliasScale(&m_fSoftwareXScale, &m_fSoftwareYScale);
 
@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <unordered_map>
+#include <vector>
+
 #include "elight.h"
 #include "svdformat.h"
 
@@ -16,6 +19,73 @@ enum shadow_lightype_t
 	SL_TYPE_POINTLIGHT
 };
 
+// Shadow volume of one bodypart, reused while its key stays the same
+struct shadowvolumecache_t
+{
+	uint64_t key;
+	std::vector<Vector> vertexes;
+	std::vector<uint16_t> indexes;
+};
+
+struct entityshadowcache_t
+{
+	// Client time the entity last drew a shadow
+	double lastused;
+	shadowvolumecache_t bodyparts[MAXSTUDIOBODYPARTS];
+};
+
+// Shadow detail an entity was drawn at, kept between frames so
+// entities near a threshold don't switch back and forth
+struct entityshadowlod_t
+{
+	double lastused;
+	int lod;
+	bool faded;
+};
+
+// Per-entity caches are kept per model too, players draw their
+// weapon model while they're still the current entity
+struct studiocachekey_t
+{
+	cl_entity_t* pentity;
+	model_t* pmodel;
+
+	bool operator==(const studiocachekey_t& other) const { return pentity == other.pentity && pmodel == other.pmodel; }
+};
+
+struct studiocachehash_t
+{
+	size_t operator()(const studiocachekey_t& key) const { return std::hash<const void*>()(key.pentity) * 31 + std::hash<const void*>()(key.pmodel); }
+};
+
+// Bones an entity was set up with this frame, so extra draws of it
+// (mirrors, shadows, the local player) skip the animation work
+struct studioposecache_t
+{
+	double lastused;
+	uint64_t key;
+	int numbones;
+	float bonetransform[MAXSTUDIOBONES][3][4];
+	float lighttransform[MAXSTUDIOBONES][3][4];
+
+	// Bounding box from StudioGetMinsMaxs and what it was built from
+	double boundstime;
+	int boundssequence;
+	Vector boundsorigin;
+	Vector boundsangles;
+	Vector mins;
+	Vector maxs;
+};
+
+// Bone setup handed to the job pool by StudioSetupQueuedBones
+struct studiobonejob_t
+{
+	cl_entity_t* pentity;
+	studiohdr_t* pstudiohdr;
+	studioposecache_t* ppose;
+	float rotationmatrix[3][4];
+};
+
 /*
 ====================
 CStudioModelRenderer
@@ -74,7 +144,12 @@ public:
 	// Compute bone adjustments ( bone controllers )
 	virtual void StudioCalcBoneAdj(float dadt, float* adj, const byte* pcontroller1, const byte* pcontroller2, byte mouthopen);
 
-	// Get bone quaternions
+	// Get bone angles on the frames either side of the one being drawn,
+	// StudioCalcRotations turns them into quaternions for all bones at once
+	virtual void StudioCalcBoneAngles(int frame, mstudiobone_t* pbone, mstudioanim_t* panim, float* adj, float* angle1, float* angle2);
+
+	// Get bone quaternions, one bone through the same path as StudioCalcRotations.
+	// Kept for subclasses that call it, StudioCalcRotations doesn't
 	virtual void StudioCalcBoneQuaterion(int frame, float s, mstudiobone_t* pbone, mstudioanim_t* panim, float* adj, float* q);
 
 	// Get bone positions
@@ -103,6 +178,39 @@ public:
 	// Process movement of player
 	virtual void StudioProcessGait(entity_state_t* pplayer);
 
+	// Pose cache
+	// Key of the current entity and model in the per-entity caches
+	studiocachekey_t StudioCacheKey() { return {m_pCurrentEntity, m_pRenderModel}; }
+
+	// Hashes everything StudioSetupBones reads for the current entity
+	virtual uint64_t StudioPoseKey(float frame, bool blendPrevSequence);
+
+	// Copies cached bones into the transforms, returns false on a miss
+	virtual bool StudioRestorePose(uint64_t key);
+
+	// Saves the bones StudioSetupBones just built
+	virtual void StudioStorePose(uint64_t key);
+
+	// Prints and resets the counters, and prunes old entries, on a new frame
+	virtual void StudioPoseCacheFrame();
+
+	// Tells if StudioSetupBones blends in the previous sequence
+	virtual bool StudioBlendsPrevSequence();
+
+	// Bone setup jobs
+	// Adds an entity on this frame's visible list to the bone setup pre-pass
+	virtual void StudioQueueBoneSetup(cl_entity_t* pentity);
+
+	// Sets up the bones of queued entities on the job pool, straight into the pose cache
+	virtual void StudioSetupQueuedBones();
+
+	// Runs one bone setup job
+	static void StudioBoneJob(int index, int thread, void* pdata);
+
+	// Creates a renderer for a pool thread to set up bones on, override it along
+	// with anything the bone setup uses so the workers run the same code
+	virtual CStudioModelRenderer* StudioCreateBoneWorker();
+
 	// Stencil shadow stuff
 public:
 	// Gets entity lights for a model
@@ -120,9 +228,33 @@ public:
 	// Draws a shadow volume
 	virtual void StudioDrawShadowVolume();
 
+	// Submits a built shadow volume to the stencil buffer
+	virtual void StudioDrawShadowVolumeData(const Vector* pvertexdata, int numVertexes, const uint16_t* pindexdata, int numIndexes);
+
+	// Hashes everything a shadow volume depends on besides the submodel
+	virtual uint64_t StudioShadowVolumeKey();
+
+	// Drops cached volumes of entities that stopped casting shadows
+	virtual void StudioPruneShadowCache();
+
+	// Builds the shadow volume index list, reference implementation
+	virtual int StudioBuildShadowVolume_Scalar();
+
+	// Builds the shadow volume index list four vertices/faces at a time
+	virtual int StudioBuildShadowVolume_SSE();
+
+	// Adds the silhouette edges to the shadow volume index list
+	virtual int StudioBuildShadowVolumeEdges(int numIndexes);
+
 	// Tells if we should draw a shadow for this ent
 	virtual bool StudioShouldDrawShadow();
 
+	// Picks the shadow LOD, returns false if the shadow is faded out or over budget
+	virtual bool StudioSelectShadowLOD();
+
+	// Prints and resets the shadow LOD counters when a new frame starts
+	virtual void StudioShadowLODFrame();
+
 	// Sets up the shadow info
 	virtual void StudioSetupShadows();
 
@@ -140,6 +272,9 @@ public:
 	// Current render frame #
 	int m_nFrameCount;
 
+	// Hardware renderer? Read on the main thread, bone jobs can't ask the engine
+	bool m_bIsHardware;
+
 	// Cvars that studio model code needs to reference
 	//
 	// Use high quality models?
@@ -251,6 +386,80 @@ public:
 	cvar_t* m_pCvarDrawStencilShadows;
 	// Extrusion length for stencil shadow volumes
 	cvar_t* m_pCvarShadowVolumeExtrudeDistance;
+	// Selects the shadow volume kernel (0 = scalar, 1 = SSE, 2 = SSE verified against scalar)
+	cvar_t* m_pCvarShadowSIMD;
+	// Toggles streaming shadow volumes through buffer objects instead of client side arrays
+	cvar_t* m_pCvarShadowVBO;
+	// Tells if the shadow buffers are bound for the current shadow
+	bool m_bShadowBuffersBound;
+	// Toggles darkening the world from a static buffer instead of walking the BSP
+	cvar_t* m_pCvarShadowWorldVBO;
+	// How shadowed pixels are darkened (0 = redraw the world, 1 = full-screen quad)
+	cvar_t* m_pCvarShadowResolve;
+	// Shows how the shadow FBO reaches the screen and the bytes it copies
+	cvar_t* m_pCvarShadowFBOStats;
+
+	// Toggles reuse of shadow volumes for entities that didn't change
+	cvar_t* m_pCvarShadowCache;
+	// Cached shadow volumes per entity and model
+	std::unordered_map<studiocachekey_t, entityshadowcache_t, studiocachehash_t> m_shadowCache;
+	// Cache of the entity being drawn, NULL if caching is off
+	entityshadowcache_t* m_pShadowCache;
+	// Key of the entity being drawn
+	uint64_t m_shadowCacheKey;
+	// Bodypart being drawn
+	int m_iShadowBodyPart;
+	// Client time of the last prune
+	double m_flShadowCachePruneTime;
+
+	// Toggles picking reduced shadow meshes for small casters
+	cvar_t* m_pCvarShadowLOD;
+	// Projected radius in pixels below which the first LOD is used, each further LOD halves it
+	cvar_t* m_pCvarShadowLODPixels;
+	// Distance beyond which casters drop their shadow, 0 keeps them all
+	cvar_t* m_pCvarShadowFadeDistance;
+	// Shadow volume triangles allowed per frame, 0 is unlimited
+	cvar_t* m_pCvarShadowBudget;
+	// Shows shadows drawn per LOD
+	cvar_t* m_pCvarShadowLODStats;
+	// LOD state per entity and model
+	std::unordered_map<studiocachekey_t, entityshadowlod_t, studiocachehash_t> m_shadowLODs;
+	// LOD of the entity being drawn
+	int m_iShadowLOD;
+	// Frame the counters below belong to
+	int m_iShadowStatsFrame;
+	// Shadows drawn at each LOD this frame
+	int m_iShadowLODCounts[SVD_MAX_LODS + 1];
+	// Shadows dropped for distance or budget this frame
+	int m_iShadowsFaded;
+	int m_iShadowsOverBudget;
+	// Shadow volume triangles submitted this frame
+	int m_iShadowTriangles;
 	// Tells if two sided stencil test is supported
 	bool m_bTwoSideSupported;
+
+	// Toggles reuse of bones set up earlier in the same frame
+	cvar_t* m_pCvarPoseCache;
+	// Shows the pose cache hit rate
+	cvar_t* m_pCvarPoseCacheStats;
+	// Cached poses per entity and model
+	std::unordered_map<studiocachekey_t, studioposecache_t, studiocachehash_t> m_poseCache;
+	// Client time the counters below belong to
+	double m_flPoseStatsTime;
+	// Client time of the last prune
+	double m_flPoseCachePruneTime;
+	// Bone setups and bounding boxes served from the cache this frame, or rebuilt
+	int m_iPoseCacheHits;
+	int m_iPoseCacheMisses;
+	int m_iBoundsCacheHits;
+	int m_iBoundsCacheMisses;
+
+	// Toggles setting up bones on the job pool before rendering
+	cvar_t* m_pCvarBoneJobs;
+	// Entities added to the visible list this frame
+	std::vector<cl_entity_t*> m_boneSetupQueue;
+	// Jobs of the current pre-pass
+	std::vector<studiobonejob_t> m_boneJobs;
+	// Renderer state for each pool thread, the draw state of this one is left alone
+	std::vector<CStudioModelRenderer*> m_boneWorkers;
 };
@@ -14,10 +14,14 @@
 #include "pm_shared.h"
 #include "Exports.h"
 
+#include "svd_render.h"
+
 #include "particleman.h"
 extern IParticleMan* g_pParticleMan;
 
 void Game_AddObjects();
+void R_StudioQueueBoneSetup(cl_entity_t* pentity);
+void R_StudioSetupQueuedBones();
 
 extern Vector v_origin;
 
@@ -58,6 +62,12 @@ int DLLEXPORT HUD_AddEntity(int type, struct cl_entity_s* ent, const char* model
 			return 0; // don't draw the player we are following in eye
 	}
 
+	// Collect for the stencil shadow visibility pass
+	SVD_AddShadowCaster(ent);
+
+	// And for the bone setup pre-pass
+	R_StudioQueueBoneSetup(ent);
+
 	return 1;
 }
 
@@ -310,6 +320,9 @@ void DLLEXPORT HUD_CreateEntities()
 	Game_AddObjects();
 
 	GetClientVoiceMgr()->CreateEntities();
+
+	// Everything on the visible list is known now, animate it before drawing starts
+	R_StudioSetupQueuedBones();
 }
 
 
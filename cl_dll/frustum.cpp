@@ -0,0 +1,512 @@
+//========= Copyright © 1996-2002, Valve LLC, All rights reserved. ============
+//
+// Purpose: View frustum planes and box/sphere culling against them
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include <math.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "hud.h"
+#include "cl_util.h"
+#include "const.h"
+#include "com_model.h"
+#include "studio_util.h"
+#include "frustum.h"
+
+#ifndef M_PI
+#define M_PI		3.14159265358979323846	// matches value in gcc v2 math.h
+#endif
+
+#define DEG2RAD( a ) ( a * M_PI ) / 180.0F
+
+/*
+====================
+RotatePointAroundVector
+
+====================
+*/
+void RotatePointAroundVector( Vector& vDest, const Vector& vDir, const Vector& vPoint, float flDegrees )
+{
+	float q[3];
+	float q3;
+	float t[3];
+	float t3;
+	float hrad;
+	float s;
+
+	hrad = DEG2RAD(flDegrees) / 2;
+	s = sin(hrad);
+	VectorScale(vDir, s, q);
+	q3 = cos(hrad);
+
+	CrossProduct(q, vPoint, t);
+	VectorMA(t, q3, vPoint, t);
+	t3 = DotProduct(q, vPoint);
+
+	CrossProduct(q, t, vDest);
+	VectorMA(vDest, t3, q, vDest);
+	VectorMA(vDest, q3, t, vDest);
+}
+
+/*
+====================
+Frustum_SetPlane
+
+====================
+*/
+void Frustum_SetPlane( frustum_t* pfrustum, int index, const float* pnormal, float dist )
+{
+	pfrustum->signbits[index] = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		pfrustum->normals[index][i] = pnormal[i];
+		if(pnormal[i] < 0)
+			pfrustum->signbits[index] |= 1<<i;
+	}
+
+	pfrustum->dists[index] = dist;
+}
+
+/*
+====================
+Frustum_SetFromView
+
+====================
+*/
+void Frustum_SetFromView( frustum_t* pfrustum, const Vector& angles, const Vector& origin, float fov )
+{
+	Vector vpn, up, right;
+	gEngfuncs.pfnAngleVectors(angles, vpn, right, up);
+
+	Vector normals[4];
+	RotatePointAroundVector(normals[0], up, vpn, -(90-fov / 2));
+	RotatePointAroundVector(normals[1], up, vpn, 90-fov / 2);
+	RotatePointAroundVector(normals[2], right, vpn, 90-fov / 2);
+	RotatePointAroundVector(normals[3], right, vpn, -(90 - fov / 2));
+
+	pfrustum->numplanes = 4;
+	for(int i = 0; i < 4; i++)
+		Frustum_SetPlane(pfrustum, i, normals[i], DotProduct(origin, normals[i]));
+}
+
+/*
+====================
+Frustum_SetFromMatrices
+
+Planes are the w row of the clip matrix plus or minus the others,
+in right, left, bottom, top, far, near order
+====================
+*/
+void Frustum_SetFromMatrices( frustum_t* pfrustum, const float* pprojection, const float* pmodelview )
+{
+	// Both are column major, so clip = modelview * projection
+	float clip[16];
+	for(int i = 0; i < 4; i++)
+	{
+		for(int j = 0; j < 4; j++)
+		{
+			clip[i*4+j] = pmodelview[i*4+0] * pprojection[0*4+j] + pmodelview[i*4+1] * pprojection[1*4+j]
+				+ pmodelview[i*4+2] * pprojection[2*4+j] + pmodelview[i*4+3] * pprojection[3*4+j];
+		}
+	}
+
+	static const int planerows[6][2] = { {0, -1}, {0, 1}, {1, 1}, {1, -1}, {2, -1}, {2, 1} };
+
+	pfrustum->numplanes = 6;
+	for(int i = 0; i < 6; i++)
+	{
+		float plane[4];
+		for(int j = 0; j < 4; j++)
+			plane[j] = clip[j*4+3] + planerows[i][1] * clip[j*4+planerows[i][0]];
+
+		float length = sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if(length == 0)
+		{
+			// Degenerate matrix, keep everything
+			const float zero[3] = { 0, 0, 0 };
+			Frustum_SetPlane(pfrustum, i, zero, -1);
+			continue;
+		}
+
+		const float normal[3] = { plane[0] / length, plane[1] / length, plane[2] / length };
+		Frustum_SetPlane(pfrustum, i, normal, -plane[3] / length);
+	}
+}
+
+/*
+====================
+Frustum_Expand
+
+====================
+*/
+void Frustum_Expand( frustum_t* pfrustum, float size )
+{
+	for(int i = 0; i < pfrustum->numplanes; i++)
+	{
+		const float* pnormal = pfrustum->normals[i];
+		pfrustum->dists[i] -= size * (fabs(pnormal[0]) + fabs(pnormal[1]) + fabs(pnormal[2]));
+	}
+}
+
+/*
+====================
+Frustum_CullBox
+
+====================
+*/
+bool Frustum_CullBox( const frustum_t* pfrustum, const Vector& mins, const Vector& maxs )
+{
+	for(int i = 0; i < pfrustum->numplanes; i++)
+	{
+		const float* pnormal = pfrustum->normals[i];
+		int bits = pfrustum->signbits[i];
+
+		// Corner furthest along the normal
+		float x = (bits & 1) ? mins[0] : maxs[0];
+		float y = (bits & 2) ? mins[1] : maxs[1];
+		float z = (bits & 4) ? mins[2] : maxs[2];
+
+		if(pnormal[0] * x + pnormal[1] * y + pnormal[2] * z < pfrustum->dists[i])
+			return true;
+	}
+
+	return false;
+}
+
+/*
+====================
+Frustum_CullSphere
+
+====================
+*/
+bool Frustum_CullSphere( const frustum_t* pfrustum, const Vector& origin, float radius )
+{
+	for(int i = 0; i < pfrustum->numplanes; i++)
+	{
+		const float* pnormal = pfrustum->normals[i];
+		if(pnormal[0] * origin[0] + pnormal[1] * origin[1] + pnormal[2] * origin[2] - pfrustum->dists[i] <= -radius)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+====================
+Frustum_ContainsBox
+
+====================
+*/
+bool Frustum_ContainsBox( const frustum_t* pfrustum, const Vector& mins, const Vector& maxs )
+{
+	for(int i = 0; i < pfrustum->numplanes; i++)
+	{
+		const float* pnormal = pfrustum->normals[i];
+		int bits = pfrustum->signbits[i];
+
+		// Corner nearest along the normal
+		float x = (bits & 1) ? maxs[0] : mins[0];
+		float y = (bits & 2) ? maxs[1] : mins[1];
+		float z = (bits & 4) ? maxs[2] : mins[2];
+
+		if(pnormal[0] * x + pnormal[1] * y + pnormal[2] * z - pfrustum->dists[i] <= 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+====================
+Frustum_CullBoxes
+
+====================
+*/
+int Frustum_CullBoxes( const frustum_t* pfrustum, const float* const pmins[3], const float* const pmaxs[3], int count, int* pvisible )
+{
+	int numvisible = 0;
+	int i = 0;
+
+#ifdef STUDIO_SSE2
+	__m128 normals[FRUSTUM_MAX_PLANES][3];
+	__m128 dists[FRUSTUM_MAX_PLANES];
+	for(int j = 0; j < pfrustum->numplanes; j++)
+	{
+		for(int k = 0; k < 3; k++)
+			normals[j][k] = _mm_set1_ps(pfrustum->normals[j][k]);
+
+		dists[j] = _mm_set1_ps(pfrustum->dists[j]);
+	}
+
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 outside = _mm_setzero_ps();
+		for(int j = 0; j < pfrustum->numplanes; j++)
+		{
+			int bits = pfrustum->signbits[j];
+
+			// Same corner and sums as Frustum_CullBox
+			__m128 x = _mm_loadu_ps(&((bits & 1) ? pmins[0] : pmaxs[0])[i]);
+			__m128 y = _mm_loadu_ps(&((bits & 2) ? pmins[1] : pmaxs[1])[i]);
+			__m128 z = _mm_loadu_ps(&((bits & 4) ? pmins[2] : pmaxs[2])[i]);
+
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normals[j][0], x), _mm_mul_ps(normals[j][1], y)), _mm_mul_ps(normals[j][2], z));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, dists[j]));
+
+			if(_mm_movemask_ps(outside) == 15)
+				break;
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for(int k = 0; k < 4; k++)
+		{
+			if(!(mask & (1 << k)))
+				pvisible[numvisible++] = i + k;
+		}
+	}
+#endif
+
+	for(; i < count; i++)
+	{
+		Vector mins(pmins[0][i], pmins[1][i], pmins[2][i]);
+		Vector maxs(pmaxs[0][i], pmaxs[1][i], pmaxs[2][i]);
+
+		if(!Frustum_CullBox(pfrustum, mins, maxs))
+			pvisible[numvisible++] = i;
+	}
+
+	return numvisible;
+}
+
+/*
+====================
+Frustum_CullSpheres
+
+====================
+*/
+int Frustum_CullSpheres( const frustum_t* pfrustum, const float* const porigins[3], const float* pradii, int count, int* pvisible )
+{
+	int numvisible = 0;
+	int i = 0;
+
+#ifdef STUDIO_SSE2
+	__m128 normals[FRUSTUM_MAX_PLANES][3];
+	__m128 dists[FRUSTUM_MAX_PLANES];
+	for(int j = 0; j < pfrustum->numplanes; j++)
+	{
+		for(int k = 0; k < 3; k++)
+			normals[j][k] = _mm_set1_ps(pfrustum->normals[j][k]);
+
+		dists[j] = _mm_set1_ps(pfrustum->dists[j]);
+	}
+
+	const __m128 signmask = _mm_set1_ps(-0.0f);
+
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&porigins[0][i]);
+		__m128 y = _mm_loadu_ps(&porigins[1][i]);
+		__m128 z = _mm_loadu_ps(&porigins[2][i]);
+		__m128 negradii = _mm_xor_ps(_mm_loadu_ps(&pradii[i]), signmask);
+
+		__m128 outside = _mm_setzero_ps();
+		for(int j = 0; j < pfrustum->numplanes; j++)
+		{
+			// Same sums as Frustum_CullSphere
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normals[j][0], x), _mm_mul_ps(normals[j][1], y)), _mm_mul_ps(normals[j][2], z));
+			outside = _mm_or_ps(outside, _mm_cmple_ps(_mm_sub_ps(dist, dists[j]), negradii));
+
+			if(_mm_movemask_ps(outside) == 15)
+				break;
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for(int k = 0; k < 4; k++)
+		{
+			if(!(mask & (1 << k)))
+				pvisible[numvisible++] = i + k;
+		}
+	}
+#endif
+
+	for(; i < count; i++)
+	{
+		Vector origin(porigins[0][i], porigins[1][i], porigins[2][i]);
+
+		if(!Frustum_CullSphere(pfrustum, origin, pradii[i]))
+			pvisible[numvisible++] = i;
+	}
+
+	return numvisible;
+}
+
+/*
+====================
+Frustum_TestBatch
+
+Runs the single object tests and the batched ones over the same
+objects, prints the timings and returns how many results differ
+====================
+*/
+int Frustum_TestBatch( const char* pname, const frustum_t* pfrustum, const float* const pmins[3], const float* const pmaxs[3], const float* pradii, int count )
+{
+	std::vector<int> scalar(count);
+	std::vector<int> batched(count);
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int numscalar = 0;
+	for(int i = 0; i < count; i++)
+	{
+		Vector mins(pmins[0][i], pmins[1][i], pmins[2][i]);
+		Vector maxs(pmaxs[0][i], pmaxs[1][i], pmaxs[2][i]);
+
+		bool culled = pradii ? Frustum_CullSphere(pfrustum, mins, pradii[i]) : Frustum_CullBox(pfrustum, mins, maxs);
+		if(!culled)
+			scalar[numscalar++] = i;
+	}
+
+	auto middle = std::chrono::high_resolution_clock::now();
+
+	int numbatched = pradii ? Frustum_CullSpheres(pfrustum, pmins, pradii, count, batched.data())
+		: Frustum_CullBoxes(pfrustum, pmins, pmaxs, count, batched.data());
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	// Both lists are sorted, count the indexes only one of them has
+	int nummismatches = 0;
+	int j = 0, k = 0;
+	while(j < numscalar || k < numbatched)
+	{
+		if(k == numbatched || (j < numscalar && scalar[j] < batched[k]))
+		{
+			nummismatches++;
+			j++;
+		}
+		else if(j == numscalar || batched[k] < scalar[j])
+		{
+			nummismatches++;
+			k++;
+		}
+		else
+		{
+			j++;
+			k++;
+		}
+	}
+
+	double scalartime = std::chrono::duration<double, std::nano>(middle - start).count() / count;
+	double batchedtime = std::chrono::duration<double, std::nano>(end - middle).count() / count;
+
+	gEngfuncs.Con_Printf("%s, %d x %d planes: %d visible, scalar %.1f ns, batched %.1f ns (%.2fx), %d mismatches\n",
+		pname, count, pfrustum->numplanes, numscalar, scalartime, batchedtime, batchedtime > 0 ? scalartime / batchedtime : 0.0, nummismatches);
+
+	return nummismatches;
+}
+
+/*
+====================
+Frustum_Test_f
+
+Checks the batched culling against the single object tests
+====================
+*/
+void Frustum_Test_f( void )
+{
+	int count = 100000;
+	if(gEngfuncs.Cmd_Argc() > 1)
+		count = atoi(gEngfuncs.Cmd_Argv(1));
+
+	if(count < 1)
+		count = 1;
+
+	Vector origin(0, 0, 0);
+	cl_entity_t* pplayer = gEngfuncs.GetLocalPlayer();
+	if(pplayer)
+		origin = pplayer->origin;
+
+	Vector angles;
+	gEngfuncs.GetViewAngles(angles);
+
+	// Odd counts leave a tail for the scalar loop
+	std::vector<float> mins[3], maxs[3];
+	std::vector<float> radii(count);
+	for(int i = 0; i < 3; i++)
+	{
+		mins[i].resize(count);
+		maxs[i].resize(count);
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		for(int j = 0; j < 3; j++)
+		{
+			float center = origin[j] + gEngfuncs.pfnRandomFloat(-2048, 2048);
+			float size = gEngfuncs.pfnRandomFloat(0, 128);
+			mins[j][i] = center - size;
+			maxs[j][i] = center + size;
+		}
+
+		radii[i] = gEngfuncs.pfnRandomFloat(0, 128);
+	}
+
+	const float* pmins[3] = { mins[0].data(), mins[1].data(), mins[2].data() };
+	const float* pmaxs[3] = { maxs[0].data(), maxs[1].data(), maxs[2].data() };
+
+	frustum_t view;
+	Frustum_SetFromView(&view, angles, origin, 90);
+
+	frustum_t expanded = view;
+	Frustum_Expand(&expanded, 64);
+
+	// GL style perspective looking down -z from the origin, with an identity modelview
+	const float nearz = 4, farz = 4096;
+	const float f = 1.0f / tan(DEG2RAD(90.0f) * 0.5f);
+	const float projection[16] = {
+		f, 0, 0, 0,
+		0, f, 0, 0,
+		0, 0, (farz + nearz) / (nearz - farz), -1,
+		0, 0, 2 * farz * nearz / (nearz - farz), 0 };
+	const float modelview[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+	frustum_t matrices;
+	Frustum_SetFromMatrices(&matrices, projection, modelview);
+
+	// The matrix frustum has to face the right way for the numbers to mean anything
+	int nummismatches = 0;
+	if(Frustum_CullSphere(&matrices, Vector(0, 0, -100), 0) || !Frustum_CullSphere(&matrices, Vector(0, 0, 100), 0)
+		|| !Frustum_CullSphere(&matrices, Vector(0, 0, -5000), 0) || !Frustum_CullSphere(&matrices, Vector(200, 0, -100), 0))
+	{
+		gEngfuncs.Con_Printf("Frustum planes from matrices face the wrong way\n");
+		nummismatches++;
+	}
+
+	// Spheres reuse the box mins as their origins
+	nummismatches += Frustum_TestBatch("View boxes", &view, pmins, pmaxs, nullptr, count);
+	nummismatches += Frustum_TestBatch("View spheres", &view, pmins, pmaxs, radii.data(), count);
+	nummismatches += Frustum_TestBatch("Expanded view boxes", &expanded, pmins, pmaxs, nullptr, count);
+	nummismatches += Frustum_TestBatch("Matrix boxes", &matrices, pmins, pmaxs, nullptr, count);
+	nummismatches += Frustum_TestBatch("Matrix spheres", &matrices, pmins, pmaxs, radii.data(), count);
+
+#ifdef STUDIO_SSE2
+	const char* pkernel = "SSE2";
+#else
+	const char* pkernel = "scalar";
+#endif
+	gEngfuncs.Con_Printf("Frustum test %s with %s batches\n", nummismatches ? "FAILED" : "passed", pkernel);
+}
+
+/*
+====================
+Frustum_Init
+
+====================
+*/
+void Frustum_Init( void )
+{
+	gEngfuncs.pfnAddCommand("r_frustum_test", Frustum_Test_f);
+}
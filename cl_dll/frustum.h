@@ -0,0 +1,47 @@
+//========= Copyright © 1996-2002, Valve LLC, All rights reserved. ============
+//
+// Purpose: View frustum planes and box/sphere culling against them
+//
+// $NoKeywords: $
+//=============================================================================
+
+#pragma once
+
+#define FRUSTUM_MAX_PLANES 6
+
+// Planes face into the frustum, a point is inside a plane when
+// DotProduct(normal, point) - dist is positive
+struct frustum_t
+{
+	int numplanes;
+	float normals[FRUSTUM_MAX_PLANES][3];
+	float dists[FRUSTUM_MAX_PLANES];
+	int signbits[FRUSTUM_MAX_PLANES]; // Bit per axis with a negative normal
+};
+
+// Four side planes of a view with the same fov on both axes
+extern void Frustum_SetFromView( frustum_t* pfrustum, const Vector& angles, const Vector& origin, float fov );
+
+// Six planes of an OpenGL projection and modelview matrix pair
+extern void Frustum_SetFromMatrices( frustum_t* pfrustum, const float* pprojection, const float* pmodelview );
+
+// Moves the planes out so boxes test as if grown by size on every side
+extern void Frustum_Expand( frustum_t* pfrustum, float size );
+
+// True if the box is entirely behind one of the planes
+extern bool Frustum_CullBox( const frustum_t* pfrustum, const Vector& mins, const Vector& maxs );
+
+// True if the sphere is behind one of the planes, a zero radius tests a point
+extern bool Frustum_CullSphere( const frustum_t* pfrustum, const Vector& origin, float radius );
+
+// True if the whole box is in front of every plane
+extern bool Frustum_ContainsBox( const frustum_t* pfrustum, const Vector& mins, const Vector& maxs );
+
+// Batched versions of Frustum_CullBox and Frustum_CullSphere, four at a time with SSE2.
+// Objects are given per axis, pmins[axis][i], and the indexes of the ones that aren't
+// culled are written to pvisible in ascending order. Returns how many that was
+extern int Frustum_CullBoxes( const frustum_t* pfrustum, const float* const pmins[3], const float* const pmaxs[3], int count, int* pvisible );
+extern int Frustum_CullSpheres( const frustum_t* pfrustum, const float* const porigins[3], const float* pradii, int count, int* pvisible );
+
+// Adds the r_frustum_test command
+extern void Frustum_Init();
@@ -32,6 +32,7 @@
 
 #include "lightlist.h"
 #include "svd_render.h"
+#include "frustum.h"
 #include "svdformat.h"
 #include "svd_render.h"
 
@@ -381,6 +382,7 @@ void CHud::Init()
 	MsgFunc_ResetHUD(0, 0, NULL);
 
 	gLightList.Init();
+	Frustum_Init();
 
 #ifdef STEAM_RICH_PRESENCE
 	gEngfuncs.pfnClientCmd("richpresence_gamemode\n"); // reset
@@ -407,8 +409,6 @@ CHud::~CHud()
 		}
 		m_pHudList = NULL;
 	}
-
-	SVD_Shutdown();
 }
 
 // GetSpriteIndex()
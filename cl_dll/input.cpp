@@ -1012,6 +1012,7 @@ void ShutdownInput()
 
 #include "interface.h"
 void CL_UnloadParticleMan();
+void R_StudioShutdown();
 
 
 void DLLEXPORT HUD_Shutdown()
@@ -1020,6 +1021,8 @@ void DLLEXPORT HUD_Shutdown()
 
 	ShutdownInput();
 
+	R_StudioShutdown();
+
 
 	FileSystem_FreeFileSystem();
 	CL_UnloadParticleMan();
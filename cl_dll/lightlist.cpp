@@ -25,6 +25,10 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
 #include "lightlist.h"
 
 #include "pmtrace.h"
@@ -38,6 +42,8 @@
 #include "com_model.h"
 #include "r_studioint.h"
 #include "svd_render.h"
+#include "studio_util.h"
+#include "frustum.h"
 
 #define GLEW_STATIC 1
 #include "GL/glew.h"
@@ -46,7 +52,6 @@
 CLightList gLightList;
 
 // msurface_t struct size
-extern int g_msurfaceStructSize;
 
 extern engine_studio_api_t IEngineStudio;
 
@@ -104,6 +109,24 @@ void __CmdFunc_MakeLight( void )
 	gLightList.AddLight(entIndex, gHUD.m_vecOrigin, lightColor, radius, false);
 }
 
+//===========================================
+//
+//
+//===========================================
+void __CmdFunc_LightsBench( void )
+{
+	gLightList.BenchmarkBBoxes();
+}
+
+//===========================================
+//
+//
+//===========================================
+void __CmdFunc_LightGridBench( void )
+{
+	gLightList.BenchmarkGrid();
+}
+
 //===========================================
 //
 //
@@ -121,11 +144,15 @@ void CLightList::Init( void )
 {
 	// Create debug fn
 	gEngfuncs.pfnAddCommand("make_light", __CmdFunc_MakeLight);
+	gEngfuncs.pfnAddCommand("r_lights_bench", __CmdFunc_LightsBench);
+	gEngfuncs.pfnAddCommand("cl_lightgridbench", __CmdFunc_LightGridBench);
 
 	// Register client message
 	HOOK_MESSAGE(LightSource);
 
 	m_pCvarDebugELights = CVAR_CREATE( "r_debug_lights", "0", FCVAR_CLIENTDLL );
+	m_pCvarCullLights = CVAR_CREATE( "r_lights_cull", "1", FCVAR_CLIENTDLL );
+	m_pCvarLightStats = CVAR_CREATE( "r_lights_stats", "0", FCVAR_CLIENTDLL );
 }
 
 /*
@@ -144,6 +171,22 @@ void CLightList::VidInit( void )
 	memset(m_pTempEntityLights, 0, sizeof(m_pTempEntityLights));
 	m_iNumTempEntityLights = 0;
 
+	// Clear the light grid
+	m_lightGrid.clear();
+	m_oversizedLights.clear();
+	m_lightTraceCache.clear();
+	m_lightIndexes.clear();
+	memset(m_lightCells, 0, sizeof(m_lightCells));
+	memset(m_lightQueryStamps, 0, sizeof(m_lightQueryStamps));
+	m_iLightQuery = 0;
+
+	// Nothing is culled until the first view is set up
+	m_visibleLights.clear();
+	m_visibleTempLights.clear();
+	m_visibleLightsValid = false;
+	m_iNumLightQueries = 0;
+	m_iNumLightsTested = 0;
+
 	// Get pointer to first elight
 	m_pGoldSrcELights = gEngfuncs.pEfxAPI->CL_AllocElight(0);
 	m_pGoldSrcDLights = gEngfuncs.pEfxAPI->CL_AllocDlight(0);
@@ -161,13 +204,13 @@ AddEntityLight
 void CLightList::AddLight( int entindex, const Vector& origin, const Vector& color, float radius, bool isTemporary )
 {
 	elight_t* plight = NULL;
-	for(int i = 0; i < m_iNumEntityLights; i++)
+	int index = -1;
+
+	auto it = m_lightIndexes.find(entindex);
+	if(it != m_lightIndexes.end())
 	{
-		if(m_pEntityLights[i].entindex == entindex)
-		{
-			plight = &m_pEntityLights[i];
-			break;
-		}
+		index = it->second;
+		plight = &m_pEntityLights[index];
 	}
 
 	if(!plight)
@@ -178,7 +221,11 @@ void CLightList::AddLight( int entindex, const Vector& origin, const Vector& col
 				return;
 
 			plight = &m_pEntityLights[m_iNumEntityLights];
+			index = m_iNumEntityLights;
 			m_iNumEntityLights++;
+
+			if(entindex != -1)
+				m_lightIndexes[entindex] = index;
 		}
 		else
 		{
@@ -201,6 +248,14 @@ void CLightList::AddLight( int entindex, const Vector& origin, const Vector& col
 		plight->mins[i] = plight->origin[i] - plight->radius;
 		plight->maxs[i] = plight->origin[i] + plight->radius;
 	}
+
+	// Only entity lights live in the grid
+	if(index != -1)
+	{
+		LinkLight(index);
+		m_lightTraceCache.clear();
+		m_visibleLightsValid = false;
+	}
 }
 
 /*
@@ -211,17 +266,379 @@ AddEntityLight
 */
 void CLightList::RemoveLight( int entindex )
 {
+	auto it = m_lightIndexes.find(entindex);
+	if(it == m_lightIndexes.end())
+		return;
+
+	int i = it->second;
+	m_lightIndexes.erase(it);
+
+	// Shift the lights after it down, the list order decides which
+	// lights make the cut. Only the shifted ones need relinking
+	int last = m_iNumEntityLights-1;
+	for(int j = i; j <= last; j++)
+		UnlinkLight(j);
+
+	for(int j = i; j < last; j++)
+	{
+		m_pEntityLights[j] = m_pEntityLights[j+1];
+		LinkLight(j);
+
+		if(m_pEntityLights[j].entindex != -1)
+			m_lightIndexes[m_pEntityLights[j].entindex] = j;
+	}
+
+	m_iNumEntityLights--;
+	m_lightTraceCache.clear();
+	m_visibleLightsValid = false;
+}
+
+/*
+====================
+GetGridCells
+
+====================
+*/
+void CLightList::GetGridCells( const Vector& mins, const Vector& maxs, int* cellmins, int* cellmaxs )
+{
+	for(int i = 0; i < 3; i++)
+	{
+		cellmins[i] = (int)floor(mins[i] / LIGHT_GRID_CELL_SIZE);
+		cellmaxs[i] = (int)floor(maxs[i] / LIGHT_GRID_CELL_SIZE);
+	}
+}
+
+//=============================================
+// @brief Packs cell coordinates into a grid key, far apart
+// cells may share a key, which only adds candidates
+//
+//=============================================
+inline unsigned int LightGridKey( int x, int y, int z )
+{
+	return ((unsigned int)(x & 1023) << 20) | ((unsigned int)(y & 1023) << 10) | (unsigned int)(z & 1023);
+}
+
+//=============================================
+// @brief Hashes an exact vertex position, -0 and 0 share a key
+//
+//=============================================
+inline unsigned int LightVertKey( const Vector& origin )
+{
+	unsigned int key = 2166136261u;
+	for(int i = 0; i < 3; i++)
+	{
+		float value = origin[i];
+		if(value == 0.0f)
+			value = 0.0f;
+
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		key = (key ^ bits) * 16777619u;
+	}
+
+	return key;
+}
+
+/*
+====================
+LinkLight
+
+====================
+*/
+void CLightList::LinkLight( int index )
+{
+	elight_t* plight = &m_pEntityLights[index];
+	lightcells_t* pcells = &m_lightCells[index];
+
+	for(int i = 0; i < 3; i++)
+	{
+		m_lightMins[i][index] = plight->mins[i];
+		m_lightMaxs[i][index] = plight->maxs[i];
+	}
+
+	int cellmins[3], cellmaxs[3];
+	GetGridCells(plight->mins, plight->maxs, cellmins, cellmaxs);
+
+	// Nothing to do if the light stayed in the same cells
+	if(pcells->linked && !memcmp(pcells->mins, cellmins, sizeof(cellmins)) && !memcmp(pcells->maxs, cellmaxs, sizeof(cellmaxs)))
+		return;
+
+	UnlinkLight(index);
+
+	memcpy(pcells->mins, cellmins, sizeof(cellmins));
+	memcpy(pcells->maxs, cellmaxs, sizeof(cellmaxs));
+	pcells->linked = true;
+
+	int numcells = 1;
+	for(int i = 0; i < 3; i++)
+		numcells *= cellmaxs[i] - cellmins[i] + 1;
+
+	if(numcells > LIGHT_GRID_MAX_CELLS)
+	{
+		pcells->oversized = true;
+		m_oversizedLights.push_back(index);
+		return;
+	}
+
+	pcells->oversized = false;
+	for(int x = cellmins[0]; x <= cellmaxs[0]; x++)
+	{
+		for(int y = cellmins[1]; y <= cellmaxs[1]; y++)
+		{
+			for(int z = cellmins[2]; z <= cellmaxs[2]; z++)
+				m_lightGrid[LightGridKey(x, y, z)].push_back(index);
+		}
+	}
+}
+
+/*
+====================
+UnlinkLight
+
+====================
+*/
+void CLightList::UnlinkLight( int index )
+{
+	lightcells_t* pcells = &m_lightCells[index];
+	if(!pcells->linked)
+		return;
+
+	pcells->linked = false;
+
+	if(pcells->oversized)
+	{
+		auto it = std::find(m_oversizedLights.begin(), m_oversizedLights.end(), index);
+		if(it != m_oversizedLights.end())
+			m_oversizedLights.erase(it);
+
+		pcells->oversized = false;
+		return;
+	}
+
+	for(int x = pcells->mins[0]; x <= pcells->maxs[0]; x++)
+	{
+		for(int y = pcells->mins[1]; y <= pcells->maxs[1]; y++)
+		{
+			for(int z = pcells->mins[2]; z <= pcells->maxs[2]; z++)
+			{
+				auto it = m_lightGrid.find(LightGridKey(x, y, z));
+				if(it == m_lightGrid.end())
+					continue;
+
+				std::vector<int>& cell = it->second;
+				auto pos = std::find(cell.begin(), cell.end(), index);
+				if(pos != cell.end())
+				{
+					*pos = cell.back();
+					cell.pop_back();
+				}
+			}
+		}
+	}
+}
+
+/*
+====================
+RebuildLightGrid
+
+====================
+*/
+void CLightList::RebuildLightGrid( void )
+{
+	m_lightGrid.clear();
+	m_oversizedLights.clear();
+	m_lightTraceCache.clear();
+	m_lightIndexes.clear();
+	m_visibleLightsValid = false;
+
+	// The grid is already empty
+	memset(m_lightCells, 0, sizeof(m_lightCells));
+
 	for(int i = 0; i < m_iNumEntityLights; i++)
 	{
-		if(m_pEntityLights[i].entindex == entindex)
+		LinkLight(i);
+
+		if(m_pEntityLights[i].entindex != -1)
+			m_lightIndexes[m_pEntityLights[i].entindex] = i;
+	}
+}
+
+/*
+====================
+FilterLightBounds
+
+Keeps the entity lights whose bounds touch the box, pindexes
+may be NULL to test lights [0, count). pout may alias pindexes
+====================
+*/
+int CLightList::FilterLightBounds( const int* pindexes, int count, const Vector& mins, const Vector& maxs, int* pout )
+{
+	int numout = 0;
+	int i = 0;
+
+#ifdef STUDIO_SSE2
+	__m128 boxmins[3], boxmaxs[3];
+	for(int j = 0; j < 3; j++)
+	{
+		boxmins[j] = _mm_set1_ps(mins[j]);
+		boxmaxs[j] = _mm_set1_ps(maxs[j]);
+	}
+
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 outside = _mm_setzero_ps();
+		for(int j = 0; j < 3; j++)
 		{
-			for(int j = i; j < m_iNumEntityLights-1; j++)
-				m_pEntityLights[j] = m_pEntityLights[j+1];
+			__m128 lightmins, lightmaxs;
+			if(pindexes)
+			{
+				const int* pgroup = &pindexes[i];
+				lightmins = _mm_setr_ps(m_lightMins[j][pgroup[0]], m_lightMins[j][pgroup[1]], m_lightMins[j][pgroup[2]], m_lightMins[j][pgroup[3]]);
+				lightmaxs = _mm_setr_ps(m_lightMaxs[j][pgroup[0]], m_lightMaxs[j][pgroup[1]], m_lightMaxs[j][pgroup[2]], m_lightMaxs[j][pgroup[3]]);
+			}
+			else
+			{
+				lightmins = _mm_loadu_ps(&m_lightMins[j][i]);
+				lightmaxs = _mm_loadu_ps(&m_lightMaxs[j][i]);
+			}
 
-			m_iNumEntityLights--;
-			return;
+			// Same tests as CheckBBox
+			outside = _mm_or_ps(outside, _mm_cmpgt_ps(boxmins[j], lightmaxs));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(boxmaxs[j], lightmins));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		if(mask == 15)
+			continue;
+
+		for(int k = 0; k < 4; k++)
+		{
+			if(!(mask & (1 << k)))
+				pout[numout++] = pindexes ? pindexes[i + k] : i + k;
+		}
+	}
+#endif
+
+	for(; i < count; i++)
+	{
+		int index = pindexes ? pindexes[i] : i;
+
+		bool outside = false;
+		for(int j = 0; j < 3; j++)
+		{
+			if(mins[j] > m_lightMaxs[j][index] || maxs[j] < m_lightMins[j][index])
+				outside = true;
+		}
+
+		if(!outside)
+			pout[numout++] = index;
+	}
+
+	return numout;
+}
+
+/*
+====================
+GetGridLights
+
+====================
+*/
+void CLightList::GetGridLights( const Vector& mins, const Vector& maxs )
+{
+	m_gridLights.clear();
+	m_iLightQuery++;
+
+	int cellmins[3], cellmaxs[3];
+	GetGridCells(mins, maxs, cellmins, cellmaxs);
+
+	int numcells = 1;
+	for(int i = 0; i < 3; i++)
+		numcells *= cellmaxs[i] - cellmins[i] + 1;
+
+	// Huge boxes are cheaper to test against the visible lights directly
+	int numvisible = m_visibleLights.size();
+	if(numcells > LIGHT_GRID_MAX_CELLS || numcells > numvisible)
+	{
+		m_iNumLightsTested += numvisible;
+		m_gridLights.resize(numvisible);
+		m_gridLights.resize(FilterLightBounds(m_visibleLights.data(), numvisible, mins, maxs, m_gridLights.data()));
+		return;
+	}
+
+	for(int x = cellmins[0]; x <= cellmaxs[0]; x++)
+	{
+		for(int y = cellmins[1]; y <= cellmaxs[1]; y++)
+		{
+			for(int z = cellmins[2]; z <= cellmaxs[2]; z++)
+			{
+				auto it = m_lightGrid.find(LightGridKey(x, y, z));
+				if(it == m_lightGrid.end())
+					continue;
+
+				for(int index : it->second)
+				{
+					if(m_lightQueryStamps[index] == m_iLightQuery || !m_lightVisible[index])
+						continue;
+
+					m_lightQueryStamps[index] = m_iLightQuery;
+					m_gridLights.push_back(index);
+				}
+			}
 		}
 	}
+
+	for(int index : m_oversizedLights)
+	{
+		if(m_lightVisible[index])
+			m_gridLights.push_back(index);
+	}
+
+	// Keep the list order, it decides which lights make the cut
+	std::sort(m_gridLights.begin(), m_gridLights.end());
+	m_iNumLightsTested += m_gridLights.size();
+
+	m_gridLights.resize(FilterLightBounds(m_gridLights.data(), m_gridLights.size(), mins, maxs, m_gridLights.data()));
+}
+
+/*
+====================
+lighttracehash_t
+
+====================
+*/
+size_t CLightList::lighttracehash_t::operator()( const lighttracekey_t& key ) const
+{
+	unsigned int bits[3];
+	memcpy(bits, &key.origin[0], sizeof(bits));
+
+	size_t hash = std::hash<const void*>()(key.plight);
+	for(int i = 0; i < 3; i++)
+		hash = hash * 31 + bits[i];
+
+	return hash;
+}
+
+/*
+====================
+IsLightVisible
+
+====================
+*/
+bool CLightList::IsLightVisible( const Vector& origin, const elight_t* plight )
+{
+	// An entity is usually drawn more than once a frame
+	lighttracekey_t key = { plight, origin };
+	auto it = m_lightTraceCache.find(key);
+	if(it != m_lightTraceCache.end())
+		return it->second;
+
+	static pmtrace_t traceResult;
+	gEngfuncs.pEventAPI->EV_PlayerTrace( (float *)&origin[0], (float *)&plight->origin[0], PM_WORLD_ONLY, -1, &traceResult );
+
+	bool visible = !(traceResult.fraction != 1.0 || traceResult.allsolid || traceResult.startsolid);
+	m_lightTraceCache.emplace(key, visible);
+
+	return visible;
 }
 
 /*
@@ -237,38 +654,42 @@ void CLightList::GetLightList( Vector& origin, const Vector& mins, const Vector&
 
 	gEngfuncs.pEventAPI->EV_SetTraceHull( 2 );
 
-	for(int i = 0; i < m_iNumEntityLights; i++)
+	// Lights changed since CalcRefDef
+	if(!m_visibleLightsValid)
+		CullLights();
+
+	m_iNumLightQueries++;
+
+	// Only test entity lights near the box
+	GetGridLights(mins, maxs);
+
+	for(int index : m_gridLights)
 	{
 		if((*numLights) == MAX_MODEL_ENTITY_LIGHTS)
 			return;
 
-		elight_t* plight = &m_pEntityLights[i];
+		elight_t* plight = &m_pEntityLights[index];
 
-		if(CheckBBox(plight, mins, maxs))
-			continue;
-
-		static pmtrace_t traceResult;
-		gEngfuncs.pEventAPI->EV_PlayerTrace( (float *)origin, (float *)plight->origin, PM_WORLD_ONLY, -1, &traceResult );
-		if(traceResult.fraction != 1.0 || traceResult.allsolid || traceResult.startsolid)
+		if(!IsLightVisible(origin, plight))
 			continue;
 
 		lightArray[*numLights] = plight;
 		(*numLights)++;
 	}
 
-	for(int i = 0; i < m_iNumTempEntityLights; i++)
+	// Temporary lights are few and change every frame
+	m_iNumLightsTested += m_visibleTempLights.size();
+	for(int index : m_visibleTempLights)
 	{
 		if((*numLights) == MAX_MODEL_ENTITY_LIGHTS)
 			return;
 
-		elight_t* plight = &m_pTempEntityLights[i];
+		elight_t* plight = &m_pTempEntityLights[index];
 
 		if(CheckBBox(plight, mins, maxs))
 			continue;
 
-		static pmtrace_t traceResult;
-		gEngfuncs.pEventAPI->EV_PlayerTrace( (float *)origin, (float *)plight->origin, PM_WORLD_ONLY, -1, &traceResult );
-		if(traceResult.fraction != 1.0 || traceResult.allsolid || traceResult.startsolid)
+		if(!IsLightVisible(origin, plight))
 			continue;
 
 		lightArray[*numLights] = plight;
@@ -276,6 +697,90 @@ void CLightList::GetLightList( Vector& origin, const Vector& mins, const Vector&
 	}
 }
 
+/*
+====================
+IsLightCulled
+
+====================
+*/
+bool CLightList::IsLightCulled( const elight_t* plight )
+{
+	Vector mins, maxs;
+	for(int i = 0; i < 3; i++)
+	{
+		mins[i] = plight->mins[i] - LIGHT_CULL_MARGIN;
+		maxs[i] = plight->maxs[i] + LIGHT_CULL_MARGIN;
+	}
+
+	return SVD_CullViewBox(mins, maxs);
+}
+
+/*
+====================
+CullLights
+
+Gathers the lights that can reach the view, per-model queries only test these
+====================
+*/
+void CLightList::CullLights( void )
+{
+	bool cull = m_pCvarCullLights->value > 0;
+
+	const frustum_t* pviewfrustum = SVD_GetViewFrustum();
+	if(cull && pviewfrustum)
+	{
+		// Growing the frustum by the margin is the same as growing every light
+		frustum_t frustum = *pviewfrustum;
+		Frustum_Expand(&frustum, LIGHT_CULL_MARGIN);
+
+		const float* pmins[3] = { m_lightMins[0], m_lightMins[1], m_lightMins[2] };
+		const float* pmaxs[3] = { m_lightMaxs[0], m_lightMaxs[1], m_lightMaxs[2] };
+
+		m_visibleLights.resize(m_iNumEntityLights);
+		m_visibleLights.resize(Frustum_CullBoxes(&frustum, pmins, pmaxs, m_iNumEntityLights, m_visibleLights.data()));
+
+		memset(m_lightVisible, 0, sizeof(bool) * m_iNumEntityLights);
+
+		// Then the PVS, on the few that are left
+		int numvisible = 0;
+		for(int index : m_visibleLights)
+		{
+			Vector mins, maxs;
+			for(int i = 0; i < 3; i++)
+			{
+				mins[i] = m_lightMins[i][index] - LIGHT_CULL_MARGIN;
+				maxs[i] = m_lightMaxs[i][index] + LIGHT_CULL_MARGIN;
+			}
+
+			if(!SVD_BoxInViewPVS(mins, maxs))
+				continue;
+
+			m_lightVisible[index] = true;
+			m_visibleLights[numvisible++] = index;
+		}
+
+		m_visibleLights.resize(numvisible);
+	}
+	else
+	{
+		m_visibleLights.clear();
+		for(int i = 0; i < m_iNumEntityLights; i++)
+		{
+			m_lightVisible[i] = true;
+			m_visibleLights.push_back(i);
+		}
+	}
+
+	m_visibleTempLights.clear();
+	for(int i = 0; i < m_iNumTempEntityLights; i++)
+	{
+		if(!cull || !IsLightCulled(&m_pTempEntityLights[i]))
+			m_visibleTempLights.push_back(i);
+	}
+
+	m_visibleLightsValid = true;
+}
+
 /*
 ====================
 CheckBBox
@@ -305,6 +810,165 @@ bool CLightList::CheckBBox( elight_t* plight, const Vector& vmins, const Vector&
 	return false;
 }
 
+/*
+====================
+BenchmarkBBoxes
+
+Times CheckBBox against FilterLightBounds on the loaded entity lights
+====================
+*/
+void CLightList::BenchmarkBBoxes( void )
+{
+	if(!m_iNumEntityLights)
+	{
+		gEngfuncs.Con_Printf("No entity lights to test against.\n");
+		return;
+	}
+
+	const int numBoxes = 4096;
+
+	// Player sized and bigger boxes around the lights
+	static Vector boxMins[numBoxes];
+	static Vector boxMaxs[numBoxes];
+	for(int i = 0; i < numBoxes; i++)
+	{
+		elight_t* plight = &m_pEntityLights[gEngfuncs.pfnRandomLong(0, m_iNumEntityLights-1)];
+		for(int j = 0; j < 3; j++)
+		{
+			float size = gEngfuncs.pfnRandomFloat(16, 128);
+			boxMins[i][j] = plight->origin[j] + gEngfuncs.pfnRandomFloat(-1024, 1024);
+			boxMaxs[i][j] = boxMins[i][j] + size;
+		}
+	}
+
+	static int overlapping[MAX_ENTITY_LIGHTS];
+	int numScalar = 0;
+	int numFiltered = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for(int i = 0; i < numBoxes; i++)
+	{
+		for(int j = 0; j < m_iNumEntityLights; j++)
+		{
+			if(!CheckBBox(&m_pEntityLights[j], boxMins[i], boxMaxs[i]))
+				overlapping[numScalar++ % MAX_ENTITY_LIGHTS] = j;
+		}
+	}
+
+	auto middle = std::chrono::high_resolution_clock::now();
+
+	for(int i = 0; i < numBoxes; i++)
+		numFiltered += FilterLightBounds(NULL, m_iNumEntityLights, boxMins[i], boxMaxs[i], overlapping);
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double numTests = (double)numBoxes * m_iNumEntityLights;
+	double scalar = std::chrono::duration<double, std::nano>(middle - start).count() / numTests;
+	double filtered = std::chrono::duration<double, std::nano>(end - middle).count() / numTests;
+
+	gEngfuncs.Con_Printf("Light bboxes, %d lights x %d boxes: CheckBBox %.2f ns/light, filtered %.2f ns/light (%.2fx), %d/%d overlaps\n",
+		m_iNumEntityLights, numBoxes, scalar, filtered, filtered > 0 ? scalar / filtered : 0.0, numScalar, numFiltered);
+}
+
+/*
+====================
+BenchmarkGrid
+
+Times grid lookups against testing every entity light, the way
+GetLightList did before the grid. cl_lightgridbench [boxes]
+====================
+*/
+void CLightList::BenchmarkGrid( void )
+{
+	if(!m_iNumEntityLights)
+	{
+		gEngfuncs.Con_Printf("No entity lights to test against.\n");
+		return;
+	}
+
+	int numBoxes = 4096;
+	if(gEngfuncs.Cmd_Argc() > 1)
+		numBoxes = std::max(1, atoi(gEngfuncs.Cmd_Argv(1)));
+
+	// Model sized boxes around the lights
+	std::vector<Vector> boxMins(numBoxes);
+	std::vector<Vector> boxMaxs(numBoxes);
+	for(int i = 0; i < numBoxes; i++)
+	{
+		elight_t* plight = &m_pEntityLights[gEngfuncs.pfnRandomLong(0, m_iNumEntityLights-1)];
+		for(int j = 0; j < 3; j++)
+		{
+			float size = gEngfuncs.pfnRandomFloat(16, 128);
+			boxMins[i][j] = plight->origin[j] + gEngfuncs.pfnRandomFloat(-1024, 1024);
+			boxMaxs[i][j] = boxMins[i][j] + size;
+		}
+	}
+
+	if(!m_visibleLightsValid)
+		CullLights();
+
+	// Don't let the benchmark show up in r_lights_stats
+	int numLightsTested = m_iNumLightsTested;
+
+	int numLinear = 0;
+	int numGrid = 0;
+	int numMismatches = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for(int i = 0; i < numBoxes; i++)
+	{
+		for(int index : m_visibleLights)
+		{
+			if(!CheckBBox(&m_pEntityLights[index], boxMins[i], boxMaxs[i]))
+				numLinear++;
+		}
+	}
+
+	auto middle = std::chrono::high_resolution_clock::now();
+
+	for(int i = 0; i < numBoxes; i++)
+	{
+		GetGridLights(boxMins[i], boxMaxs[i]);
+		numGrid += m_gridLights.size();
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	// Same lights in the same order, outside of the timing
+	for(int i = 0; i < numBoxes; i++)
+	{
+		GetGridLights(boxMins[i], boxMaxs[i]);
+
+		size_t k = 0;
+		for(int index : m_visibleLights)
+		{
+			if(CheckBBox(&m_pEntityLights[index], boxMins[i], boxMaxs[i]))
+				continue;
+
+			if(k >= m_gridLights.size() || m_gridLights[k] != index)
+			{
+				numMismatches++;
+				break;
+			}
+
+			k++;
+		}
+
+		if(k != m_gridLights.size())
+			numMismatches++;
+	}
+
+	m_iNumLightsTested = numLightsTested;
+
+	double linear = std::chrono::duration<double, std::micro>(middle - start).count() / numBoxes;
+	double grid = std::chrono::duration<double, std::micro>(end - middle).count() / numBoxes;
+
+	gEngfuncs.Con_Printf("cl_lightgridbench: %d lights x %d boxes: linear %.3f us/box, grid %.3f us/box (%.2fx), %d/%d lights found, %d mismatches\n",
+		(int)m_visibleLights.size(), numBoxes, linear, grid, grid > 0 ? linear / grid : 0.0, numLinear, numGrid, numMismatches);
+}
+
 /*
 ====================
 CalcRefDef
@@ -316,6 +980,9 @@ void CLightList::CalcRefDef( void )
 	// Reset to zero
 	m_iNumTempEntityLights = 0;
 
+	// Traces are only reused within a frame
+	m_lightTraceCache.clear();
+
 	float fltime = gEngfuncs.GetClientTime();
 
 	dlight_t* pdlight = m_pGoldSrcELights;
@@ -363,6 +1030,21 @@ void CLightList::CalcRefDef( void )
 		ReadLightsRadFile();
 		m_readLightsRad = true;
 	}
+
+	CullLights();
+
+	if(m_pCvarLightStats->value > 0)
+	{
+		int numTotal = m_iNumEntityLights + m_iNumTempEntityLights;
+		int numVisible = m_visibleLights.size() + m_visibleTempLights.size();
+		float avgTested = m_iNumLightQueries ? (float)m_iNumLightsTested / m_iNumLightQueries : 0;
+
+		gEngfuncs.Con_NPrintf(24, "Lights: %d total, %d visible", numTotal, numVisible);
+		gEngfuncs.Con_NPrintf(25, "Lights tested per model: %.1f (%d models)", avgTested, m_iNumLightQueries);
+	}
+
+	m_iNumLightQueries = 0;
+	m_iNumLightsTested = 0;
 }
 
 /*
@@ -562,123 +1244,123 @@ void CLightList::ReadLightsRadFile( void )
 	if(!pWorld)
 		return;
 
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	// Texlights by name, the first entry for a name wins
+	std::unordered_map<std::string, texlight_t*> texLightsByName;
+	for(int i = 0; i < m_numTexLights; i++)
+		texLightsByName.emplace(m_texLights[i].texname, &m_texLights[i]);
+
+	// Texlight for each world texture, only looked up by name once
+	std::unordered_map<texture_t*, texlight_t*> texLightsByTexture;
+
 	char texName[64];
 
 	// Array of light-emitting surfaces
 	std::vector<lightsurface_t> lightSurfacesVector;
 
-	if(!g_msurfaceStructSize)
-		g_msurfaceStructSize = R_DetermineSurfaceStructSize();
+	// Light surface verts by exact position
+	std::unordered_map<unsigned int, std::vector<lightsurfacevert_t>> surfaceVertHash;
+
+	int numSurfaces = 0;
+	const svdsurface_t* psurfaces = SVD_GetWorldSurfaces(&numSurfaces);
 
 	// Parse through all surfaces and build lit surface array
-	byte* pfirstsurfaceptr = reinterpret_cast<byte*>(pWorld->surfaces);
-	for(int i = 0; i < pWorld->numsurfaces; i++)
+	int numLitSurfaces = 0;
+	for(int i = 0; i < numSurfaces; i++)
 	{
-		msurface_t* psurface = reinterpret_cast<msurface_t*>(pfirstsurfaceptr + g_msurfaceStructSize*i);
+		const svdsurface_t* psurface = &psurfaces[i];
 
 		// See if surface binds to a texlight
-		mtexinfo_t* ptexinfo = psurface->texinfo;
-		if(!ptexinfo->texture)
+		texture_t* ptexture = psurface->texinfo->texture;
+		if(!ptexture)
 			continue;
 
-		strcpy(texName, ptexinfo->texture->name);
-		COM_ToLowerCase(texName);
-
 		texlight_t* ptexlight = NULL;
-		for(int j = 0; j < m_numTexLights; j++)
+		auto texit = texLightsByTexture.find(ptexture);
+		if(texit != texLightsByTexture.end())
 		{
-			if(!strcmp(m_texLights[j].texname, texName))
-			{
-				ptexlight = &m_texLights[j];
-				break;
-			}
+			ptexlight = texit->second;
+		}
+		else
+		{
+			strcpy(texName, ptexture->name);
+			COM_ToLowerCase(texName);
+
+			auto nameit = texLightsByName.find(texName);
+			if(nameit != texLightsByName.end())
+				ptexlight = nameit->second;
+
+			texLightsByTexture.emplace(ptexture, ptexlight);
 		}
 
 		if(!ptexlight)
 			continue;
 
-		unsigned int j = 0;
-		for(j = 0; j < lightSurfacesVector.size(); j++)
+		numLitSurfaces++;
+		glpoly_t* ppoly = psurface->polys;
+
+		// Merge into the earliest light surface with the same texture
+		// and normal that shares a vert with this one
+		int index = -1;
+		for(int j = 0; j < ppoly->numverts; j++)
 		{
-			lightsurface_t& lsurf = lightSurfacesVector[j];
-			if(lsurf.ptexture != ptexinfo->texture)
-				continue;
+			Vector vcoord = Vector(ppoly->verts[j][0], ppoly->verts[j][1], ppoly->verts[j][2]);
 
-			if((lsurf.normal - psurface->plane->normal).Length() > 0.01)
+			auto it = surfaceVertHash.find(LightVertKey(vcoord));
+			if(it == surfaceVertHash.end())
 				continue;
-			
-			unsigned int k = 0;
-			for(; k < lsurf.verts.size(); k++)
-			{
-				int l = 0;
-				for(; l < psurface->polys->numverts; l++)
-				{
-					Vector vcoord = Vector(psurface->polys->verts[l][0],
-						psurface->polys->verts[l][1],
-						psurface->polys->verts[l][2]);
-			
-					if(vcoord == lsurf.verts[k])
-						break;
-				}
-			
-				if(l != psurface->polys->numverts)
-					break;
-			}
 
-			if(k != lsurf.verts.size())
+			for(const lightsurfacevert_t& vert : it->second)
 			{
-				for(int k = 0; k < psurface->polys->numverts; k++)
-				{
-					Vector vcoord = Vector((float)psurface->polys->verts[k][0],
-						(float)psurface->polys->verts[k][1],
-						(float)psurface->polys->verts[k][2]);
-			
-					lsurf.verts.push_back(vcoord);
-			
-					for(int l = 0; l < 3; l++)
-					{
-						if(vcoord[l] < lsurf.mins[l])
-							lsurf.mins[l] = vcoord[l];
-			
-						if(vcoord[l] > lsurf.maxs[l])
-							lsurf.maxs[l] = vcoord[l];
-					}
-				}
-			
-				break;
+				if(index != -1 && vert.surface >= index)
+					continue;
+
+				if(vert.origin != vcoord)
+					continue;
+
+				const lightsurface_t& lsurf = lightSurfacesVector[vert.surface];
+				if(lsurf.ptexture != ptexture)
+					continue;
+
+				if((lsurf.normal - psurface->plane->normal).Length() > 0.01)
+					continue;
+
+				index = vert.surface;
 			}
 		}
 
-		if(j == lightSurfacesVector.size())
+		if(index == -1)
 		{
 			// Create new entry
-			lightSurfacesVector.resize(lightSurfacesVector.size()+1);
-			lightsurface_t& lsurf = lightSurfacesVector[j];
+			index = lightSurfacesVector.size();
+			lightSurfacesVector.resize(index+1);
+			lightsurface_t& lsurf = lightSurfacesVector[index];
 			lsurf.mins = Vector(999999, 999999, 999999);
 			lsurf.maxs = Vector(-999999, -999999, -999999);
 			lsurf.normal = psurface->plane->normal;
-			lsurf.ptexture = psurface->texinfo->texture;
+			lsurf.ptexture = ptexture;
 			lsurf.ptexlight = ptexlight;
 
 			if(psurface->flags & SURF_PLANEBACK)
 				VectorInverse(lsurf.normal);
-			
-			for(j = 0; j < (unsigned int)psurface->polys->numverts; j++)
+		}
+
+		lightsurface_t& lsurf = lightSurfacesVector[index];
+		for(int j = 0; j < ppoly->numverts; j++)
+		{
+			Vector vcoord = Vector(ppoly->verts[j][0], ppoly->verts[j][1], ppoly->verts[j][2]);
+
+			lsurf.verts.push_back(vcoord);
+			surfaceVertHash[LightVertKey(vcoord)].push_back({vcoord, index});
+
+			for(int l = 0; l < 3; l++)
 			{
-				Vector vcoord = Vector((float)psurface->polys->verts[j][0],
-					(float)psurface->polys->verts[j][1],
-					(float)psurface->polys->verts[j][2]);
-			
-				lsurf.verts.push_back(vcoord);
-			
-				for(int l = 0; l < 3; l++)
-				{
-					if(vcoord[l] < lsurf.mins[l])
-						lsurf.mins[l] = vcoord[l];
-			
-					if(vcoord[l] > lsurf.maxs[l])
-						lsurf.maxs[l] = vcoord[l];
-				}
+				if(vcoord[l] < lsurf.mins[l])
+					lsurf.mins[l] = vcoord[l];
+
+				if(vcoord[l] > lsurf.maxs[l])
+					lsurf.maxs[l] = vcoord[l];
 			}
 		}
 	}
@@ -729,39 +1411,99 @@ void CLightList::ReadLightsRadFile( void )
 		}
 	}
 
+	// Static lights by position, neighbours within LIGHT_MERGE_CELL_SIZE
+	// are always in the surrounding cells
+	std::unordered_map<unsigned int, std::vector<int>> lightHash;
+	auto hashLights = [&]()
+	{
+		lightHash.clear();
+		for(int i = 0; i < m_iNumEntityLights; i++)
+		{
+			elight_t* pel = &m_pEntityLights[i];
+			if(pel->entindex != -1)
+				continue;
+
+			int x = (int)floor(pel->origin.x / LIGHT_MERGE_CELL_SIZE);
+			int y = (int)floor(pel->origin.y / LIGHT_MERGE_CELL_SIZE);
+			int z = (int)floor(pel->origin.z / LIGHT_MERGE_CELL_SIZE);
+			lightHash[LightGridKey(x, y, z)].push_back(i);
+		}
+	};
+
+	// Calls pfnVisit for every other static light with a matching color closer than maxDist
+	auto forNearbyLights = [&]( int index, float maxDist, auto pfnVisit )
+	{
+		elight_t* pel1 = &m_pEntityLights[index];
+		int cx = (int)floor(pel1->origin.x / LIGHT_MERGE_CELL_SIZE);
+		int cy = (int)floor(pel1->origin.y / LIGHT_MERGE_CELL_SIZE);
+		int cz = (int)floor(pel1->origin.z / LIGHT_MERGE_CELL_SIZE);
+
+		for(int x = cx - 1; x <= cx + 1; x++)
+		{
+			for(int y = cy - 1; y <= cy + 1; y++)
+			{
+				for(int z = cz - 1; z <= cz + 1; z++)
+				{
+					auto it = lightHash.find(LightGridKey(x, y, z));
+					if(it == lightHash.end())
+						continue;
+
+					for(int j : it->second)
+					{
+						if(j == index)
+							continue;
+
+						elight_t* pel2 = &m_pEntityLights[j];
+						if((pel1->color.x - pel2->color.x) > 0.01
+							|| (pel1->color.y - pel2->color.y) > 0.01
+							|| (pel1->color.z - pel2->color.z) > 0.01)
+							continue;
+
+						float dist = (pel2->origin - pel1->origin).Length();
+						if(dist < maxDist)
+							pfnVisit(j);
+					}
+				}
+			}
+		}
+	};
+
 	// Merge matching light sources that are very close
 	int numOptimized = 0;
+	hashLights();
+
+	std::vector<bool> removedLights(m_iNumEntityLights, false);
 	for(int i = 0; i < m_iNumEntityLights; i++)
 	{
-		elight_t* pel1 = &m_pEntityLights[i];
-		if(pel1->entindex != -1)
+		if(removedLights[i] || m_pEntityLights[i].entindex != -1)
 			continue;
 
-		for(int j = 0; j < m_iNumEntityLights; j++)
+		forNearbyLights(i, 32, [&]( int j )
 		{
-			if(j == i)
-				continue;
+			if(removedLights[j])
+				return;
 
-			elight_t* pel2 = &m_pEntityLights[j];
-			if(pel2->entindex != -1)
-				continue;
+			removedLights[j] = true;
+			numOptimized++;
+		});
+	}
 
-			if((pel1->color.x - pel2->color.x) > 0.01
-				|| (pel1->color.y - pel2->color.y) > 0.01
-				|| (pel1->color.z - pel2->color.z) > 0.01)
+	if(numOptimized > 0)
+	{
+		int numKept = 0;
+		for(int i = 0; i < m_iNumEntityLights; i++)
+		{
+			if(removedLights[i])
 				continue;
-				
-			float dist = (pel2->origin - pel1->origin).Length();
-			if(dist < 32)
-			{
-				for(int k = j+1; k < m_iNumEntityLights; k++)
-					m_pEntityLights[k-1] = m_pEntityLights[k];
 
-				numOptimized++;
-				m_iNumEntityLights--;
-				j--;
-			}
+			if(numKept != i)
+				m_pEntityLights[numKept] = m_pEntityLights[i];
+
+			numKept++;
 		}
+
+		m_iNumEntityLights = numKept;
+		hashLights();
 	}
 
 	// Check for lights being too near eachother, dim those that are too close
@@ -773,24 +1515,10 @@ void CLightList::ReadLightsRadFile( void )
 			continue;
 
 		int closeMatchCount = 0;
-		for(int j = 0; j < m_iNumEntityLights; j++)
+		forNearbyLights(i, 64, [&]( int )
 		{
-			if(j == i)
-				continue;
-
-			elight_t* pel2 = &m_pEntityLights[j];
-			if(pel2->entindex != -1)
-				continue;
-
-			if((pel1->color.x - pel2->color.x) > 0.01
-				|| (pel1->color.y - pel2->color.y) > 0.01
-				|| (pel1->color.z - pel2->color.z) > 0.01)
-				continue;
-				
-			float dist = (pel2->origin - pel1->origin).Length();
-			if(dist < 64)
-				closeMatchCount++;
-		}
+			closeMatchCount++;
+		});
 
 		if(closeMatchCount > 0)
 		{
@@ -800,6 +1528,13 @@ void CLightList::ReadLightsRadFile( void )
 		}
 	}
 
+	// Lights were added and shuffled around directly
+	RebuildLightGrid();
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	gEngfuncs.Con_DPrintf("lights.rad: %d texlights on %d surfaces merged into %d lights in %.2f ms.\n",
+		m_numTexLights, numLitSurfaces, (int)lightSurfacesVector.size(), elapsed);
+
 #ifdef DEBUG
 	gEngfuncs.Con_Printf("Removed %d per-vertex lights stuck in solids.\n", numStuckInSolid);
 	gEngfuncs.Con_Printf("Removed %d clumped matching per-vertex lights.\n", numOptimized);
@@ -11,6 +11,7 @@
 #include "elight.h"
 #include "dlight.h"
 #include <vector>
+#include <unordered_map>
 #include "com_model.h"
 
 #define MAX_ENTITY_LIGHTS		1024 // Arbitrary
@@ -18,6 +19,11 @@
 #define MAX_GOLDSRC_DLIGHTS		32 // Actual limit, based on IDA pro
 #define MAX_TEXLIGHTS			1024 // Arbitrary
 
+#define LIGHT_GRID_CELL_SIZE	512 // Matches the largest lights.rad radius
+#define LIGHT_GRID_MAX_CELLS	64 // Lights touching more cells are tested directly
+#define LIGHT_MERGE_CELL_SIZE	64 // Widest distance lights.rad lights are matched at
+#define LIGHT_CULL_MARGIN		64 // Models at the edge of the view can reach lights outside of it
+
 /*
 ====================
 CLightList
@@ -48,6 +54,39 @@ public:
 		std::vector<Vector> verts;
 	};
 
+	// Light surface vert in the lights.rad merge hash
+	struct lightsurfacevert_t
+	{
+		Vector origin;
+		int surface;
+	};
+
+	// Grid cells an entity light is linked into
+	struct lightcells_t
+	{
+		int mins[3];
+		int maxs[3];
+		bool linked;
+		bool oversized;
+	};
+
+	// Visibility of a light from an entity origin, valid for one frame
+	struct lighttracekey_t
+	{
+		const elight_t* plight;
+		Vector origin;
+
+		bool operator==(const lighttracekey_t& other) const
+		{
+			return plight == other.plight && origin == other.origin;
+		}
+	};
+
+	struct lighttracehash_t
+	{
+		size_t operator()(const lighttracekey_t& key) const;
+	};
+
 public:
 	// Called by HUD::Init
 	void Init( void );
@@ -73,12 +112,43 @@ public:
 
 	// Performs bbox check for elight
 	bool CheckBBox(elight_t* plight, const Vector& vmins, const Vector& vmaxs);
+	// Times the entity light bbox tests
+	void BenchmarkBBoxes( void );
+	// Times grid lookups against testing every entity light
+	void BenchmarkGrid( void );
 
 private:
+	// Returns the grid cells a bounding box touches
+	void GetGridCells(const Vector& mins, const Vector& maxs, int* cellmins, int* cellmaxs);
+	// Links an entity light into the grid
+	void LinkLight(int index);
+	// Unlinks an entity light from the grid
+	void UnlinkLight(int index);
+	// Relinks every entity light
+	void RebuildLightGrid(void);
+	// Gathers entity lights whose bounds touch a bounding box
+	void GetGridLights(const Vector& mins, const Vector& maxs);
+	// Keeps the entity lights whose bounds touch a bounding box, returns how many did
+	int FilterLightBounds(const int* pindexes, int count, const Vector& mins, const Vector& maxs, int* pout);
+	// Tests if a light can be seen from an origin
+	bool IsLightVisible(const Vector& origin, const elight_t* plight);
+	// Tests if a light's bounds are outside the view frustum or PVS
+	bool IsLightCulled(const elight_t* plight);
+	// Builds the list of lights that can reach the view
+	void CullLights(void);
+
 	// Elights kept in memory
 	elight_t	m_pEntityLights[MAX_ENTITY_LIGHTS];
 	int			m_iNumEntityLights;
 
+	// Entity light bounds split per axis, kept in sync by LinkLight
+	float		m_lightMins[3][MAX_ENTITY_LIGHTS];
+	float		m_lightMaxs[3][MAX_ENTITY_LIGHTS];
+
+	// Entity light slot for each entindex. Slots aren't stable, RemoveLight shifts the lights
+	// after the removed one down to keep them in the order they were added, and this follows
+	std::unordered_map<int, int> m_lightIndexes;
+
 	// elights fetched from goldsrc
 	elight_t	m_pTempEntityLights[MAX_GOLDSRC_ELIGHTS];
 	int			m_iNumTempEntityLights;
@@ -94,8 +164,35 @@ private:
 	// True if we've read lights.rad
 	bool		m_readLightsRad;
 
+	// Uniform grid over entity light bounds
+	std::unordered_map<unsigned int, std::vector<int>> m_lightGrid;
+	lightcells_t	m_lightCells[MAX_ENTITY_LIGHTS];
+	std::vector<int> m_oversizedLights;
+
+	// Stamps for deduplicating lights in more than one cell
+	int			m_lightQueryStamps[MAX_ENTITY_LIGHTS];
+	int			m_iLightQuery;
+	std::vector<int> m_gridLights;
+
+	// Light traces done this frame
+	std::unordered_map<lighttracekey_t, bool, lighttracehash_t> m_lightTraceCache;
+
+	// Lights that can reach the view this frame, in list order
+	std::vector<int> m_visibleLights;
+	std::vector<int> m_visibleTempLights;
+	bool		m_lightVisible[MAX_ENTITY_LIGHTS];
+	bool		m_visibleLightsValid;
+
+	// Per-model query counters for r_lights_stats
+	int			m_iNumLightQueries;
+	int			m_iNumLightsTested;
+
 	// Shows elights rendered for the world
 	cvar_t*		m_pCvarDebugELights;
+	// Culls lights outside the view before per-model queries
+	cvar_t*		m_pCvarCullLights;
+	// Prints light culling counters
+	cvar_t*		m_pCvarLightStats;
 };
 
 extern CLightList gLightList;
@@ -19,6 +19,7 @@
 #undef clamp
 
 #include <algorithm>
+#include <vector>
 
 #include "event_api.h"
 #include "triangleapi.h"
@@ -26,6 +27,8 @@
 #include "particleman.h"
 #include "particleman_internal.h"
 #include "CBaseParticle.h"
+#include "CParticleBatch.h"
+#include "studio_jobs.h"
 
 #include "pm_defs.h"
 #include "pmtrace.h"
@@ -103,12 +106,12 @@ void CBaseParticle::InitializeSprite(Vector org, Vector normal, model_s* sprite,
 	m_vTopLeft = m_vLowLeft + scaledUp + scaledUp;
 }
 
-bool CBaseParticle::CheckVisibility()
+bool CBaseParticle::CheckPVS()
 {
-	const float radius = m_flSize / 5.0;
-
 	if (gEngfuncs.GetClientTime() >= m_flNextPVSCheck)
 	{
+		const float radius = m_flSize / 5.0;
+
 		const Vector radiusVector{radius, radius, radius};
 		Vector mins = m_vOrigin - radiusVector;
 		Vector maxs = m_vOrigin + radiusVector;
@@ -118,41 +121,133 @@ bool CBaseParticle::CheckVisibility()
 		m_flNextPVSCheck = gEngfuncs.GetClientTime() + 0.1;
 	}
 
+	return m_bInPVS || (m_iRenderFlags & CULL_PVS) == 0;
+}
+
+bool CBaseParticle::CheckVisibility()
+{
+	const float radius = m_flSize / 5.0;
+
+	const bool inPVS = CheckPVS();
+
 	if ((m_iRenderFlags & CULL_FRUSTUM_SPHERE) != 0)
 	{
-		if (!g_cFrustum.SphereInsideFrustum(m_vOrigin.x, m_vOrigin.y, m_vOrigin.z, radius))
+		if (Frustum_CullSphere(&g_Frustum, m_vOrigin, radius))
 		{
 			return false;
 		}
 	}
 	else if ((m_iRenderFlags & CULL_FRUSTUM_PLANE) != 0)
 	{
-		if (!g_cFrustum.PlaneInsideFrustum(m_vOrigin.x, m_vOrigin.y, m_vOrigin.z, radius))
+		const Vector radiusVector{radius, radius, radius};
+
+		if (!Frustum_ContainsBox(&g_Frustum, m_vOrigin - radiusVector, m_vOrigin + radiusVector))
 		{
 			return false;
 		}
 	}
 	else if ((m_iRenderFlags & CULL_FRUSTUM_POINT) != 0)
 	{
-		if (!g_cFrustum.PointInsideFrustum(m_vOrigin.x, m_vOrigin.y, m_vOrigin.z))
+		if (Frustum_CullSphere(&g_Frustum, m_vOrigin, 0))
 		{
 			return false;
 		}
 	}
 
-	if (!m_bInPVS)
+	return inPVS;
+}
+
+void CBaseParticle::CheckVisibilityAll(CBaseParticle* const* particles, std::size_t count, std::uint8_t* visible)
+{
+	//Sphere and point culled particles, stored per axis for Frustum_CullSpheres.
+	static std::vector<float> origins[3];
+	static std::vector<float> radii;
+	static std::vector<std::size_t> spheres;
+	static std::vector<int> kept;
+
+	for (auto& axis : origins)
 	{
-		return (m_iRenderFlags & CULL_PVS) == 0;
+		axis.clear();
 	}
 
-	return true;
+	radii.clear();
+	spheres.clear();
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		auto particle = particles[i];
+
+		visible[i] = particle->CheckPVS() ? 1 : 0;
+
+		float radius = 0;
+
+		if ((particle->m_iRenderFlags & CULL_FRUSTUM_SPHERE) != 0)
+		{
+			radius = particle->m_flSize / 5.0;
+		}
+		else if ((particle->m_iRenderFlags & CULL_FRUSTUM_PLANE) != 0)
+		{
+			//Few particles use this, test them on their own.
+			const float size = particle->m_flSize / 5.0;
+			const Vector radiusVector{size, size, size};
+
+			if (!Frustum_ContainsBox(&g_Frustum, particle->m_vOrigin - radiusVector, particle->m_vOrigin + radiusVector))
+			{
+				visible[i] = 0;
+			}
+
+			continue;
+		}
+		else if ((particle->m_iRenderFlags & CULL_FRUSTUM_POINT) == 0)
+		{
+			continue;
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			origins[axis].push_back(particle->m_vOrigin[axis]);
+		}
+
+		radii.push_back(radius);
+		spheres.push_back(i);
+	}
+
+	const float* axes[3] = {origins[0].data(), origins[1].data(), origins[2].data()};
+
+	kept.resize(spheres.size());
+	const int keptCount = Frustum_CullSpheres(&g_Frustum, axes, radii.data(), static_cast<int>(spheres.size()), kept.data());
+
+	//Kept indexes are in ascending order, everything skipped over was culled.
+	int next = 0;
+
+	for (std::size_t i = 0; i < spheres.size(); ++i)
+	{
+		if (next < keptCount && kept[next] == static_cast<int>(i))
+		{
+			++next;
+		}
+		else
+		{
+			visible[spheres[i]] = 0;
+		}
+	}
 }
 
 void CBaseParticle::Draw()
+{
+	ParticleQuad quad;
+
+	if (BuildQuad(quad))
+	{
+		CParticleBatch::Draw(&quad, 1);
+	}
+}
+
+bool CBaseParticle::BuildQuad(ParticleQuad& quad)
 {
 	if (m_flDieTime == gEngfuncs.GetClientTime())
 	{
-		return;
+		return false;
 	}
 
 	Vector vColor;
@@ -213,29 +308,21 @@ void CBaseParticle::Draw()
 	const Vector topLeft = lowLeft + height;
 	const Vector topRight = lowRight + height;
 
-	gEngfuncs.pTriAPI->SpriteTexture(m_pTexture, m_iFrame);
-	gEngfuncs.pTriAPI->RenderMode(m_iRendermode);
-	gEngfuncs.pTriAPI->CullFace(TRI_NONE);
-
-	gEngfuncs.pTriAPI->Begin(TRI_QUADS);
-	gEngfuncs.pTriAPI->Color4f(resultColor.x / 255, resultColor.y / 255, resultColor.z / 255, m_flBrightness / 255);
-
-	gEngfuncs.pTriAPI->TexCoord2f(0, 0);
-	gEngfuncs.pTriAPI->Vertex3fv(topLeft);
+	quad.m_pTexture = m_pTexture;
+	quad.m_iFrame = m_iFrame;
+	quad.m_iRendermode = m_iRendermode;
 
-	gEngfuncs.pTriAPI->TexCoord2f(0, 1);
-	gEngfuncs.pTriAPI->Vertex3fv(lowLeft);
+	quad.m_flColor[0] = resultColor.x / 255;
+	quad.m_flColor[1] = resultColor.y / 255;
+	quad.m_flColor[2] = resultColor.z / 255;
+	quad.m_flColor[3] = m_flBrightness / 255;
 
-	gEngfuncs.pTriAPI->TexCoord2f(1, 1);
-	gEngfuncs.pTriAPI->Vertex3fv(lowRight);
+	quad.m_vCorners[0] = topLeft;
+	quad.m_vCorners[1] = lowLeft;
+	quad.m_vCorners[2] = lowRight;
+	quad.m_vCorners[3] = topRight;
 
-	gEngfuncs.pTriAPI->TexCoord2f(1, 0);
-	gEngfuncs.pTriAPI->Vertex3fv(topRight);
-
-	gEngfuncs.pTriAPI->End();
-
-	gEngfuncs.pTriAPI->RenderMode(kRenderNormal);
-	gEngfuncs.pTriAPI->CullFace(TRI_FRONT);
+	return true;
 }
 
 void CBaseParticle::Animate(float time)
@@ -363,6 +450,9 @@ void CBaseParticle::CheckCollision(float time)
 		return;
 	}
 
+	//When the last check was, ThinkAll can skip particles for a few frames.
+	const float lastCollisionTime = m_flNextCollisionTime;
+
 	m_flNextCollisionTime = time;
 
 	if ((m_iCollisionFlags & (TRI_WATERTRACE | TRI_COLLIDEALL | TRI_COLLIDEWORLD)) == 0)
@@ -416,7 +506,10 @@ void CBaseParticle::CheckCollision(float time)
 	{
 		const float frametime = time - g_flOldTime;
 
-		m_vOrigin = m_vPrevOrigin + m_vVelocity * (trace.fraction * frametime);
+		//The trace covers the path since the last check, which can be more than one frame.
+		const float tracetime = lastCollisionTime > 0 ? time - lastCollisionTime : frametime;
+
+		m_vOrigin = m_vPrevOrigin + m_vVelocity * (trace.fraction * tracetime);
 
 		float bounce;
 
@@ -491,6 +584,116 @@ void CBaseParticle::Force()
 	//Nothing.
 }
 
+/**
+*	@brief Particles moved per job, small enough to spread a big effect over every thread.
+*/
+constexpr std::size_t ParticleMoveChunkSize = 512;
+
+/**
+*	@brief Particles that moved less than this since their last collision check keep its result.
+*/
+constexpr float ParticleSlowMove = 2;
+
+struct ParticleMoveJob
+{
+	CBaseParticle* const* Particles;
+	std::size_t Count;
+	float Time;
+};
+
+/**
+*	@brief Runs the steps of Think before collision on one chunk of particles.
+*	These only touch the particle itself, so chunks can run on any thread.
+*/
+static void ParticleMoveChunk(int index, int thread, void* pdata)
+{
+	const auto job = static_cast<const ParticleMoveJob*>(pdata);
+
+	const std::size_t first = index * ParticleMoveChunkSize;
+	const std::size_t last = std::min(first + ParticleMoveChunkSize, job->Count);
+
+	for (std::size_t i = first; i < last; ++i)
+	{
+		auto particle = job->Particles[i];
+
+		if ((particle->GetCollisionFlags() & TRI_ANIMATEDIE) != 0)
+		{
+			particle->CBaseParticle::AnimateAndDie(job->Time);
+		}
+		else
+		{
+			particle->CBaseParticle::Animate(job->Time);
+		}
+
+		particle->CBaseParticle::Contract(job->Time);
+		particle->CBaseParticle::Expand(job->Time);
+		particle->CBaseParticle::Fade(job->Time);
+		particle->CBaseParticle::Spin(job->Time);
+		particle->CBaseParticle::CalculateVelocity(job->Time);
+	}
+}
+
+ParticleCollisionStats CBaseParticle::ThinkAll(CBaseParticle* const* particles, std::size_t count, float time, int maxTraces)
+{
+	ParticleCollisionStats stats;
+
+	const ParticleMoveJob job{particles, count, time};
+	StudioJobs_Run(static_cast<int>((count + ParticleMoveChunkSize - 1) / ParticleMoveChunkSize), &ParticleMoveChunk, const_cast<ParticleMoveJob*>(&job));
+
+	//The engine's traces aren't thread safe, collisions are checked here.
+	static std::vector<std::size_t> candidates;
+	candidates.clear();
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		auto particle = particles[i];
+
+		if ((particle->m_iCollisionFlags & (TRI_WATERTRACE | TRI_COLLIDEALL | TRI_COLLIDEWORLD)) == 0)
+		{
+			//Nothing to trace.
+			particle->CBaseParticle::CheckCollision(time);
+			continue;
+		}
+
+		//The previous origin stays put, so once the particle has moved far enough the trace covers the whole path.
+		if ((particle->m_vOrigin - particle->m_vPrevOrigin).LengthSquared() < ParticleSlowMove * ParticleSlowMove)
+		{
+			++stats.m_iReused;
+			continue;
+		}
+
+		candidates.push_back(i);
+	}
+
+	if (maxTraces > 0 && candidates.size() > static_cast<std::size_t>(maxTraces))
+	{
+		//Keep the particles that went the longest without a check, the rest catch up on later frames.
+		const auto staler = [&](std::size_t lhs, std::size_t rhs)
+		{
+			const float lhsTime = particles[lhs]->m_flNextCollisionTime;
+			const float rhsTime = particles[rhs]->m_flNextCollisionTime;
+
+			return lhsTime != rhsTime ? lhsTime < rhsTime : lhs < rhs;
+		};
+
+		std::nth_element(candidates.begin(), candidates.begin() + maxTraces, candidates.end(), staler);
+
+		stats.m_iDeferred = static_cast<int>(candidates.size()) - maxTraces;
+		candidates.resize(maxTraces);
+
+		std::sort(candidates.begin(), candidates.end());
+	}
+
+	for (auto index : candidates)
+	{
+		particles[index]->CBaseParticle::CheckCollision(time);
+	}
+
+	stats.m_iTraces = static_cast<int>(candidates.size());
+
+	return stats;
+}
+
 void CBaseParticle::Think(float time)
 {
 	if ((m_iCollisionFlags & TRI_ANIMATEDIE) != 0)
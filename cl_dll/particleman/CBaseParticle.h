@@ -23,6 +23,8 @@
 
 #include "CMiniMem.h"
 
+struct ParticleQuad;
+
 //pure virtual baseclass
 class CBaseParticle
 {
@@ -34,6 +36,11 @@ private:
 	int m_iCollisionFlags;
 	float m_flPlayerDistance; //Used for sorting the particles, DO NOT TOUCH.
 
+	/**
+	*	@brief Refreshes m_bInPVS every 0.1 seconds, returns false if the PVS keeps the particle from being drawn.
+	*/
+	bool CheckPVS();
+
 public:
 	void* operator new(size_t size)
 	{
@@ -71,6 +78,26 @@ public:
 	virtual void InitializeSprite(Vector org, Vector normal, model_s* sprite, float size, float brightness);
 	virtual void Force(void);
 
+	/**
+	*	@brief Fills in the quad Draw would render, returns false if there is nothing to draw.
+	*/
+	bool BuildQuad(ParticleQuad& quad);
+
+	/**
+	*	@brief Runs CBaseParticle::Think on particles that don't override any of its steps.
+	*	Movement runs in parallel chunks, collisions run on the calling thread in list order
+	*	with at most maxTraces of them per frame, or no limit if maxTraces is 0.
+	*	The results don't depend on the number of threads.
+	*/
+	static ParticleCollisionStats ThinkAll(CBaseParticle* const* particles, std::size_t count, float time, int maxTraces);
+
+	/**
+	*	@brief Runs CBaseParticle::CheckVisibility on particles that don't override it,
+	*	testing the sphere and point culled ones against the frustum in one batch.
+	*	Sets visible[i] to whether particles[i] should be drawn.
+	*/
+	static void CheckVisibilityAll(CBaseParticle* const* particles, std::size_t count, std::uint8_t* visible);
+
 	float m_flSize;			 //scale of object
 	float m_flScaleSpeed;	 //speed at which object expands
 	float m_flContractSpeed; //speed at which object expands
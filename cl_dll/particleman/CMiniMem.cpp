@@ -16,6 +16,9 @@
 #undef clamp
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <typeinfo>
 
 #include "hud.h"
 #include "cl_util.h"
@@ -42,7 +45,19 @@ void CMiniMem::Deallocate(void* memory, std::size_t sizeInBytes, std::size_t ali
 		return;
 	}
 
-	_particles.erase(std::find(_particles.begin(), _particles.end(), memory));
+	if (!_sweeping)
+	{
+		_particles.erase(std::find(_particles.begin(), _particles.end(), memory));
+	}
+	else if (memory != _deleting)
+	{
+		//Deleted by another particle's Die, leave a hole so the sweep's indices stay valid.
+		if (auto it = std::find(_particles.begin(), _particles.end(), memory); it != _particles.end())
+		{
+			*it = nullptr;
+			_hasHoles = true;
+		}
+	}
 
 	_pool.deallocate(memory, sizeInBytes, alignment);
 }
@@ -63,75 +78,240 @@ CMiniMem* CMiniMem::Instance()
 	return _instance;
 }
 
-void CMiniMem::ProcessAll()
+void CMiniMem::SweepDead(float time)
 {
-	const float time = gEngfuncs.GetClientTime();
+	_sweeping = true;
 
-	//Clear list of visible particles.
-	_visibleParticles = 0;
-
-	//Divide the particle list in two: the list of visible particles and the list of invisible particles.
-	//Remove any particles that have died.
-	std::size_t invisibleCount = 0;
+	std::size_t liveCount = 0;
 
-	for (std::size_t i = 0; i < (_particles.size() - invisibleCount);)
+	//Particles created by Die are appended and checked as well.
+	for (std::size_t i = 0; i < _particles.size(); ++i)
 	{
 		auto effect = _particles[i];
 
-		if (!IsGamePaused())
+		if (!effect)
 		{
-			effect->Think(time);
+			continue;
 		}
 
+		_particles[i] = nullptr;
+
 		if (0 != effect->m_flDieTime && time >= effect->m_flDieTime)
 		{
+			_deleting = effect;
 			effect->Die();
 			delete effect;
+			_deleting = nullptr;
+			continue;
+		}
 
-			//Don't do this! operator delete removes the effect from the list.
-			//_particles.erase(_particles.begin() + i);
+		_particles[liveCount++] = effect;
+	}
+
+	_particles.resize(liveCount);
+
+	_sweeping = false;
+
+	if (_hasHoles)
+	{
+		_particles.erase(std::remove(_particles.begin(), _particles.end(), nullptr), _particles.end());
+		_hasHoles = false;
+	}
+}
+
+void CMiniMem::SortVisible()
+{
+	const std::size_t count = _sorted.size();
+
+	//The list starts out in last frame's draw order, so it's usually close to sorted.
+	//Insertion sort finishes that in about linear time, give up on it if it has to move too much.
+	const std::size_t maxMoves = count * 4;
+	std::size_t moves = 0;
+
+	for (std::size_t i = 1; i < count && moves <= maxMoves; ++i)
+	{
+		const SortEntry entry = _sorted[i];
+
+		std::size_t j = i;
+
+		for (; j > 0 && _sorted[j - 1].Key > entry.Key && moves <= maxMoves; --j, ++moves)
+		{
+			_sorted[j] = _sorted[j - 1];
+		}
+
+		_sorted[j] = entry;
+	}
+
+	if (moves <= maxMoves)
+	{
+		return;
+	}
+
+	//Stable radix sort on 11 bit digits.
+	constexpr int DigitBits = 11;
+	constexpr std::size_t NumBuckets = 1 << DigitBits;
+
+	_sortScratch.resize(count);
+
+	SortEntry* from = _sorted.data();
+	SortEntry* to = _sortScratch.data();
+
+	for (int shift = 0; shift < 32; shift += DigitBits)
+	{
+		std::size_t offsets[NumBuckets] = {};
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			++offsets[(from[i].Key >> shift) & (NumBuckets - 1)];
+		}
+
+		//All keys share this digit, nothing would move.
+		if (offsets[(from[0].Key >> shift) & (NumBuckets - 1)] == count)
+		{
 			continue;
 		}
 
-		if (effect->CheckVisibility())
+		std::size_t total = 0;
+
+		for (auto& offset : offsets)
 		{
-			auto player = gEngfuncs.GetLocalPlayer();
-			effect->SetPlayerDistance((player->origin - effect->m_vOrigin).LengthSquared());
+			const std::size_t bucketSize = offset;
+			offset = total;
+			total += bucketSize;
+		}
 
-			++_visibleParticles;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			to[offsets[(from[i].Key >> shift) & (NumBuckets - 1)]++] = from[i];
 		}
-		else
+
+		std::swap(from, to);
+	}
+
+	if (from != _sorted.data())
+	{
+		_sorted.swap(_sortScratch);
+	}
+}
+
+void CMiniMem::ProcessAll()
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	const float time = gEngfuncs.GetClientTime();
+
+	if (!IsGamePaused())
+	{
+		//Plain particles think in batches, ones that override anything think on their own.
+		_thinkBatch.clear();
+
+		for (std::size_t i = 0; i < _particles.size(); ++i)
 		{
-			if (i + invisibleCount < _particles.size())
+			auto effect = _particles[i];
+
+			if (typeid(*effect) == typeid(CBaseParticle))
 			{
-				//There is an effect we haven't checked yet.
-				//Put the invisible effect at the end of the list and check the other effect next.
-				std::swap(_particles[i], _particles[_particles.size() - 1 - invisibleCount]);
-				++invisibleCount;
-				continue;
+				_thinkBatch.push_back(effect);
+			}
+			else
+			{
+				effect->Think(time);
 			}
-			//No more unchecked effects in the list.
 		}
 
-		++i;
+		_collisionStats = CBaseParticle::ThinkAll(_thinkBatch.data(), _thinkBatch.size(), time, g_iMaxParticleTraces);
 	}
 
-	std::sort(_particles.begin(), _particles.begin() + _visibleParticles, [](const auto& lhs, const auto& rhs)
+	//Remove any particles that have died.
+	SweepDead(time);
+
+	//Divide the particle list in two: the list of visible particles and the list of invisible particles.
+	auto player = gEngfuncs.GetLocalPlayer();
+
+	_sorted.clear();
+	_hidden.clear();
+
+	//Plain particles are frustum culled in one batch, in the same order as the loop below.
+	_cullBatch.clear();
+
+	for (auto effect : _particles)
+	{
+		if (typeid(*effect) == typeid(CBaseParticle))
 		{
-			//Particles are ordered farthest to nearest so they can be drawn in order.
-			const float lhsDistance = lhs->GetPlayerDistance();
-			const float rhsDistance = rhs->GetPlayerDistance();
+			_cullBatch.push_back(effect);
+		}
+	}
+
+	_cullVisible.resize(_cullBatch.size());
+	CBaseParticle::CheckVisibilityAll(_cullBatch.data(), _cullBatch.size(), _cullVisible.data());
 
-			return lhsDistance > rhsDistance;
-		});
+	std::size_t cullIndex = 0;
 
-	for (std::size_t i = 0; i < _visibleParticles; ++i)
+	for (std::size_t i = 0; i < _particles.size(); ++i)
 	{
 		auto effect = _particles[i];
-		effect->Draw();
+
+		const bool visible = typeid(*effect) == typeid(CBaseParticle) ? 0 != _cullVisible[cullIndex++] : effect->CheckVisibility();
+
+		if (visible)
+		{
+			const float distance = (player->origin - effect->m_vOrigin).LengthSquared();
+			effect->SetPlayerDistance(distance);
+
+			//Distances are positive, so their flipped bits order them farthest to nearest.
+			std::uint32_t bits;
+			std::memcpy(&bits, &distance, sizeof(bits));
+
+			_sorted.push_back({~bits, effect});
+		}
+		else
+		{
+			_hidden.push_back(effect);
+		}
 	}
 
+	_visibleParticles = _sorted.size();
+
+	SortVisible();
+
+	//Keep the list in draw order so next frame's sort starts out close.
+	_particles.clear();
+
+	for (const auto& entry : _sorted)
+	{
+		_particles.push_back(entry.Particle);
+	}
+
+	_particles.insert(_particles.end(), _hidden.begin(), _hidden.end());
+
+	_batch.ResetSubmissions();
+
+	for (const auto& entry : _sorted)
+	{
+		auto effect = entry.Particle;
+
+		if (typeid(*effect) == typeid(CBaseParticle))
+		{
+			ParticleQuad quad;
+
+			if (effect->BuildQuad(quad))
+			{
+				_batch.Add(quad);
+			}
+		}
+		else
+		{
+			//Draw everything before it first, so the order stays back to front.
+			_batch.Flush();
+			effect->Draw();
+		}
+	}
+
+	_batch.Flush();
+
 	g_flOldTime = time;
+
+	_processTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 }
 
 int CMiniMem::ApplyForce(Vector vOrigin, Vector vDirection, float flRadius, float flStrength)
@@ -210,14 +390,34 @@ void CMiniMem::Reset()
 {
 	_visibleParticles = 0;
 
-	for (auto particle : _particles)
+	_sweeping = true;
+
+	for (std::size_t i = 0; i < _particles.size(); ++i)
 	{
+		auto particle = _particles[i];
+
+		if (!particle)
+		{
+			continue;
+		}
+
+		_particles[i] = nullptr;
+
+		_deleting = particle;
 		particle->Die();
 		delete particle;
 	}
 
-	//Cleared by CBaseParticle::operator delete
-	//_particles.clear();
+	_deleting = nullptr;
+	_sweeping = false;
+	_hasHoles = false;
+
+	_particles.clear();
+	_sorted.clear();
+	_hidden.clear();
+	_thinkBatch.clear();
+	_cullBatch.clear();
+	_cullVisible.clear();
 
 	//Wipe away previously allocated memory so maps with loads of particles don't eat up memory forever.
 	_pool.release();
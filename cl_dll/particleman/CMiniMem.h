@@ -1,13 +1,26 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory_resource>
 #include <vector>
 
+#include "CParticleBatch.h"
+
 class CBaseParticle;
 
 #define TRIANGLE_FPS 30
 
+/**
+*	@brief Collision work done by CBaseParticle::ThinkAll in a frame.
+*/
+struct ParticleCollisionStats
+{
+	int m_iTraces = 0;	 //Particles that checked for collisions
+	int m_iDeferred = 0; //Particles left for a later frame by the trace budget
+	int m_iReused = 0;	 //Slow particles that kept their last result
+};
+
 /**
 *	@brief Simple allocator that uses a chunk-based pool to serve requests.
 */
@@ -21,6 +34,35 @@ private:
 	std::vector<CBaseParticle*> _particles;
 	std::size_t _visibleParticles = 0;
 
+	//Set while ProcessAll or Reset delete particles, Deallocate leaves the list to them.
+	bool _sweeping = false;
+	CBaseParticle* _deleting = nullptr;
+	bool _hasHoles = false;
+
+	//Particles that think through CBaseParticle::ThinkAll this frame.
+	std::vector<CBaseParticle*> _thinkBatch;
+
+	//Particles that are culled through CBaseParticle::CheckVisibilityAll this frame, and the results.
+	std::vector<CBaseParticle*> _cullBatch;
+	std::vector<std::uint8_t> _cullVisible;
+
+	struct SortEntry
+	{
+		std::uint32_t Key;
+		CBaseParticle* Particle;
+	};
+
+	//Visible particles, farthest first after SortVisible.
+	std::vector<SortEntry> _sorted;
+	std::vector<SortEntry> _sortScratch;
+	std::vector<CBaseParticle*> _hidden;
+
+	CParticleBatch _batch;
+
+	ParticleCollisionStats _collisionStats;
+
+	double _processTime = 0;
+
 protected:
 	// private constructor and destructor.
 	CMiniMem() = default;
@@ -41,6 +83,16 @@ public:
 
 	static CMiniMem* Instance();
 
+private:
+	void SweepDead(float time);
+
+	void SortVisible();
+
+public:
+
 	std::size_t GetTotalParticles() { return _particles.size(); }
 	std::size_t GetDrawnParticles() { return _visibleParticles; }
+	std::size_t GetDrawSubmissions() { return _batch.GetSubmissions(); }
+	double GetProcessTime() { return _processTime; }
+	const ParticleCollisionStats& GetCollisionStats() { return _collisionStats; }
 };
@@ -0,0 +1,80 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+
+#include "hud.h"
+#include "cl_util.h"
+#include "triangleapi.h"
+#include "CParticleBatch.h"
+
+void CParticleBatch::Add(const ParticleQuad& quad)
+{
+	if (!_quads.empty())
+	{
+		const auto& last = _quads.back();
+
+		if (last.m_pTexture != quad.m_pTexture || last.m_iFrame != quad.m_iFrame || last.m_iRendermode != quad.m_iRendermode)
+		{
+			Flush();
+		}
+	}
+
+	_quads.push_back(quad);
+}
+
+void CParticleBatch::Flush()
+{
+	if (_quads.empty())
+	{
+		return;
+	}
+
+	Draw(_quads.data(), _quads.size());
+	++_submissions;
+
+	_quads.clear();
+}
+
+void CParticleBatch::Draw(const ParticleQuad* quads, std::size_t count)
+{
+	gEngfuncs.pTriAPI->SpriteTexture(quads[0].m_pTexture, quads[0].m_iFrame);
+	gEngfuncs.pTriAPI->RenderMode(quads[0].m_iRendermode);
+	gEngfuncs.pTriAPI->CullFace(TRI_NONE);
+
+	gEngfuncs.pTriAPI->Begin(TRI_QUADS);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const auto& quad = quads[i];
+
+		gEngfuncs.pTriAPI->Color4f(quad.m_flColor[0], quad.m_flColor[1], quad.m_flColor[2], quad.m_flColor[3]);
+
+		gEngfuncs.pTriAPI->TexCoord2f(0, 0);
+		gEngfuncs.pTriAPI->Vertex3fv(quad.m_vCorners[0]);
+
+		gEngfuncs.pTriAPI->TexCoord2f(0, 1);
+		gEngfuncs.pTriAPI->Vertex3fv(quad.m_vCorners[1]);
+
+		gEngfuncs.pTriAPI->TexCoord2f(1, 1);
+		gEngfuncs.pTriAPI->Vertex3fv(quad.m_vCorners[2]);
+
+		gEngfuncs.pTriAPI->TexCoord2f(1, 0);
+		gEngfuncs.pTriAPI->Vertex3fv(quad.m_vCorners[3]);
+	}
+
+	gEngfuncs.pTriAPI->End();
+
+	gEngfuncs.pTriAPI->RenderMode(kRenderNormal);
+	gEngfuncs.pTriAPI->CullFace(TRI_FRONT);
+}
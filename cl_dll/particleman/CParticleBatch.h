@@ -0,0 +1,56 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct model_s;
+
+/**
+*	@brief A particle's sprite quad, corners are top left, low left, low right and top right.
+*/
+struct ParticleQuad
+{
+	model_s* m_pTexture;
+	int m_iFrame;
+	int m_iRendermode;
+
+	float m_flColor[4];
+	Vector m_vCorners[4];
+};
+
+/**
+*	@brief Collects sprite quads in draw order and submits each run of quads
+*	that share a texture, frame and render mode with a single Begin/End pair.
+*/
+class CParticleBatch
+{
+private:
+	std::vector<ParticleQuad> _quads;
+	std::size_t _submissions = 0;
+
+public:
+	void Add(const ParticleQuad& quad);
+
+	void Flush(); //Draws the pending run.
+
+	//Draws quads that all share the first quad's texture, frame and render mode.
+	static void Draw(const ParticleQuad* quads, std::size_t count);
+
+	std::size_t GetSubmissions() const { return _submissions; }
+	void ResetSubmissions() { _submissions = 0; }
+};
@@ -13,6 +13,11 @@
 *
 ****/
 
+//The triangle API uses OpenGL constants for certain functions.
+#include "PlatformHeaders.h"
+#include <GL/gl.h>
+
+#include <algorithm>
 #include <vector>
 
 #include "hud.h"
@@ -26,9 +31,69 @@
 static bool g_iRenderMode = true;
 
 static cvar_t* cl_pmanstats = nullptr;
+static cvar_t* cl_pmantraces = nullptr;
 
 static std::vector<ForceMember> g_pForceList;
 
+/**
+*	@brief Emits a cloud of plain particles in front of the player, for timing the particle manager with cl_pmanstats.
+*	Usage: cl_pmanbench [count], 50000 particles by default.
+*/
+static void ParticleBenchmark_f()
+{
+	if (!g_pParticleMan)
+	{
+		return;
+	}
+
+	int count = 50000;
+
+	if (gEngfuncs.Cmd_Argc() > 1)
+	{
+		count = std::max(1, atoi(gEngfuncs.Cmd_Argv(1)));
+	}
+
+	auto sprite = gEngfuncs.CL_LoadModel("sprites/steam1.spr", nullptr);
+
+	if (!sprite)
+	{
+		gEngfuncs.Con_Printf("cl_pmanbench: couldn't load sprites/steam1.spr\n");
+		return;
+	}
+
+	auto player = gEngfuncs.GetLocalPlayer();
+
+	Vector forward, right, up;
+	gEngfuncs.pfnAngleVectors(g_vViewAngles, forward, right, up);
+
+	const Vector center = player->origin + forward * 256;
+	const float time = gEngfuncs.GetClientTime();
+
+	for (int i = 0; i < count; ++i)
+	{
+		const Vector offset{gEngfuncs.pfnRandomFloat(-128, 128), gEngfuncs.pfnRandomFloat(-128, 128), gEngfuncs.pfnRandomFloat(-64, 64)};
+
+		auto particle = g_pParticleMan->CreateParticle(center + offset, g_vecZero, sprite, gEngfuncs.pfnRandomFloat(4, 12), 200, "pmanbench");
+
+		if (!particle)
+		{
+			break;
+		}
+
+		particle->m_vVelocity = Vector{gEngfuncs.pfnRandomFloat(-32, 32), gEngfuncs.pfnRandomFloat(-32, 32), gEngfuncs.pfnRandomFloat(16, 96)};
+		particle->m_flGravity = 0.1;
+		particle->m_flScaleSpeed = 0.2;
+		particle->m_flFadeSpeed = 0;
+		particle->m_flDieTime = time + gEngfuncs.pfnRandomFloat(4, 8);
+		particle->m_iRendermode = kRenderTransAdd;
+		particle->SetLightFlag(LIGHT_NONE);
+		particle->SetCullFlag(CULL_FRUSTUM_SPHERE);
+		particle->SetRenderFlag(RENDER_FACEPLAYER);
+	}
+
+	gEngfuncs.Con_Printf("cl_pmanbench: emitted %d particles\n", count);
+}
+
 EXPOSE_INTERFACE(IParticleMan_Active, IParticleMan, PARTICLEMAN_INTERFACE);
 
 IParticleMan_Active::IParticleMan_Active()
@@ -65,6 +130,9 @@ void IParticleMan_Active::SetUp(cl_enginefunc_t* pEnginefuncs)
 	//std::memcpy(&gEngfuncs, pEnginefuncs, sizeof(gEngfuncs));
 
 	cl_pmanstats = gEngfuncs.pfnRegisterVariable("cl_pmanstats", "0", 0);
+	cl_pmantraces = gEngfuncs.pfnRegisterVariable("cl_pmantraces", "512", 0);
+
+	gEngfuncs.pfnAddCommand("cl_pmanbench", ParticleBenchmark_f);
 }
 
 CBaseParticle* IParticleMan_Active::CreateParticle(Vector org, Vector normal, model_s* sprite, float size, float brightness, const char* classname)
@@ -125,7 +193,15 @@ void IParticleMan_Active::Update()
 		memory->ApplyForce(member.m_vOrigin, member.m_vDirection, member.m_flRadius, member.m_flStrength);
 	}
 
-	g_cFrustum.CalculateFrustum();
+	float projection[16];
+	gEngfuncs.pTriAPI->GetMatrix(GL_PROJECTION_MATRIX, projection);
+
+	float modelview[16];
+	gEngfuncs.pTriAPI->GetMatrix(GL_MODELVIEW_MATRIX, modelview);
+
+	Frustum_SetFromMatrices(&g_Frustum, projection, modelview);
+
+	g_iMaxParticleTraces = nullptr != cl_pmantraces ? std::max(0, static_cast<int>(cl_pmantraces->value)) : 0;
 
 	memory->ProcessAll();
 
@@ -134,5 +210,9 @@ void IParticleMan_Active::Update()
 		//TODO: engine doesn't support printing size_t, use local printf
 		gEngfuncs.Con_NPrintf(15, "Number of Particles: %d", static_cast<int>(CMiniMem::Instance()->GetTotalParticles()));
 		gEngfuncs.Con_NPrintf(16, "Particles Drawn: %d", static_cast<int>(CMiniMem::Instance()->GetDrawnParticles()));
+		gEngfuncs.Con_NPrintf(17, "Particle Update: %.2f ms, %d draw batches", CMiniMem::Instance()->GetProcessTime(), static_cast<int>(CMiniMem::Instance()->GetDrawSubmissions()));
+
+		const auto& collisions = CMiniMem::Instance()->GetCollisionStats();
+		gEngfuncs.Con_NPrintf(14, "Particle Collisions: %d traced, %d deferred, %d reused", collisions.m_iTraces, collisions.m_iDeferred, collisions.m_iReused);
 	}
 }
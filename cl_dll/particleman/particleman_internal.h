@@ -27,14 +27,15 @@
 #include <algorithm>
 #include <cstddef>
 
-#include "CFrustum.h"
+#include "frustum.h"
 
 constexpr std::size_t MaxForceElements = 128;
 
-inline CFrustum g_cFrustum;
+inline frustum_t g_Frustum;
 inline float g_flGravity;
 inline float g_flOldTime;
 inline Vector g_vViewAngles;
+inline int g_iMaxParticleTraces; //Collision checks allowed per frame, 0 for no limit
 
 inline bool IsGamePaused()
 {
@@ -0,0 +1,200 @@
+//========= Copyright © 1996-2002, Valve LLC, All rights reserved. ============
+//
+// Purpose: Small work-stealing pool for per-frame studio model jobs
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "studio_jobs.h"
+
+// Upper limit on threads, the calling one included
+#define STUDIO_JOBS_MAX_THREADS 8
+
+// Slice of a batch a thread starts on, the others steal from it once theirs is empty
+struct studiojobrange_t
+{
+	std::atomic<int> next;
+	int end;
+};
+
+struct studiojobpool_t
+{
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable startcondition;
+	std::condition_variable donecondition;
+	bool quittingtime = false;
+
+	// Bumped for every batch, workers wait for it to change
+	int generation = 0;
+	// Workers still running the current batch
+	int numbusy = 0;
+
+	pfnStudioJob_t pfnjob = nullptr;
+	void* pdata = nullptr;
+	int numranges = 0;
+	studiojobrange_t ranges[STUDIO_JOBS_MAX_THREADS];
+};
+
+studiojobpool_t g_StudioJobPool;
+
+/*
+====================
+StudioJobs_Work
+
+====================
+*/
+void StudioJobs_Work( int thread )
+{
+	studiojobpool_t& pool = g_StudioJobPool;
+
+	// Own range first, then steal from the others
+	for(int i = 0; i < pool.numranges; i++)
+	{
+		studiojobrange_t& range = pool.ranges[(thread + i) % pool.numranges];
+		while(true)
+		{
+			int index = range.next.fetch_add(1);
+			if(index >= range.end)
+				break;
+
+			pool.pfnjob(index, thread, pool.pdata);
+		}
+	}
+}
+
+/*
+====================
+StudioJobs_ThreadFunction
+
+====================
+*/
+void StudioJobs_ThreadFunction( int thread )
+{
+	studiojobpool_t& pool = g_StudioJobPool;
+	int generation = 0;
+
+	while(true)
+	{
+		{
+			std::unique_lock lock{pool.mutex};
+			pool.startcondition.wait(lock, [&]()
+				{ return pool.quittingtime || pool.generation != generation; });
+
+			if(pool.quittingtime)
+				break;
+
+			generation = pool.generation;
+		}
+
+		StudioJobs_Work(thread);
+
+		{
+			std::lock_guard guard{pool.mutex};
+			pool.numbusy--;
+		}
+
+		pool.donecondition.notify_one();
+	}
+}
+
+/*
+====================
+StudioJobs_NumThreads
+
+====================
+*/
+int StudioJobs_NumThreads( void )
+{
+	studiojobpool_t& pool = g_StudioJobPool;
+
+	if(pool.threads.empty())
+	{
+		// Leave a core for the engine, the calling thread makes up for it
+		int numthreads = (int)std::thread::hardware_concurrency() - 1;
+		if(numthreads > STUDIO_JOBS_MAX_THREADS)
+			numthreads = STUDIO_JOBS_MAX_THREADS;
+
+		for(int i = 1; i < numthreads; i++)
+			pool.threads.emplace_back(&StudioJobs_ThreadFunction, i);
+	}
+
+	return pool.threads.size() + 1;
+}
+
+/*
+====================
+StudioJobs_Run
+
+====================
+*/
+void StudioJobs_Run( int count, pfnStudioJob_t pfnJob, void* pdata )
+{
+	studiojobpool_t& pool = g_StudioJobPool;
+
+	int numthreads = StudioJobs_NumThreads();
+	if(numthreads == 1 || count < 2)
+	{
+		for(int i = 0; i < count; i++)
+			pfnJob(i, 0, pdata);
+
+		return;
+	}
+
+	pool.pfnjob = pfnJob;
+	pool.pdata = pdata;
+	pool.numranges = numthreads;
+
+	for(int i = 0; i < numthreads; i++)
+	{
+		pool.ranges[i].next = count * i / numthreads;
+		pool.ranges[i].end = count * (i + 1) / numthreads;
+	}
+
+	{
+		std::lock_guard guard{pool.mutex};
+		pool.numbusy = numthreads - 1;
+		pool.generation++;
+	}
+
+	pool.startcondition.notify_all();
+
+	StudioJobs_Work(0);
+
+	// Every worker has to be out before the ranges can be reused
+	std::unique_lock lock{pool.mutex};
+	pool.donecondition.wait(lock, [&]()
+		{ return pool.numbusy == 0; });
+}
+
+/*
+====================
+StudioJobs_Shutdown
+
+====================
+*/
+void StudioJobs_Shutdown( void )
+{
+	studiojobpool_t& pool = g_StudioJobPool;
+	if(pool.threads.empty())
+		return;
+
+	{
+		std::lock_guard guard{pool.mutex};
+		pool.quittingtime = true;
+	}
+
+	pool.startcondition.notify_all();
+
+	for(std::thread& thread : pool.threads)
+		thread.join();
+
+	pool.threads.clear();
+	pool.quittingtime = false;
+}
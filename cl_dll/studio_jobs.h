@@ -0,0 +1,21 @@
+//========= Copyright © 1996-2002, Valve LLC, All rights reserved. ============
+//
+// Purpose: Small work-stealing pool for per-frame studio model jobs
+//
+// $NoKeywords: $
+//=============================================================================
+
+#pragma once
+
+// Job callback, thread is 0 for the calling thread and 1..StudioJobs_NumThreads()-1 for workers
+typedef void (*pfnStudioJob_t)(int index, int thread, void* pdata);
+
+// Threads that run jobs, the calling thread included
+extern int StudioJobs_NumThreads();
+
+// Runs the job for every index in [0, count) and returns once all of them are done.
+// The engine APIs aren't thread safe, jobs must stay away from them
+extern void StudioJobs_Run(int count, pfnStudioJob_t pfnJob, void* pdata);
+
+// Stops the worker threads
+extern void StudioJobs_Shutdown();
@@ -36,13 +36,11 @@
 #include "event_args.h"
 #include "in_defs.h"
 #include "pm_defs.h"
+#include "svd_render.h"
 
 #define GLEW_STATIC 1
 #include "GL/glew.h"
 
-// msurface_t struct size
-extern int g_msurfaceStructSize;
-
 // Global engine <-> studio model rendering code interface
 extern engine_studio_api_t IEngineStudio;
 
@@ -104,11 +102,11 @@ const msurface_t* Mod_SurfaceAtPoint( const model_t* pmodel, const mnode_t* pnod
 	if(psurface)
 		return psurface;
 
-	byte* pfirstsurfaceptr = reinterpret_cast<byte*>(pmodel->surfaces);
+	const svdsurface_t* psurfaces = SVD_GetWorldSurfaces();
 	for(int i = 0; i < pnode->numsurfaces; i++)
 	{
-		msurface_t* psurface = reinterpret_cast<msurface_t*>(pfirstsurfaceptr + g_msurfaceStructSize*(pnode->firstsurface+i));
-		mtexinfo_t *ptexinfo = psurface->texinfo;
+		msurface_t* psurface = psurfaces[pnode->firstsurface+i].psurface;
+		mtexinfo_t *ptexinfo = psurfaces[pnode->firstsurface+i].texinfo;
 
 		int ds = (int)(DotProduct(mid, ptexinfo->vecs[0]) + ptexinfo->vecs[0][3]);
 		int dt = (int)(DotProduct(mid, ptexinfo->vecs[1]) + ptexinfo->vecs[1][3]);
@@ -135,6 +133,27 @@ void CStudioModelRenderer::StudioGetMinsMaxs ( Vector& outMins, Vector& outMaxs
 	if (m_pCurrentEntity->curstate.sequence >=  m_pStudioHeader->numseq) 
 		m_pCurrentEntity->curstate.sequence = 0;
 
+	// Lights, shadow setup and the shadow LOD all ask for the same box
+	studioposecache_t* pcache = NULL;
+	if (m_pCvarPoseCache->value >= 1)
+	{
+		StudioPoseCacheFrame();
+
+		pcache = &m_poseCache[StudioCacheKey()];
+		if (pcache->boundstime == m_clTime
+			&& pcache->boundssequence == m_pCurrentEntity->curstate.sequence
+			&& pcache->boundsorigin == m_pCurrentEntity->origin
+			&& pcache->boundsangles == m_pCurrentEntity->angles)
+		{
+			outMins = pcache->mins;
+			outMaxs = pcache->maxs;
+			m_iBoundsCacheHits++;
+			return;
+		}
+
+		m_iBoundsCacheMisses++;
+	}
+
 	// Build full bounding box
 	mstudioseqdesc_t *pseqdesc = (mstudioseqdesc_t *)((byte *)m_pStudioHeader + m_pStudioHeader->seqindex) + m_pCurrentEntity->curstate.sequence;
 
@@ -181,6 +200,17 @@ void CStudioModelRenderer::StudioGetMinsMaxs ( Vector& outMins, Vector& outMaxs
 
 	VectorAdd(outMins, m_pCurrentEntity->origin, outMins);
 	VectorAdd(outMaxs, m_pCurrentEntity->origin, outMaxs);
+
+	if (pcache)
+	{
+		pcache->lastused = m_clTime;
+		pcache->boundstime = m_clTime;
+		pcache->boundssequence = m_pCurrentEntity->curstate.sequence;
+		pcache->boundsorigin = m_pCurrentEntity->origin;
+		pcache->boundsangles = m_pCurrentEntity->angles;
+		pcache->mins = outMins;
+		pcache->maxs = outMaxs;
+	}
 }
 
 /*
@@ -245,6 +275,7 @@ void CStudioModelRenderer::StudioSetupShadows()
 		Vector mins, maxs;
 		StudioGetMinsMaxs(mins, maxs);
 
+		// The engine's sv_skyvec_* cvars, changing them rebuilds the sky leaf table
 		Vector skyVec;
 		skyVec[0] = m_pSkylightDirX->value;
 		skyVec[1] = m_pSkylightDirY->value;
@@ -252,13 +283,9 @@ void CStudioModelRenderer::StudioSetupShadows()
 		skyVec = skyVec.Normalize();
 
 		Vector center = mins *0.5 + maxs * 0.5;
-		Vector end = center - skyVec * 8192;
 
-		model_t* pworld = IEngineStudio.GetModelByIndex(1);
-		const msurface_t* phitsurf = Mod_SurfaceAtPoint(pworld, pworld->nodes, center, end);
-		
 		Vector shadeVector;
-		if(phitsurf && phitsurf->flags & SURF_DRAWSKY)
+		if(SVD_PointSeesSky(center, skyVec))
 		{
 			// Hit by sky
 			shadeVector = skyVec;
@@ -301,6 +328,13 @@ void CStudioModelRenderer::StudioSetupModelSVD( int bodypart )
 	index = index % pbodypart->numsubmodels;
 
 	m_pSVDSubModel = (svdsubmodel_t *)((byte *)m_pSVDHeader + pbodypart->submodelindex) + index;
+
+	// Reduced meshes are complete submodels, so the kernels don't need to know
+	if (m_iShadowLOD > 0 && m_pSVDSubModel->numlods > 0)
+	{
+		int lod = (m_iShadowLOD < m_pSVDSubModel->numlods ? m_iShadowLOD : m_pSVDSubModel->numlods) - 1;
+		m_pSVDSubModel = (svdsubmodel_t *)((byte *)m_pSVDHeader + m_pSVDSubModel->lodindex) + lod;
+	}
 }
 
 
@@ -318,23 +352,155 @@ bool CStudioModelRenderer::StudioShouldDrawShadow()
 	if( IEngineStudio.IsHardware() != 1 )
 		return false;
 
-	if( !m_pRenderModel->visdata )
+	if(m_pCurrentEntity->curstate.renderfx == kRenderFxNoShadow)
 		return false;
 
-	if(m_pCurrentEntity->curstate.renderfx == kRenderFxNoShadow)
+	// Fucking butt-ugly hack to make the shadows less annoying,
+	// the trace normally already ran in the frame's visibility pass
+	int casterState = SVD_GetShadowCasterState(m_pCurrentEntity);
+	if(casterState == SHADOW_CASTER_HIDDEN)
+		return false;
+
+	if(casterState == SHADOW_CASTER_UNKNOWN)
+	{
+		pmtrace_t tr;
+		gEngfuncs.pEventAPI->EV_SetTraceHull( 2 );
+		gEngfuncs.pEventAPI->EV_PlayerTrace( m_vRenderOrigin, m_pCurrentEntity->origin+Vector(0, 0, 1), PM_WORLD_ONLY, -1, &tr);
+
+		if(tr.fraction != 1.0)
+			return false;
+	}
+
+	// Only now is the svd needed, skip the shadow until it's built
+	m_pSVDHeader = SVD_GetModelSVD(m_pRenderModel);
+	if( !m_pSVDHeader )
 		return false;
 
-	// Fucking butt-ugly hack to make the shadows less annoying
-	pmtrace_t tr;
-	gEngfuncs.pEventAPI->EV_SetTraceHull( 2 );
-	gEngfuncs.pEventAPI->EV_PlayerTrace( m_vRenderOrigin, m_pCurrentEntity->origin+Vector(0, 0, 1), PM_WORLD_ONLY, -1, &tr);
+	return StudioSelectShadowLOD();
+}
+
+/*
+====================
+StudioSelectShadowLOD
+
+====================
+*/
+bool CStudioModelRenderer::StudioSelectShadowLOD()
+{
+	StudioShadowLODFrame();
+	StudioPruneShadowCache();
+
+	entityshadowlod_t& state = m_shadowLODs[StudioCacheKey()];
+	state.lastused = m_clTime;
+
+	Vector mins, maxs;
+	StudioGetMinsMaxs(mins, maxs);
+
+	Vector center = (mins + maxs) * 0.5;
+	float radius = (maxs - mins).Length() * 0.5;
+	float distance = (center - Vector(m_vRenderOrigin)).Length();
+	if (distance < 1)
+		distance = 1;
+
+	// Thresholds need some slack so casters at the edge don't flicker
+	float fadeDistance = m_pCvarShadowFadeDistance->value;
+	if (fadeDistance <= 0)
+		state.faded = false;
+	else if (state.faded)
+		state.faded = distance > fadeDistance * 0.9f;
+	else
+		state.faded = distance > fadeDistance;
 
-	if(tr.fraction != 1.0)
+	if (state.faded)
+	{
+		m_iShadowsFaded++;
 		return false;
+	}
+
+	int lod = 0;
+	if (m_pCvarShadowLOD->value > 0)
+	{
+		// default_fov is the horizontal fov of a 4:3 screen
+		float pixelsPerUnit = (ScreenHeight * (4.0f / 3.0f) * 0.5f) / tan(gHUD.m_iFOV * (M_PI / 360.0f));
+		float pixels = radius * pixelsPerUnit / distance;
+
+		float threshold = m_pCvarShadowLODPixels->value;
+		for (int i = 1; i <= SVD_MAX_LODS; i++, threshold *= 0.5f)
+		{
+			float limit = threshold * (state.lod >= i ? 1.15f : 0.85f);
+			if (pixels >= limit)
+				break;
+
+			lod = i;
+		}
+	}
+
+	state.lod = lod;
+
+	// Coarsen until the shadow fits in what's left of the budget
+	int budget = m_pCvarShadowBudget->value;
+	if (budget > 0)
+	{
+		for (; lod <= SVD_MAX_LODS; lod++)
+		{
+			m_iShadowLOD = lod;
 
+			// Caps and sides together come to about two triangles per face
+			int estimate = 0;
+			for (int i = 0; i < m_pStudioHeader->numbodyparts; i++)
+			{
+				StudioSetupModelSVD(i);
+				estimate += m_pSVDSubModel->numfaces * 2;
+			}
+
+			if (m_iShadowTriangles + estimate <= budget)
+				break;
+		}
+
+		if (lod > SVD_MAX_LODS)
+		{
+			m_iShadowsOverBudget++;
+			return false;
+		}
+	}
+
+	m_iShadowLOD = lod;
+	m_iShadowLODCounts[lod]++;
 	return true;
 }
 
+/*
+====================
+StudioShadowLODFrame
+
+====================
+*/
+void CStudioModelRenderer::StudioShadowLODFrame()
+{
+	if (m_iShadowStatsFrame == m_nFrameCount)
+		return;
+
+	if (m_pCvarShadowLODStats->value > 0 && m_iShadowStatsFrame != -1)
+	{
+		char szCounts[64] = "";
+		for (int i = 0; i <= SVD_MAX_LODS; i++)
+		{
+			int length = strlen(szCounts);
+			snprintf(szCounts + length, sizeof(szCounts) - length, i ? " / %d" : "%d", m_iShadowLODCounts[i]);
+		}
+
+		gEngfuncs.Con_NPrintf(18, "Shadows per LOD: %s", szCounts);
+		gEngfuncs.Con_NPrintf(19, "Shadows faded: %d, over budget: %d", m_iShadowsFaded, m_iShadowsOverBudget);
+		gEngfuncs.Con_NPrintf(20, "Shadow triangles: %d", m_iShadowTriangles);
+	}
+
+	memset(m_iShadowLODCounts, 0, sizeof(m_iShadowLODCounts));
+	m_iShadowsFaded = 0;
+	m_iShadowsOverBudget = 0;
+	m_iShadowTriangles = 0;
+	m_iShadowStatsFrame = m_nFrameCount;
+}
+
 /*
 ====================
 StudioDrawShadow
@@ -358,12 +524,26 @@ void CStudioModelRenderer::StudioDrawShadow ()
 	glClientActiveTexture(GL_TEXTURE0);
 	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-	glVertexPointer( 3, GL_FLOAT, sizeof(Vector), m_vertexTransform );
+	// The vertex pointer is set per volume, it points into the stream buffer when bound
+	m_bShadowBuffersBound = m_pCvarShadowVBO->value > 0 && SVD_BindShadowBuffers();
 	glEnableClientState(GL_VERTEX_ARRAY);
 
 	// Set SVD header
 	m_pSVDHeader = (svdheader_t*)m_pRenderModel->visdata;
 
+	// Find the volumes this entity drew last time
+	m_pShadowCache = NULL;
+	if(m_pCvarShadowCache->value > 0)
+	{
+		m_pShadowCache = &m_shadowCache[StudioCacheKey()];
+		m_pShadowCache->lastused = m_clTime;
+		m_shadowCacheKey = StudioShadowVolumeKey();
+	}
+	else if(!m_shadowCache.empty())
+	{
+		m_shadowCache.clear();
+	}
+
 	glDepthMask(GL_FALSE);
 	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE); // disable writes to color buffer
 
@@ -378,6 +558,7 @@ void CStudioModelRenderer::StudioDrawShadow ()
 
 	for (int i = 0; i < m_pStudioHeader->numbodyparts; i++)
 	{
+		m_iShadowBodyPart = i;
 		StudioSetupModelSVD( i );
 		StudioDrawShadowVolume( );
 	}
@@ -394,9 +575,82 @@ void CStudioModelRenderer::StudioDrawShadow ()
 
 	glDisableClientState(GL_VERTEX_ARRAY);
 
+	if(m_bShadowBuffersBound)
+	{
+		SVD_UnbindShadowBuffers();
+		m_bShadowBuffersBound = false;
+	}
+
 	glPopClientAttrib();
 }
 
+/*
+====================
+StudioShadowVolumeKey
+
+====================
+*/
+uint64_t CStudioModelRenderer::StudioShadowVolumeKey()
+{
+	// FNV-1a over the bone transforms and the light setup
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	auto hashBytes = [&hash](const void* pdata, size_t size)
+	{
+		const byte* pbytes = (const byte*)pdata;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= pbytes[i];
+			hash *= 0x100000001B3ULL;
+		}
+	};
+
+	hashBytes(*m_pbonetransform, sizeof(float) * 12 * m_pStudioHeader->numbones);
+	hashBytes(&m_shadowLightType, sizeof(m_shadowLightType));
+
+	if (m_shadowLightType == SL_TYPE_POINTLIGHT)
+		hashBytes(&m_vShadowLightOrigin, sizeof(m_vShadowLightOrigin));
+	else
+		hashBytes(&m_vShadowLightVector, sizeof(m_vShadowLightVector));
+
+	hashBytes(&m_pCvarShadowVolumeExtrudeDistance->value, sizeof(float));
+	hashBytes(&m_pCurrentEntity->curstate.body, sizeof(m_pCurrentEntity->curstate.body));
+	hashBytes(&m_pSVDHeader, sizeof(m_pSVDHeader));
+
+	return hash;
+}
+
+/*
+====================
+StudioPruneShadowCache
+
+====================
+*/
+void CStudioModelRenderer::StudioPruneShadowCache()
+{
+	// Once a second is plenty, entries are only memory
+	if (m_clTime >= m_flShadowCachePruneTime && m_clTime < m_flShadowCachePruneTime + 1.0)
+		return;
+
+	for (auto it = m_shadowCache.begin(); it != m_shadowCache.end();)
+	{
+		// Also catches the clock going backwards on a map change
+		if (it->second.lastused < m_clTime - 1.0 || it->second.lastused > m_clTime)
+			it = m_shadowCache.erase(it);
+		else
+			++it;
+	}
+
+	for (auto it = m_shadowLODs.begin(); it != m_shadowLODs.end();)
+	{
+		if (it->second.lastused < m_clTime - 1.0 || it->second.lastused > m_clTime)
+			it = m_shadowLODs.erase(it);
+		else
+			++it;
+	}
+
+	m_flShadowCachePruneTime = m_clTime;
+}
+
 /*
 ====================
 StudioDrawShadowVolume
@@ -404,14 +658,121 @@ StudioDrawShadowVolume
 ====================
 */
 void CStudioModelRenderer::StudioDrawShadowVolume()
+{
+	if (!m_pSVDSubModel->numfaces)
+		return;
+
+	const int numVertexes = m_pSVDSubModel->numverts * 2;
+
+	// Reuse the volume if nothing it depends on changed
+	shadowvolumecache_t* pcache = NULL;
+	uint64_t key = 0;
+	if (m_pShadowCache && m_iShadowBodyPart < MAXSTUDIOBODYPARTS)
+	{
+		pcache = &m_pShadowCache->bodyparts[m_iShadowBodyPart];
+
+		// Fold in the submodel, body changes pick another one
+		key = (m_shadowCacheKey ^ (uint64_t)(uintptr_t)m_pSVDSubModel) * 0x100000001B3ULL;
+		if (!key)
+			key = 1;
+
+		if (pcache->key == key)
+		{
+			StudioDrawShadowVolumeData(pcache->vertexes.data(), numVertexes, pcache->indexes.data(), pcache->indexes.size());
+			return;
+		}
+	}
+
+	int numIndexes;
+	if (m_pCvarShadowSIMD->value < 1)
+	{
+		numIndexes = StudioBuildShadowVolume_Scalar();
+	}
+	else if (m_pCvarShadowSIMD->value < 2)
+	{
+		numIndexes = StudioBuildShadowVolume_SSE();
+	}
+	else
+	{
+		// Run both kernels and make sure they agree
+		static uint16_t referenceIndexes[MAXSTUDIOTRIANGLES * 3];
+
+		int numReferenceIndexes = StudioBuildShadowVolume_Scalar();
+		memcpy(referenceIndexes, m_shadowVolumeIndexes, sizeof(uint16_t) * numReferenceIndexes);
+
+		numIndexes = StudioBuildShadowVolume_SSE();
+		if (numIndexes != numReferenceIndexes || memcmp(referenceIndexes, m_shadowVolumeIndexes, sizeof(uint16_t) * numIndexes))
+			gEngfuncs.Con_Printf("%s - SSE shadow volume mismatch on %s (%d vs %d indexes)\n", __FUNCTION__, m_pRenderModel->name, numIndexes, numReferenceIndexes);
+	}
+
+	if (pcache)
+	{
+		pcache->key = key;
+		pcache->vertexes.assign(m_vertexTransform, m_vertexTransform + numVertexes);
+		pcache->indexes.assign(m_shadowVolumeIndexes, m_shadowVolumeIndexes + numIndexes);
+	}
+
+	StudioDrawShadowVolumeData(m_vertexTransform, numVertexes, m_shadowVolumeIndexes, numIndexes);
+}
+
+/*
+====================
+StudioDrawShadowVolumeData
+
+====================
+*/
+void CStudioModelRenderer::StudioDrawShadowVolumeData(const Vector* pvertexdata, int numVertexes, const uint16_t* pindexdata, int numIndexes)
+{
+	// Upload once, the two pass path draws the same data twice
+	const void* pvertexes = pvertexdata;
+	const void* pindexes = pindexdata;
+	if(m_bShadowBuffersBound)
+	{
+		pvertexes = SVD_StreamShadowVertexes(pvertexdata, sizeof(Vector) * numVertexes);
+		pindexes = SVD_StreamShadowIndexes(pindexdata, sizeof(uint16_t) * numIndexes);
+	}
+
+	glVertexPointer(3, GL_FLOAT, sizeof(Vector), pvertexes);
+	m_iShadowTriangles += numIndexes / 3;
+
+	if(m_bTwoSideSupported)
+	{
+		glActiveStencilFaceEXT(GL_BACK);
+		glStencilOp(GL_KEEP, GL_INCR_WRAP_EXT, GL_KEEP);
+		glStencilMask(~0);
+
+		glActiveStencilFaceEXT(GL_FRONT);
+		glStencilOp(GL_KEEP, GL_DECR_WRAP_EXT, GL_KEEP);
+		glStencilMask(~0);
+
+		glDrawElements(GL_TRIANGLES, numIndexes, GL_UNSIGNED_SHORT, pindexes);
+	}
+	else
+	{
+		// draw back faces incrementing stencil values when z fails
+		glStencilOp(GL_KEEP, GL_INCR, GL_KEEP);
+		glCullFace(GL_BACK);
+		glDrawElements(GL_TRIANGLES, numIndexes, GL_UNSIGNED_SHORT, pindexes);
+
+		// draw front faces decrementing stencil values when z fails
+		glStencilOp(GL_KEEP, GL_DECR, GL_KEEP);
+		glCullFace(GL_FRONT);
+		glDrawElements(GL_TRIANGLES, numIndexes, GL_UNSIGNED_SHORT, pindexes);
+	}
+}
+
+/*
+====================
+StudioBuildShadowVolume_Scalar
+
+====================
+*/
+int CStudioModelRenderer::StudioBuildShadowVolume_Scalar()
 {
 	float plane[4];
 	Vector lightdir;
 	Vector *pv1, *pv2, *pv3;
 
-	if (!m_pSVDSubModel->numfaces)
-		return;
-
 	Vector *psvdverts = (Vector *)((byte *)m_pSVDHeader + m_pSVDSubModel->vertexindex);
 	byte *pvertbone = ((byte *)m_pSVDHeader + m_pSVDSubModel->vertinfoindex);
 
@@ -504,6 +865,259 @@ void CStudioModelRenderer::StudioDrawShadowVolume()
 		}
 	}
 
+	return StudioBuildShadowVolumeEdges(numIndexes);
+}
+
+#ifdef STUDIO_SSE2
+//=============================================
+// @brief Loads element [row][col] of four bone matrices into one register
+//
+//=============================================
+inline __m128 SVD_LoadBoneElement4( float (*pbones)[3][4], const byte* pvertbone, int row, int col )
+{
+	return _mm_setr_ps(pbones[pvertbone[0]][row][col], pbones[pvertbone[1]][row][col],
+		pbones[pvertbone[2]][row][col], pbones[pvertbone[3]][row][col]);
+}
+
+//=============================================
+// @brief Transforms four vertices by their bones. Operation order matches VectorTransform,
+// so the results are bit-identical to the scalar path.
+//
+//=============================================
+inline void SVD_TransformVertexes4( const Vector* pverts, const byte* pvertbone, float (*pbones)[3][4], __m128& outx, __m128& outy, __m128& outz )
+{
+	__m128 x = _mm_setr_ps(pverts[0].x, pverts[1].x, pverts[2].x, pverts[3].x);
+	__m128 y = _mm_setr_ps(pverts[0].y, pverts[1].y, pverts[2].y, pverts[3].y);
+	__m128 z = _mm_setr_ps(pverts[0].z, pverts[1].z, pverts[2].z, pverts[3].z);
+
+	__m128 m[3][4];
+	if (pvertbone[0] == pvertbone[1] && pvertbone[0] == pvertbone[2] && pvertbone[0] == pvertbone[3])
+	{
+		// Studiomdl groups vertexes by bone, so this is the common case
+		float (*pmatrix)[4] = pbones[pvertbone[0]];
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 4; j++)
+				m[i][j] = _mm_set1_ps(pmatrix[i][j]);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 4; j++)
+				m[i][j] = SVD_LoadBoneElement4(pbones, pvertbone, i, j);
+		}
+	}
+
+	outx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[0][0]), _mm_mul_ps(y, m[0][1])), _mm_mul_ps(z, m[0][2])), m[0][3]);
+	outy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[1][0]), _mm_mul_ps(y, m[1][1])), _mm_mul_ps(z, m[1][2])), m[1][3]);
+	outz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m[2][0]), _mm_mul_ps(y, m[2][1])), _mm_mul_ps(z, m[2][2])), m[2][3]);
+}
+
+//=============================================
+// @brief Four-wide version of Q_rsqrt, including the integer trick
+//
+//=============================================
+inline __m128 SVD_RSqrt4( __m128 number )
+{
+	const __m128 x2 = _mm_mul_ps(number, _mm_set1_ps(0.5f));
+	__m128i i = _mm_sub_epi32(_mm_set1_epi32(0x5f3759df), _mm_srai_epi32(_mm_castps_si128(number), 1));
+	__m128 y = _mm_castsi128_ps(i);
+
+	return _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(x2, y), y)));
+}
+
+//=============================================
+// @brief Writes four vertex/extruded vertex pairs to the interleaved output array
+//
+//=============================================
+inline void SVD_StoreVertexPairs4( Vector* pout, __m128 x, __m128 y, __m128 z, __m128 ex, __m128 ey, __m128 ez )
+{
+	float fx[4], fy[4], fz[4];
+	float fex[4], fey[4], fez[4];
+	_mm_storeu_ps(fx, x); _mm_storeu_ps(fy, y); _mm_storeu_ps(fz, z);
+	_mm_storeu_ps(fex, ex); _mm_storeu_ps(fey, ey); _mm_storeu_ps(fez, ez);
+
+	for (int i = 0; i < 4; i++, pout += 2)
+	{
+		pout[0].x = fx[i]; pout[0].y = fy[i]; pout[0].z = fz[i];
+		pout[1].x = fex[i]; pout[1].y = fey[i]; pout[1].z = fez[i];
+	}
+}
+
+//=============================================
+// @brief Gathers one axis of the three corners of four faces
+//
+//=============================================
+inline void SVD_GatherFaceAxis4( const Vector* pverts, const svdface_t* pfaces, int axis, __m128& v1, __m128& v2, __m128& v3 )
+{
+	v1 = _mm_setr_ps(pverts[pfaces[0].vertex0][axis], pverts[pfaces[1].vertex0][axis], pverts[pfaces[2].vertex0][axis], pverts[pfaces[3].vertex0][axis]);
+	v2 = _mm_setr_ps(pverts[pfaces[0].vertex1][axis], pverts[pfaces[1].vertex1][axis], pverts[pfaces[2].vertex1][axis], pverts[pfaces[3].vertex1][axis]);
+	v3 = _mm_setr_ps(pverts[pfaces[0].vertex2][axis], pverts[pfaces[1].vertex2][axis], pverts[pfaces[2].vertex2][axis], pverts[pfaces[3].vertex2][axis]);
+}
+
+//=============================================
+// @brief Computes a*(b-c) + d*(e-f) + g*(h-i), the pattern used by the face plane terms
+//
+//=============================================
+inline __m128 SVD_PlaneTerm4( __m128 a, __m128 b, __m128 c, __m128 d, __m128 e, __m128 f, __m128 g, __m128 h, __m128 i )
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_sub_ps(b, c)), _mm_mul_ps(d, _mm_sub_ps(e, f))), _mm_mul_ps(g, _mm_sub_ps(h, i)));
+}
+#endif
+
+/*
+====================
+StudioBuildShadowVolume_SSE
+
+====================
+*/
+int CStudioModelRenderer::StudioBuildShadowVolume_SSE()
+{
+#ifndef STUDIO_SSE2
+	return StudioBuildShadowVolume_Scalar();
+#else
+	Vector *psvdverts = (Vector *)((byte *)m_pSVDHeader + m_pSVDSubModel->vertexindex);
+	byte *pvertbone = ((byte *)m_pSVDHeader + m_pSVDSubModel->vertinfoindex);
+
+	// Extrusion distance
+	float extrudeDistance = m_pCvarShadowVolumeExtrudeDistance->value;
+	const __m128 extrude = _mm_set1_ps(extrudeDistance);
+
+	const int numverts = m_pSVDSubModel->numverts;
+	const int numfaces = m_pSVDSubModel->numfaces;
+
+	// Calculate vertex coords, four at a time, remainder goes through the scalar code
+	int i = 0;
+	if(m_shadowLightType == SL_TYPE_POINTLIGHT)
+	{
+		const __m128 lx = _mm_set1_ps(m_vShadowLightOrigin.x);
+		const __m128 ly = _mm_set1_ps(m_vShadowLightOrigin.y);
+		const __m128 lz = _mm_set1_ps(m_vShadowLightOrigin.z);
+
+		for (; i + 4 <= numverts; i += 4)
+		{
+			__m128 x, y, z;
+			SVD_TransformVertexes4(&psvdverts[i], &pvertbone[i], (*m_pbonetransform), x, y, z);
+
+			__m128 dx = _mm_sub_ps(x, lx);
+			__m128 dy = _mm_sub_ps(y, ly);
+			__m128 dz = _mm_sub_ps(z, lz);
+
+			__m128 ilength = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			__m128 sqroot = SVD_RSqrt4(ilength);
+			dx = _mm_mul_ps(dx, sqroot);
+			dy = _mm_mul_ps(dy, sqroot);
+			dz = _mm_mul_ps(dz, sqroot);
+
+			SVD_StoreVertexPairs4(&m_vertexTransform[i * 2], x, y, z,
+				_mm_add_ps(x, _mm_mul_ps(extrude, dx)),
+				_mm_add_ps(y, _mm_mul_ps(extrude, dy)),
+				_mm_add_ps(z, _mm_mul_ps(extrude, dz)));
+		}
+
+		for (Vector lightdir; i < numverts; i++)
+		{
+			VectorTransform(psvdverts[i], (*m_pbonetransform)[pvertbone[i]], m_vertexTransform[i * 2]);
+
+			VectorSubtract(m_vertexTransform[i * 2], m_vShadowLightOrigin, lightdir);
+			VectorNormalizeFast(lightdir);
+
+			VectorMA(m_vertexTransform[i * 2], extrudeDistance, lightdir, m_vertexTransform[i * 2 + 1]);
+		}
+	}
+	else
+	{
+		const Vector extrudeVector = -m_vShadowLightVector;
+		const __m128 ex = _mm_mul_ps(extrude, _mm_set1_ps(extrudeVector.x));
+		const __m128 ey = _mm_mul_ps(extrude, _mm_set1_ps(extrudeVector.y));
+		const __m128 ez = _mm_mul_ps(extrude, _mm_set1_ps(extrudeVector.z));
+
+		for (; i + 4 <= numverts; i += 4)
+		{
+			__m128 x, y, z;
+			SVD_TransformVertexes4(&psvdverts[i], &pvertbone[i], (*m_pbonetransform), x, y, z);
+			SVD_StoreVertexPairs4(&m_vertexTransform[i * 2], x, y, z, _mm_add_ps(x, ex), _mm_add_ps(y, ey), _mm_add_ps(z, ez));
+		}
+
+		for (; i < numverts; i++)
+		{
+			VectorTransform(psvdverts[i], (*m_pbonetransform)[pvertbone[i]], m_vertexTransform[i * 2]);
+			VectorMA(m_vertexTransform[i * 2], extrudeDistance, extrudeVector, m_vertexTransform[i * 2 + 1]);
+		}
+	}
+
+	// Process the faces, four at a time
+	int numIndexes = 0;
+	svdface_t* pfaces = (svdface_t*)((byte *)m_pSVDHeader + m_pSVDSubModel->faceindex);
+
+	const bool isPointLight = (m_shadowLightType == SL_TYPE_POINTLIGHT);
+	const Vector& lightVec = isPointLight ? m_vShadowLightOrigin : m_vShadowLightVector;
+	const __m128 lx = _mm_set1_ps(lightVec.x);
+	const __m128 ly = _mm_set1_ps(lightVec.y);
+	const __m128 lz = _mm_set1_ps(lightVec.z);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	for (i = 0; i < numfaces; i += 4)
+	{
+		// Pad the last batch by repeating the final face, the extra lanes are ignored
+		svdface_t batch[4];
+		for (int j = 0; j < 4; j++)
+			batch[j] = pfaces[(i + j < numfaces) ? (i + j) : (numfaces - 1)];
+
+		__m128 x1, x2, x3, y1, y2, y3, z1, z2, z3;
+		SVD_GatherFaceAxis4(m_vertexTransform, batch, 0, x1, x2, x3);
+		SVD_GatherFaceAxis4(m_vertexTransform, batch, 1, y1, y2, y3);
+		SVD_GatherFaceAxis4(m_vertexTransform, batch, 2, z1, z2, z3);
+
+		__m128 p0 = SVD_PlaneTerm4(y1, z2, z3, y2, z3, z1, y3, z1, z2);
+		__m128 p1 = SVD_PlaneTerm4(z1, x2, x3, z2, x3, x1, z3, x1, x2);
+		__m128 p2 = SVD_PlaneTerm4(x1, y2, y3, x2, y3, y1, x3, y1, y2);
+
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, lx), _mm_mul_ps(p1, ly)), _mm_mul_ps(p2, lz));
+		if (isPointLight)
+		{
+			__m128 p3 = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(x1, _mm_sub_ps(_mm_mul_ps(y2, z3), _mm_mul_ps(y3, z2))),
+				_mm_mul_ps(x2, _mm_sub_ps(_mm_mul_ps(y3, z1), _mm_mul_ps(y1, z3)))),
+				_mm_mul_ps(x3, _mm_sub_ps(_mm_mul_ps(y1, z2), _mm_mul_ps(y2, z1))));
+
+			dist = _mm_add_ps(dist, _mm_xor_ps(p3, signMask));
+		}
+
+		int facingMask = _mm_movemask_ps(_mm_cmpgt_ps(dist, _mm_setzero_ps()));
+		for (int j = 0; j < 4 && (i + j) < numfaces; j++)
+		{
+			m_trianglesFacingLight[i + j] = (facingMask & (1 << j)) ? true : false;
+			if (!m_trianglesFacingLight[i + j])
+				continue;
+
+			const svdface_t& face = batch[j];
+			m_shadowVolumeIndexes[numIndexes] = face.vertex0;
+			m_shadowVolumeIndexes[numIndexes + 1] = face.vertex2;
+			m_shadowVolumeIndexes[numIndexes + 2] = face.vertex1;
+
+			m_shadowVolumeIndexes[numIndexes + 3] = face.vertex0 + 1;
+			m_shadowVolumeIndexes[numIndexes + 4] = face.vertex1 + 1;
+			m_shadowVolumeIndexes[numIndexes + 5] = face.vertex2 + 1;
+
+			numIndexes += 6;
+		}
+	}
+
+	return StudioBuildShadowVolumeEdges(numIndexes);
+#endif
+}
+
+/*
+====================
+StudioBuildShadowVolumeEdges
+
+====================
+*/
+int CStudioModelRenderer::StudioBuildShadowVolumeEdges( int numIndexes )
+{
 	// Process the edges
 	svdedge_t* pedges = (svdedge_t*)((byte *)m_pSVDHeader + m_pSVDSubModel->edgeindex);
 	for (int i = 0; i < m_pSVDSubModel->numedges; i++)
@@ -532,28 +1146,5 @@ void CStudioModelRenderer::StudioDrawShadowVolume()
 		numIndexes += 6;
 	}
 
-	if(m_bTwoSideSupported)
-	{
-		glActiveStencilFaceEXT(GL_BACK);
-		glStencilOp(GL_KEEP, GL_INCR_WRAP_EXT, GL_KEEP);
-		glStencilMask(~0);
-
-		glActiveStencilFaceEXT(GL_FRONT);
-		glStencilOp(GL_KEEP, GL_DECR_WRAP_EXT, GL_KEEP);
-		glStencilMask(~0);
-
-		glDrawElements(GL_TRIANGLES, numIndexes, GL_UNSIGNED_SHORT, m_shadowVolumeIndexes);
-	}
-	else
-	{
-		// draw back faces incrementing stencil values when z fails
-		glStencilOp(GL_KEEP, GL_INCR, GL_KEEP);
-		glCullFace(GL_BACK);
-		glDrawElements(GL_TRIANGLES, numIndexes, GL_UNSIGNED_SHORT, m_shadowVolumeIndexes);
-
-		// draw front faces decrementing stencil values when z fails
-		glStencilOp(GL_KEEP, GL_DECR, GL_KEEP);
-		glCullFace(GL_FRONT);
-		glDrawElements(GL_TRIANGLES, numIndexes, GL_UNSIGNED_SHORT, m_shadowVolumeIndexes);
-	}
+	return numIndexes;
 }
@@ -137,3 +137,270 @@ void MatrixCopy(float in[3][4], float out[3][4])
 {
 	memcpy(out, in, sizeof(float) * 3 * 4);
 }
+
+#ifdef STUDIO_SSE2
+//=============================================
+// @brief Sine and cosine of four angles, reduced to [-pi/4, pi/4] and
+// evaluated with the Cephes single precision polynomials
+//
+//=============================================
+inline void SinCos4( __m128 x, __m128& outsin, __m128& outcos )
+{
+	__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236758134f)));
+	__m128 j = _mm_cvtepi32_ps(quadrant);
+
+	// pi/2 split in two so the reduction keeps its precision
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(1.5707963705062866f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(-4.3711390001862427e-8f)));
+
+	__m128 r2 = _mm_mul_ps(r, r);
+
+	__m128 s = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(-1.9515295891e-4f)), _mm_set1_ps(8.3321608736e-3f));
+	s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.6666654611e-1f));
+	s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, r2), r), r);
+
+	__m128 c = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(2.443315711809948e-5f)), _mm_set1_ps(-1.388731625493765e-3f));
+	c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(4.166664568298827e-2f));
+	c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c, r2), r2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(r2, _mm_set1_ps(0.5f))));
+
+	// Odd quadrants swap sine and cosine, the sign follows the quadrant
+	__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+	__m128 sinsign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+	__m128 cossign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+	outsin = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sinsign);
+	outcos = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cossign);
+}
+
+//=============================================
+// @brief Dot product of quaternions stored as x, y, z, w registers
+//
+//=============================================
+inline __m128 QuaternionDot4( const __m128* p, const __m128* q )
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(p[0], q[0]), _mm_mul_ps(p[1], q[1])), _mm_add_ps(_mm_mul_ps(p[2], q[2]), _mm_mul_ps(p[3], q[3])));
+}
+#endif
+
+/*
+====================
+AngleQuaternionBones
+
+====================
+*/
+void AngleQuaternionBones(const float (*angles)[3], vec4_t* quaternions, int count)
+{
+	int i = 0;
+
+#ifdef STUDIO_SSE2
+	for (; i + 4 <= count; i += 4)
+	{
+		const float (*a)[3] = &angles[i];
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		__m128 sr, cr, sp, cp, sy, cy;
+		SinCos4(_mm_mul_ps(_mm_setr_ps(a[0][0], a[1][0], a[2][0], a[3][0]), half), sr, cr);
+		SinCos4(_mm_mul_ps(_mm_setr_ps(a[0][1], a[1][1], a[2][1], a[3][1]), half), sp, cp);
+		SinCos4(_mm_mul_ps(_mm_setr_ps(a[0][2], a[1][2], a[2][2], a[3][2]), half), sy, cy);
+
+		__m128 cpcy = _mm_mul_ps(cp, cy);
+		__m128 spsy = _mm_mul_ps(sp, sy);
+		__m128 spcy = _mm_mul_ps(sp, cy);
+		__m128 cpsy = _mm_mul_ps(cp, sy);
+
+		__m128 x = _mm_sub_ps(_mm_mul_ps(sr, cpcy), _mm_mul_ps(cr, spsy));
+		__m128 y = _mm_add_ps(_mm_mul_ps(cr, spcy), _mm_mul_ps(sr, cpsy));
+		__m128 z = _mm_sub_ps(_mm_mul_ps(cr, cpsy), _mm_mul_ps(sr, spcy));
+		__m128 w = _mm_add_ps(_mm_mul_ps(cr, cpcy), _mm_mul_ps(sr, spsy));
+
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_storeu_ps(quaternions[i + 0], x);
+		_mm_storeu_ps(quaternions[i + 1], y);
+		_mm_storeu_ps(quaternions[i + 2], z);
+		_mm_storeu_ps(quaternions[i + 3], w);
+	}
+#endif
+
+	for (; i < count; i++)
+		AngleQuaternion((float*)angles[i], quaternions[i]);
+}
+
+/*
+====================
+QuaternionSlerpBone
+
+One pair of QuaternionSlerpBones, with the same close pair rule as its SSE2 lanes
+====================
+*/
+static void QuaternionSlerpBone(const vec4_t p, const vec4_t q, float t, vec4_t qt)
+{
+	float cosom = p[0] * q[0] + p[1] * q[1] + p[2] * q[2] + p[3] * q[3];
+
+	// Take the short way around, same test as QuaternionSlerp
+	float sign = cosom < 0.0f ? -1.0f : 1.0f;
+
+	if (cosom * sign > STUDIO_NLERP_COSINE)
+	{
+		vec4_t r;
+		float length = 0.0f;
+		for (int j = 0; j < 4; j++)
+		{
+			r[j] = p[j] * (1.0f - t) + q[j] * sign * t;
+			length += r[j] * r[j];
+		}
+
+		float scale = 1.0f / sqrt(length);
+		for (int j = 0; j < 4; j++)
+			qt[j] = r[j] * scale;
+		return;
+	}
+
+	vec4_t pp, qq;
+	memcpy(pp, p, sizeof(vec4_t));
+	memcpy(qq, q, sizeof(vec4_t));
+	QuaternionSlerp(pp, qq, t, qt);
+}
+
+/*
+====================
+QuaternionSlerpBones
+
+Blends count quaternion pairs, qt may be the same array as p.
+Close pairs take a normalized lerp, which is what slerp comes
+down to at small angles
+====================
+*/
+void QuaternionSlerpBones(const vec4_t* p, const vec4_t* q, float t, vec4_t* qt, int count)
+{
+	int i = 0;
+
+#ifdef STUDIO_SSE2
+	const __m128 tt = _mm_set1_ps(t);
+	const __m128 t1 = _mm_set1_ps(1.0f - t);
+	const __m128 signmask = _mm_set1_ps(-0.0f);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 vp[4], vq[4];
+		for (int j = 0; j < 4; j++)
+		{
+			vp[j] = _mm_loadu_ps(p[i + j]);
+			vq[j] = _mm_loadu_ps(q[i + j]);
+		}
+
+		_MM_TRANSPOSE4_PS(vp[0], vp[1], vp[2], vp[3]);
+		_MM_TRANSPOSE4_PS(vq[0], vq[1], vq[2], vq[3]);
+
+		// Take the short way around, same test as QuaternionSlerp
+		__m128 cosom = QuaternionDot4(vp, vq);
+		__m128 flip = _mm_and_ps(cosom, signmask);
+		for (int j = 0; j < 4; j++)
+			vq[j] = _mm_xor_ps(vq[j], flip);
+
+		cosom = _mm_xor_ps(cosom, flip);
+		int close = _mm_movemask_ps(_mm_cmpgt_ps(cosom, _mm_set1_ps(STUDIO_NLERP_COSINE)));
+
+		if (close != 0)
+		{
+			__m128 r[4];
+			for (int j = 0; j < 4; j++)
+				r[j] = _mm_add_ps(_mm_mul_ps(vp[j], t1), _mm_mul_ps(vq[j], tt));
+
+			__m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(QuaternionDot4(r, r)));
+			for (int j = 0; j < 4; j++)
+				r[j] = _mm_mul_ps(r[j], scale);
+
+			_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+
+			for (int j = 0; j < 4; j++)
+			{
+				if (close & (1 << j))
+					_mm_storeu_ps(qt[i + j], r[j]);
+			}
+		}
+
+		// Pairs too far apart for the lerp go through the real thing
+		for (int j = 0; j < 4; j++)
+		{
+			if (close & (1 << j))
+				continue;
+
+			vec4_t pp, qq;
+			memcpy(pp, p[i + j], sizeof(vec4_t));
+			memcpy(qq, q[i + j], sizeof(vec4_t));
+			QuaternionSlerp(pp, qq, t, qt[i + j]);
+		}
+	}
+#endif
+
+	// The rest, or everything without SSE2, pair by pair
+	for (; i < count; i++)
+		QuaternionSlerpBone(p[i], q[i], t, qt[i]);
+}
+
+/*
+====================
+QuaternionMatrixBones
+
+Builds bone matrices from rotations and positions
+====================
+*/
+void QuaternionMatrixBones(const vec4_t* quaternions, const float (*pos)[3], float (*matrices)[3][4], int count)
+{
+	int i = 0;
+
+#ifdef STUDIO_SSE2
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(quaternions[i + 0]);
+		__m128 y = _mm_loadu_ps(quaternions[i + 1]);
+		__m128 z = _mm_loadu_ps(quaternions[i + 2]);
+		__m128 w = _mm_loadu_ps(quaternions[i + 3]);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128 x2 = _mm_mul_ps(two, x);
+		__m128 y2 = _mm_mul_ps(two, y);
+		__m128 z2 = _mm_mul_ps(two, z);
+
+		__m128 xx = _mm_mul_ps(x2, x), yy = _mm_mul_ps(y2, y), zz = _mm_mul_ps(z2, z);
+		__m128 xy = _mm_mul_ps(x2, y), xz = _mm_mul_ps(x2, z), yz = _mm_mul_ps(y2, z);
+		__m128 wx = _mm_mul_ps(x2, w), wy = _mm_mul_ps(y2, w), wz = _mm_mul_ps(z2, w);
+
+		float m[3][3][4];
+		_mm_storeu_ps(m[0][0], _mm_sub_ps(_mm_sub_ps(one, yy), zz));
+		_mm_storeu_ps(m[1][0], _mm_add_ps(xy, wz));
+		_mm_storeu_ps(m[2][0], _mm_sub_ps(xz, wy));
+
+		_mm_storeu_ps(m[0][1], _mm_sub_ps(xy, wz));
+		_mm_storeu_ps(m[1][1], _mm_sub_ps(_mm_sub_ps(one, xx), zz));
+		_mm_storeu_ps(m[2][1], _mm_add_ps(yz, wx));
+
+		_mm_storeu_ps(m[0][2], _mm_add_ps(xz, wy));
+		_mm_storeu_ps(m[1][2], _mm_sub_ps(yz, wx));
+		_mm_storeu_ps(m[2][2], _mm_sub_ps(_mm_sub_ps(one, xx), yy));
+
+		for (int j = 0; j < 4; j++)
+		{
+			float (*matrix)[4] = matrices[i + j];
+			for (int row = 0; row < 3; row++)
+			{
+				matrix[row][0] = m[row][0][j];
+				matrix[row][1] = m[row][1][j];
+				matrix[row][2] = m[row][2][j];
+				matrix[row][3] = pos[i + j][row];
+			}
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		QuaternionMatrix((float*)quaternions[i], matrices[i]);
+		matrices[i][0][3] = pos[i][0];
+		matrices[i][1][3] = pos[i][1];
+		matrices[i][2][3] = pos[i][2];
+	}
+}
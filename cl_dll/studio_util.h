@@ -19,6 +19,13 @@
 
 #define FDotProduct( a, b ) (fabs((a[0])*(b[0])) + fabs((a[1])*(b[1])) + fabs((a[2])*(b[2])))
 
+// SSE2 kernels are only compiled in when the compiler is allowed to emit SSE2.
+// MSVC does so by default for Win32 (/arch:SSE2), the Linux makefile builds with -mno-sse.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STUDIO_SSE2 1
+#include <emmintrin.h>
+#endif
+
 void	AngleMatrix (const float *angles, float (*matrix)[4] );
 bool	VectorCompare (const float *v1, const float *v2);
 void	CrossProduct (const float *v1, const float *v2, float *cross);
@@ -28,3 +35,11 @@ void	MatrixCopy( float in[3][4], float out[3][4] );
 void	QuaternionMatrix( vec4_t quaternion, float (*matrix)[4] );
 void	QuaternionSlerp( vec4_t p, vec4_t q, float t, vec4_t qt );
 void	AngleQuaternion( float *angles, vec4_t quaternion );
+
+// Quaternion pairs closer than this blend with a normalized lerp instead of a slerp
+#define STUDIO_NLERP_COSINE	0.9995f
+
+// Batched versions of the above for arrays of bones, four at a time with SSE2
+void	AngleQuaternionBones( const float (*angles)[3], vec4_t* quaternions, int count );
+void	QuaternionSlerpBones( const vec4_t* p, const vec4_t* q, float t, vec4_t* qt, int count );
+void	QuaternionMatrixBones( const vec4_t* quaternions, const float (*pos)[3], float (*matrices)[3][4], int count );
@@ -19,6 +19,8 @@
 #include <string.h>
 #include <memory.h>
 #include <math.h>
+#include <vector>
+#include <unordered_map>
 
 #include "studio_util.h"
 #include "r_studioint.h"
@@ -35,6 +37,7 @@
 #include "lightlist.h"
 #include "svdformat.h"
 #include "svd_render.h"
+#include "frustum.h"
 
 #define GLEW_STATIC 1
 #include "GL/glew.h"
@@ -85,12 +88,88 @@ GLuint		g_intermediateFBO = 0;
 // Framebuffer binding coming from Steam HL
 GLint		g_steamHLBoundFBO = 0;
 
+// How the frame gets from the shadow pass to Steam HL's framebuffer
+enum fbopath_t
+{
+	FBO_PATH_TWO_BLITS = 0,	// resolve into the intermediate FBO, then copy to the target
+	FBO_PATH_ONE_BLIT,		// target matches our formats, one blit does it
+	FBO_PATH_DIRECT			// target has its own stencil, render straight into it
+};
+
+int			g_fboPath = FBO_PATH_TWO_BLITS;
+// Target the path was picked for, -1 to check again
+GLint		g_fboPathTarget = -1;
+// Bytes moved by blits this frame
+int			g_fboBytesCopied = 0;
+
+// Streaming buffers every shadow volume in a frame is appended to,
+// each one holds at least a full MAXSTUDIOTRIANGLES volume
+#define SHADOW_VERTEX_BUFFER_SIZE	(1024*1024*2)
+#define SHADOW_INDEX_BUFFER_SIZE	(1024*1024*2)
+
+GLuint		g_shadowVertexBuffer = 0;
+GLuint		g_shadowIndexBuffer = 0;
+int			g_shadowVertexBufferOffset = 0;
+int			g_shadowIndexBufferOffset = 0;
+bool		g_bShadowBuffersSupported = false;
+
+// World surface of the static darkening buffer
+struct worldsurface_t
+{
+	msurface_t* psurface;
+	int firstindex;
+	int numindexes;
+};
+
+// World geometry triangulated once per map, surfaces ordered by leaf
+// so the ones visible together end up next to each other
+GLuint		g_worldVertexBuffer = 0;
+GLuint		g_worldIndexBuffer = 0;
+bool		g_bWorldBufferBuilt = false;
+std::vector<worldsurface_t> g_worldSurfaces;
+
+// Visible index ranges of the current frame
+std::vector<GLsizei> g_worldDrawCounts;
+std::vector<const void*> g_worldDrawOffsets;
+
 // Pointer to default_fov
 cvar_t*		g_pCvarDefaultFOV = NULL;
 
 // msurface_t struct size
 int			g_msurfaceStructSize = 0;
 
+// Compact copy of the world's surfaces, built at SVD_VidInit
+std::vector<svdsurface_t> g_worldSurfaceTable;
+
+// Per-leaf sky visibility along the skylight vector, filled as leaves are queried
+enum skyleafstate_t
+{
+	SKY_LEAF_UNKNOWN = 0,
+	SKY_LEAF_SKY,
+	SKY_LEAF_NOSKY,
+	SKY_LEAF_MIXED
+};
+
+std::vector<byte> g_skyLeafStates;
+Vector		g_skyTableVector;
+
+// Studio entities on this frame's visible list, and whether the view can see them
+std::unordered_map<cl_entity_t*, int> g_shadowCasters;
+float		g_shadowCasterTime = -1;
+
+// Decompressed PVS of the view leaf
+std::vector<byte> g_viewLeafVis;
+mleaf_t*	g_viewVisLeaf = nullptr;
+
+// Set once the frustum and PVS are ready for this view
+bool		g_viewCullingValid = false;
+
+// Shadow caster bounds per axis, for culling them in one batch
+std::vector<cl_entity_t*> g_cullEntities;
+std::vector<float> g_cullMins[3];
+std::vector<float> g_cullMaxs[3];
+std::vector<int> g_cullVisible;
+
 // The renderer object, created on the stack.
 extern CGameStudioModelRenderer g_StudioRenderer;
 
@@ -100,60 +179,12 @@ extern CGameStudioModelRenderer g_StudioRenderer;
 
 #define DEG2RAD( a ) ( a * M_PI ) / 180.0F
 
-// Frustum planes
-mplane_t g_frustumPlanes[5];
+// View frustum, set up by SVD_SetupViewCulling
+frustum_t g_viewFrustum;
 
 // Global engine <-> studio model rendering code interface
 extern engine_studio_api_t IEngineStudio;
 
-/*
-====================
-Mod_PointInLeaf
-
-====================
-*/
-void RotatePointAroundVector( Vector& vDest, const Vector& vDir, const Vector& vPoint, float flDegrees )
-{
-	float q[3];
-	float q3;
-	float t[3];
-	float t3;
-	float hrad;
-	float s;
-
-	hrad = DEG2RAD(flDegrees) / 2;
-	s = sin(hrad);
-	VectorScale(vDir, s, q);
-	q3 = cos(hrad);
-
-	CrossProduct(q, vPoint, t);
-	VectorMA(t, q3, vPoint, t);
-	t3 = DotProduct(q, vPoint);
-
-	CrossProduct(q, t, vDest);
-	VectorMA(vDest, t3, q, vDest);
-	VectorMA(vDest, q3, t, vDest);
-}
-
-/*
-==================
-SignbitsForPlane
-
-==================
-*/
-int SignbitsForPlane( mplane_t *pOut )
-{
-	int	nBits = 0;
-
-	for(int j = 0; j < 3; j++)
-	{
-		if(pOut->normal[j] < 0)
-			nBits |= 1<<j;
-	}
-
-	return nBits;
-}
-
 /*
 ==================
 BoxOnPlaneSide
@@ -215,67 +246,115 @@ int BoxOnPlaneSide( const Vector& emins, const Vector& emaxs, mplane_t *p )
 
 /*
 ====================
-R_SetFrustum
+Mod_PointInLeaf
 
 ====================
 */
-void R_SetFrustum( const Vector& vAngles, const Vector& vOrigin, float flFOV, float flFarDist )
+mleaf_t *Mod_PointInLeaf (Vector p, model_t *model) // quake's func
 {
-	Vector vVpn, vUp, vRight;
-	gEngfuncs.pfnAngleVectors(vAngles, vVpn, vRight, vUp);
-
-	RotatePointAroundVector(g_frustumPlanes[0].normal, vUp, vVpn, -(90-flFOV / 2));
-	RotatePointAroundVector(g_frustumPlanes[1].normal, vUp, vVpn, 90-flFOV / 2);
-	RotatePointAroundVector(g_frustumPlanes[2].normal, vRight, vVpn, 90-flFOV / 2);
-	RotatePointAroundVector(g_frustumPlanes[3].normal, vRight, vVpn, -(90 - flFOV / 2));
-
-	for(int i = 0; i < 4; i++)
+	mnode_t *node = model->nodes;
+	while (1)
 	{
-		g_frustumPlanes[i].type = PLANE_ANYZ;
-		g_frustumPlanes[i].dist = DotProduct(vOrigin, g_frustumPlanes[i].normal);
-		g_frustumPlanes[i].signbits = SignbitsForPlane(&g_frustumPlanes[i]);
+		if (node->contents < 0)
+			return (mleaf_t *)node;
+		mplane_t *plane = node->plane;
+		float d = DotProduct (p,plane->normal) - plane->dist;
+		if (d > 0)
+			node = node->children[0];
+		else
+			node = node->children[1];
 	}
+
+	return NULL;	// never reached
 }
 
+extern const msurface_t* Mod_SurfaceAtPoint( const model_t* pmodel, const mnode_t* pnode, const Vector& start, const Vector& end );
+
 /*
-=====================
-R_CullBox
+====================
+SVD_TraceSky
 
-=====================
+====================
 */
-bool R_CullBox( const Vector& vMins, const Vector& vMaxs )
-{	
-	for(int i = 0; i < 4; i++)
+bool SVD_TraceSky( model_t* pworld, const Vector& point, const Vector& skyVec )
+{
+	Vector end = point - skyVec * 8192;
+
+	const msurface_t* phitsurf = Mod_SurfaceAtPoint(pworld, pworld->nodes, point, end);
+	return phitsurf && (phitsurf->flags & SURF_DRAWSKY);
+}
+
+/*
+====================
+SVD_ClassifySkyLeaf
+
+====================
+*/
+byte SVD_ClassifySkyLeaf( model_t* pworld, mleaf_t* pleaf, const Vector& skyVec )
+{
+	Vector mins(pleaf->minmaxs[0], pleaf->minmaxs[1], pleaf->minmaxs[2]);
+	Vector maxs(pleaf->minmaxs[3], pleaf->minmaxs[4], pleaf->minmaxs[5]);
+	Vector center = (mins + maxs) * 0.5;
+
+	// Sample the center and the corners pulled halfway in, leaves
+	// don't fill their bounds so samples outside the leaf are skipped
+	int numSky = 0;
+	int numSamples = 0;
+	for(int i = 0; i < 9; i++)
 	{
-		if(BoxOnPlaneSide(vMins, vMaxs, &g_frustumPlanes[i]) == 2)
-			return true;
+		Vector sample = center;
+		if(i > 0)
+		{
+			for(int j = 0; j < 3; j++)
+				sample[j] = (((i-1) & (1<<j)) ? maxs[j] : mins[j]) * 0.5 + center[j] * 0.5;
+
+			if(Mod_PointInLeaf(sample, pworld) != pleaf)
+				continue;
+		}
+
+		numSamples++;
+		if(SVD_TraceSky(pworld, sample, skyVec))
+			numSky++;
 	}
 
-	return false;
+	if(numSamples < 2 || (numSky && numSky != numSamples))
+		return SKY_LEAF_MIXED;
+
+	return numSky ? SKY_LEAF_SKY : SKY_LEAF_NOSKY;
 }
 
 /*
 ====================
-Mod_PointInLeaf
+SVD_PointSeesSky
 
+Leaves that see the sky from every sample, or from none, answer
+for every point in them, partially lit ones still trace the point
 ====================
 */
-mleaf_t *Mod_PointInLeaf (Vector p, model_t *model) // quake's func
+bool SVD_PointSeesSky( const Vector& point, const Vector& skyVec )
 {
-	mnode_t *node = model->nodes;
-	while (1)
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+
+	// Changing the sky vector invalidates every leaf
+	if(g_skyLeafStates.size() != (size_t)pworld->numleafs + 1 || g_skyTableVector != skyVec)
 	{
-		if (node->contents < 0)
-			return (mleaf_t *)node;
-		mplane_t *plane = node->plane;
-		float d = DotProduct (p,plane->normal) - plane->dist;
-		if (d > 0)
-			node = node->children[0];
-		else
-			node = node->children[1];
+		g_skyLeafStates.assign(pworld->numleafs + 1, SKY_LEAF_UNKNOWN);
+		g_skyTableVector = skyVec;
 	}
 
-	return NULL;	// never reached
+	mleaf_t* pleaf = Mod_PointInLeaf(point, pworld);
+	int leafnum = pleaf - pworld->leafs;
+	if(leafnum <= 0 || leafnum > pworld->numleafs || pleaf->contents == CONTENTS_SOLID)
+		return SVD_TraceSky(pworld, point, skyVec);
+
+	byte& state = g_skyLeafStates[leafnum];
+	if(state == SKY_LEAF_UNKNOWN)
+		state = SVD_ClassifySkyLeaf(pworld, pleaf, skyVec);
+
+	if(state == SKY_LEAF_MIXED)
+		return SVD_TraceSky(pworld, point, skyVec);
+
+	return state == SKY_LEAF_SKY;
 }
 
 /*
@@ -343,6 +422,87 @@ void SVD_CreateIntermediateFBO( void )
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+/*
+====================
+SVD_GetRenderbufferFormat
+
+Returns the internal format and sample count of a renderbuffer attached to
+the bound framebuffer, false if the attachment isn't a renderbuffer
+====================
+*/
+bool SVD_GetRenderbufferFormat( GLenum attachment, GLint* pformat, GLint* psamples )
+{
+	GLint type = GL_NONE;
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+	if(type != GL_RENDERBUFFER)
+		return false;
+
+	GLint name = 0;
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, name);
+	glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_INTERNAL_FORMAT, pformat);
+	glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_SAMPLES, psamples);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	return true;
+}
+
+/*
+====================
+SVD_SelectFBOPath
+
+Called with Steam HL's framebuffer bound, the result is
+kept until it binds a different one
+====================
+*/
+void SVD_SelectFBOPath( void )
+{
+	if(g_fboPathTarget == g_steamHLBoundFBO)
+		return;
+
+	g_fboPathTarget = g_steamHLBoundFBO;
+	g_fboPath = FBO_PATH_TWO_BLITS;
+
+	// A target that already has stencil can take the shadows itself
+	GLint stencilBits = 0;
+	glGetIntegerv(GL_STENCIL_BITS, &stencilBits);
+	if(stencilBits >= 8)
+	{
+		g_fboPath = FBO_PATH_DIRECT;
+		return;
+	}
+
+	// The window's formats can't be queried, so it keeps the intermediate
+	if(!g_steamHLBoundFBO)
+		return;
+
+	GLint targetColorFormat, targetColorSamples;
+	GLint targetDepthFormat, targetDepthSamples;
+	if(!SVD_GetRenderbufferFormat(GL_COLOR_ATTACHMENT0, &targetColorFormat, &targetColorSamples)
+		|| !SVD_GetRenderbufferFormat(GL_DEPTH_ATTACHMENT, &targetDepthFormat, &targetDepthSamples))
+		return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, g_stencilFBO);
+
+	GLint colorFormat, colorSamples;
+	GLint depthFormat, depthSamples;
+	bool gotFormats = SVD_GetRenderbufferFormat(GL_COLOR_ATTACHMENT0, &colorFormat, &colorSamples)
+		&& SVD_GetRenderbufferFormat(GL_DEPTH_ATTACHMENT, &depthFormat, &depthSamples);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, g_steamHLBoundFBO);
+
+	if(!gotFormats)
+		return;
+
+	// Multisampled blits need matching formats, and either a
+	// single sampled target or the same sample count
+	if(colorFormat == targetColorFormat && depthFormat == targetDepthFormat
+		&& (targetColorSamples == 0 || targetColorSamples == colorSamples)
+		&& targetColorSamples == targetDepthSamples)
+		g_fboPath = FBO_PATH_ONE_BLIT;
+}
+
 /*
 ====================
 SVD_CreateStencilFBO
@@ -390,6 +550,328 @@ void SVD_CreateStencilFBO( void )
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+/*
+====================
+R_DetermineSurfaceStructSize
+
+The engine's msurface_t is larger than the SDK's, so try each
+pointer aligned stride and keep the one whose plane and texinfo
+pointers land on array elements for a few sample surfaces
+====================
+*/
+int R_DetermineSurfaceStructSize( const model_t* pworld )
+{
+	// Size of msurface_t with that stupid displaylist junk
+	static const int MAXOFS = 108;
+
+	if(pworld->numsurfaces < 3)
+		return sizeof(msurface_t);
+
+	const int planeofs = offsetof(msurface_t, plane);
+	const int texinfoofs = offsetof(msurface_t, texinfo);
+	const byte* pfirstsurfbyteptr = reinterpret_cast<const byte*>(pworld->surfaces);
+	const byte* pplanes = reinterpret_cast<const byte*>(pworld->planes);
+	const byte* ptexinfos = reinterpret_cast<const byte*>(pworld->texinfo);
+
+	int samples[3] = { 1, 2, pworld->numsurfaces - 1 };
+
+	for(int stride = sizeof(msurface_t) - planeofs; stride <= (int)sizeof(msurface_t) + MAXOFS - planeofs; stride += sizeof(void*))
+	{
+		if(stride < texinfoofs + (int)sizeof(void*))
+			continue;
+
+		int i = 0;
+		for(; i < 3; i++)
+		{
+			const byte* psurf = pfirstsurfbyteptr + stride * samples[i];
+			const byte* pplane = *reinterpret_cast<const byte* const*>(psurf + planeofs);
+			const byte* ptexinfo = *reinterpret_cast<const byte* const*>(psurf + texinfoofs);
+
+			if(pplane < pplanes || pplane >= pplanes + sizeof(mplane_t) * pworld->numplanes
+				|| (pplane - pplanes) % sizeof(mplane_t))
+				break;
+
+			if(ptexinfo < ptexinfos || ptexinfo >= ptexinfos + sizeof(mtexinfo_t) * pworld->numtexinfo
+				|| (ptexinfo - ptexinfos) % sizeof(mtexinfo_t))
+				break;
+		}
+
+		if(i == 3)
+			return stride;
+	}
+
+	gEngfuncs.Con_Printf("%s - Failed to determine msurface_t struct size.\n", __FUNCTION__);
+	return sizeof(msurface_t);
+}
+
+/*
+====================
+SVD_BuildWorldSurfaceTable
+
+====================
+*/
+void SVD_BuildWorldSurfaceTable( void )
+{
+	g_worldSurfaceTable.clear();
+
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+	if(!pworld || !pworld->surfaces || pworld->numsurfaces <= 0)
+		return;
+
+	g_msurfaceStructSize = R_DetermineSurfaceStructSize(pworld);
+
+	g_worldSurfaceTable.resize(pworld->numsurfaces);
+
+	byte* pfirstsurfbyteptr = reinterpret_cast<byte*>(pworld->surfaces);
+	for(int i = 0; i < pworld->numsurfaces; i++)
+	{
+		msurface_t* psurface = reinterpret_cast<msurface_t*>(pfirstsurfbyteptr + g_msurfaceStructSize*i);
+
+		svdsurface_t& surface = g_worldSurfaceTable[i];
+		surface.plane = psurface->plane;
+		surface.polys = psurface->polys;
+		surface.texinfo = psurface->texinfo;
+		surface.flags = psurface->flags;
+		surface.psurface = psurface;
+	}
+}
+
+/*
+====================
+SVD_GetWorldSurfaces
+
+====================
+*/
+const svdsurface_t* SVD_GetWorldSurfaces( int* pnumsurfaces )
+{
+	// Light data can be read before SVD_VidInit runs
+	if(g_worldSurfaceTable.empty())
+		SVD_BuildWorldSurfaceTable();
+
+	if(pnumsurfaces)
+		*pnumsurfaces = g_worldSurfaceTable.size();
+
+	return g_worldSurfaceTable.empty() ? nullptr : g_worldSurfaceTable.data();
+}
+
+/*
+====================
+SVD_GetWorldSurfaceIndex
+
+====================
+*/
+int SVD_GetWorldSurfaceIndex( const msurface_t* psurface )
+{
+	if(g_worldSurfaceTable.empty())
+		SVD_BuildWorldSurfaceTable();
+
+	if(g_worldSurfaceTable.empty())
+		return -1;
+
+	const byte* pfirstsurfbyteptr = reinterpret_cast<const byte*>(g_worldSurfaceTable[0].psurface);
+	return (reinterpret_cast<const byte*>(psurface) - pfirstsurfbyteptr) / g_msurfaceStructSize;
+}
+
+/*
+====================
+SVD_DeleteWorldBuffer
+
+====================
+*/
+void SVD_DeleteWorldBuffer( void )
+{
+	if(g_worldVertexBuffer)
+	{
+		glDeleteBuffers(1, &g_worldVertexBuffer);
+		g_worldVertexBuffer = 0;
+	}
+
+	if(g_worldIndexBuffer)
+	{
+		glDeleteBuffers(1, &g_worldIndexBuffer);
+		g_worldIndexBuffer = 0;
+	}
+
+	g_worldSurfaces.clear();
+	g_bWorldBufferBuilt = false;
+}
+
+/*
+====================
+SVD_AddWorldSurface
+
+====================
+*/
+void SVD_AddWorldSurface( const svdsurface_t* psurface, std::vector<Vector>& vertexes, std::vector<unsigned int>& indexes )
+{
+	if(psurface->flags & (SURF_DRAWSKY|SURF_DRAWTURB|SURF_UNDERWATER))
+		return;
+
+	glpoly_t* p = psurface->polys;
+	if(!p || p->numverts < 3)
+		return;
+
+	worldsurface_t surface;
+	surface.psurface = psurface->psurface;
+	surface.firstindex = indexes.size();
+	surface.numindexes = (p->numverts - 2) * 3;
+
+	// Fan out from the first vertex, same as GL_POLYGON
+	unsigned int base = vertexes.size();
+	float* v = p->verts[0];
+	for(int i = 0; i < p->numverts; i++, v += VERTEXSIZE)
+		vertexes.push_back(Vector(v[0], v[1], v[2]));
+
+	for(int i = 1; i < p->numverts - 1; i++)
+	{
+		indexes.push_back(base);
+		indexes.push_back(base + i);
+		indexes.push_back(base + i + 1);
+	}
+
+	g_worldSurfaces.push_back(surface);
+}
+
+/*
+====================
+SVD_BuildWorldBuffer
+
+====================
+*/
+void SVD_BuildWorldBuffer( void )
+{
+	g_bWorldBufferBuilt = true;
+
+	if(!g_bShadowBuffersSupported)
+		return;
+
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+	const svdsurface_t* psurfaces = SVD_GetWorldSurfaces();
+	if(!psurfaces)
+		return;
+
+	std::vector<Vector> vertexes;
+	std::vector<unsigned int> indexes;
+	std::vector<bool> added(pworld->numsurfaces, false);
+
+	// Surfaces are marked visible per leaf, so add them leaf by leaf
+	for(int i = 1; i <= pworld->numleafs; i++)
+	{
+		mleaf_t* pleaf = &pworld->leafs[i];
+		for(int j = 0; j < pleaf->nummarksurfaces; j++)
+		{
+			int surfnum = SVD_GetWorldSurfaceIndex(pleaf->firstmarksurface[j]);
+			if(surfnum < pworld->firstmodelsurface || surfnum >= pworld->firstmodelsurface + pworld->nummodelsurfaces)
+				continue;
+
+			if(added[surfnum])
+				continue;
+
+			added[surfnum] = true;
+			SVD_AddWorldSurface(&psurfaces[surfnum], vertexes, indexes);
+		}
+	}
+
+	if(indexes.empty())
+		return;
+
+	glGenBuffers(1, &g_worldVertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, g_worldVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vector) * vertexes.size(), vertexes.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &g_worldIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_worldIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexes.size(), indexes.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/*
+====================
+SVD_DrawWorldBuffer
+
+Returns false if the world has to be drawn by walking the BSP
+====================
+*/
+bool SVD_DrawWorldBuffer( void )
+{
+	if(g_StudioRenderer.m_pCvarShadowWorldVBO->value < 1)
+		return false;
+
+	if(!g_bWorldBufferBuilt)
+		SVD_BuildWorldBuffer();
+
+	if(!g_worldVertexBuffer || !g_worldIndexBuffer)
+		return false;
+
+	// Merge visible surfaces that sit next to each other in the buffer
+	g_worldDrawCounts.clear();
+	g_worldDrawOffsets.clear();
+
+	int runstart = -1;
+	int runend = -1;
+	for(const worldsurface_t& surface : g_worldSurfaces)
+	{
+		if(surface.psurface->visframe != g_frameCount)
+			continue;
+
+		if(surface.firstindex != runend)
+		{
+			if(runstart != -1)
+			{
+				g_worldDrawCounts.push_back(runend - runstart);
+				g_worldDrawOffsets.push_back((const void*)(intptr_t)(runstart * sizeof(unsigned int)));
+			}
+
+			runstart = surface.firstindex;
+		}
+
+		runend = surface.firstindex + surface.numindexes;
+	}
+
+	if(runstart != -1)
+	{
+		g_worldDrawCounts.push_back(runend - runstart);
+		g_worldDrawOffsets.push_back((const void*)(intptr_t)(runstart * sizeof(unsigned int)));
+	}
+
+	if(g_worldDrawCounts.empty())
+		return true;
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	for(int i = 0; i < 4; i++)
+	{
+		glClientActiveTexture(GL_TEXTURE0 + i);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	glClientActiveTexture(GL_TEXTURE0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, g_worldVertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_worldIndexBuffer);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(Vector), 0);
+
+	if(glMultiDrawElements)
+	{
+		glMultiDrawElements(GL_TRIANGLES, g_worldDrawCounts.data(), GL_UNSIGNED_INT, g_worldDrawOffsets.data(), g_worldDrawCounts.size());
+	}
+	else
+	{
+		for(size_t i = 0; i < g_worldDrawCounts.size(); i++)
+			glDrawElements(GL_TRIANGLES, g_worldDrawCounts[i], GL_UNSIGNED_INT, g_worldDrawOffsets[i]);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glPopClientAttrib();
+	return true;
+}
+
 /*
 ====================
 SVD_VidInit
@@ -399,6 +881,153 @@ SVD_VidInit
 void SVD_VidInit( void )
 {
 	SVD_Clear();
+	SVD_DeleteWorldBuffer();
+	SVD_BuildWorldSurfaceTable();
+
+	// Rebuilt for the new world on first use
+	g_skyLeafStates.clear();
+
+	g_viewVisLeaf = nullptr;
+	g_viewCullingValid = false;
+}
+
+/*
+====================
+SVD_CreateShadowBuffers
+
+====================
+*/
+void SVD_CreateShadowBuffers( void )
+{
+	if(!glGenBuffers || !glBindBuffer || !glBufferData || !glBufferSubData || !glDeleteBuffers)
+	{
+		g_bShadowBuffersSupported = false;
+		return;
+	}
+
+	glGenBuffers(1, &g_shadowVertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, g_shadowVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, SHADOW_VERTEX_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &g_shadowIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_shadowIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, SHADOW_INDEX_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	g_shadowVertexBufferOffset = 0;
+	g_shadowIndexBufferOffset = 0;
+	g_bShadowBuffersSupported = true;
+}
+
+/*
+====================
+SVD_DeleteShadowBuffers
+
+====================
+*/
+void SVD_DeleteShadowBuffers( void )
+{
+	if(!g_bShadowBuffersSupported)
+		return;
+
+	glDeleteBuffers(1, &g_shadowVertexBuffer);
+	glDeleteBuffers(1, &g_shadowIndexBuffer);
+
+	g_shadowVertexBuffer = 0;
+	g_shadowIndexBuffer = 0;
+	g_bShadowBuffersSupported = false;
+}
+
+/*
+====================
+SVD_BindShadowBuffers
+
+Returns false if the shadow has to use client side arrays
+====================
+*/
+bool SVD_BindShadowBuffers( void )
+{
+	if(!g_bShadowBuffersSupported)
+		return false;
+
+	glBindBuffer(GL_ARRAY_BUFFER, g_shadowVertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_shadowIndexBuffer);
+	return true;
+}
+
+/*
+====================
+SVD_UnbindShadowBuffers
+
+====================
+*/
+void SVD_UnbindShadowBuffers( void )
+{
+	// The engine draws everything else from client memory
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/*
+====================
+SVD_StreamBufferData
+
+Appends data to the buffer bound to target. When it runs out of room the
+storage is orphaned, so the driver hands out fresh memory instead of
+waiting on draws still reading the old contents.
+====================
+*/
+const void* SVD_StreamBufferData( GLenum target, int capacity, int* poffset, const void* pdata, int size )
+{
+	// Keep every upload 16 byte aligned
+	int offset = (*poffset + 15) & ~15;
+	if(offset + size > capacity)
+	{
+		glBufferData(target, capacity, NULL, GL_STREAM_DRAW);
+		offset = 0;
+	}
+
+	void* pdest = NULL;
+	if(glMapBufferRange)
+		pdest = glMapBufferRange(target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+	if(pdest)
+	{
+		memcpy(pdest, pdata, size);
+		glUnmapBuffer(target);
+	}
+	else
+	{
+		glBufferSubData(target, offset, size, pdata);
+	}
+
+	*poffset = offset + size;
+
+	// Offset into the bound buffer, the way gl*Pointer expects it
+	return (const void*)(intptr_t)offset;
+}
+
+/*
+====================
+SVD_StreamShadowVertexes
+
+====================
+*/
+const void* SVD_StreamShadowVertexes( const void* pdata, int size )
+{
+	return SVD_StreamBufferData(GL_ARRAY_BUFFER, SHADOW_VERTEX_BUFFER_SIZE, &g_shadowVertexBufferOffset, pdata, size);
+}
+
+/*
+====================
+SVD_StreamShadowIndexes
+
+====================
+*/
+const void* SVD_StreamShadowIndexes( const void* pdata, int size )
+{
+	return SVD_StreamBufferData(GL_ELEMENT_ARRAY_BUFFER, SHADOW_INDEX_BUFFER_SIZE, &g_shadowIndexBufferOffset, pdata, size);
 }
 
 /*
@@ -421,6 +1050,8 @@ void SVD_Init( void )
 		return;
 	}
 
+	SVD_CreateShadowBuffers();
+
 	if(!R_IsExtensionSupported("EXT_framebuffer_object") && !R_IsExtensionSupported("ARB_framebuffer_object"))
 	{
 		gEngfuncs.Con_Printf("Your hardware does not support framebuffer objects. Stencil shadows will remain disabled.\n");
@@ -458,7 +1089,11 @@ SVD_Shutdown
 */
 void SVD_Shutdown( void )
 {
+	SVD_StopBuildThread();
 	SVD_Clear();
+	SVD_ClosePack();
+	SVD_DeleteWorldBuffer();
+	SVD_DeleteShadowBuffers();
 
 	if(!g_bFBOSupported)
 		return;
@@ -531,7 +1166,7 @@ void SVD_DrawBrushModel ( cl_entity_t *pentity )
 		VectorAdd (pentity->origin, pmodel->maxs, vmaxs);
 	}
 
-	if (R_CullBox(vmins, vmaxs))
+	if (Frustum_CullBox(&g_viewFrustum, vmins, vmaxs))
 		return;
 
 	VectorSubtract (vlocalview, pentity->origin, vlocalview);
@@ -559,10 +1194,10 @@ void SVD_DrawBrushModel ( cl_entity_t *pentity )
 		glRotatef(pentity->curstate.angles[2],  1, 0, 0);
 	}
 
-	byte* pfirstsurfbyteptr = reinterpret_cast<byte*>(g_pWorld->surfaces);
+	const svdsurface_t* psurfaces = SVD_GetWorldSurfaces();
 	for (int i = 0; i < pmodel->nummodelsurfaces; i++)
 	{
-		msurface_t	*psurface = reinterpret_cast<msurface_t*>(pfirstsurfbyteptr + g_msurfaceStructSize*(pmodel->firstmodelsurface+i));
+		const svdsurface_t *psurface = &psurfaces[pmodel->firstmodelsurface+i];
 		mplane_t *pplane = psurface->plane;
 
 		float fldot = DotProduct(vlocalview, pplane->normal) - pplane->dist;
@@ -605,9 +1240,6 @@ SVD_RecursiveDrawWorld
 */
 void SVD_RecursiveDrawWorld ( mnode_t *node )
 {
-	if(!g_msurfaceStructSize)
-		g_msurfaceStructSize = R_DetermineSurfaceStructSize();
-
 	if (node->contents == CONTENTS_SOLID)
 		return;
 
@@ -625,11 +1257,10 @@ void SVD_RecursiveDrawWorld ( mnode_t *node )
 	int c = node->numsurfaces;
 	if (node->numsurfaces > 0)
 	{
-		byte* pfirstsurfbyteptr = reinterpret_cast<byte*>(g_pWorld->surfaces);
-		for(int i = 0; i < node->numsurfaces; i++)
+		const svdsurface_t* surf = SVD_GetWorldSurfaces() + node->firstsurface;
+		for(int i = 0; i < node->numsurfaces; i++, surf++)
 		{
-			msurface_t	*surf = reinterpret_cast<msurface_t*>(pfirstsurfbyteptr + g_msurfaceStructSize*(node->firstsurface+i));
-			if (surf->visframe != g_frameCount)
+			if (surf->psurface->visframe != g_frameCount)
 				continue;
 
 			if (surf->flags & (SURF_DRAWSKY|SURF_DRAWTURB|SURF_UNDERWATER))
@@ -649,6 +1280,264 @@ void SVD_RecursiveDrawWorld ( mnode_t *node )
 	}
 }
 
+/*
+====================
+SVD_AddShadowCaster
+
+====================
+*/
+void SVD_AddShadowCaster( cl_entity_t* pentity )
+{
+	if(!pentity->model || pentity->model->type != mod_studio)
+		return;
+
+	// First entity of a new frame
+	float time = gEngfuncs.GetClientTime();
+	if(time != g_shadowCasterTime)
+	{
+		g_shadowCasters.clear();
+		g_shadowCasterTime = time;
+	}
+
+	g_shadowCasters[pentity] = SHADOW_CASTER_UNKNOWN;
+}
+
+/*
+====================
+SVD_GetShadowCasterState
+
+====================
+*/
+int SVD_GetShadowCasterState( cl_entity_t* pentity )
+{
+	auto it = g_shadowCasters.find(pentity);
+	if(it == g_shadowCasters.end())
+		return SHADOW_CASTER_UNKNOWN;
+
+	return it->second;
+}
+
+/*
+====================
+SVD_DecompressViewVis
+
+====================
+*/
+void SVD_DecompressViewVis( model_t* pworld, mleaf_t* pleaf )
+{
+	int row = (pworld->numleafs+7)>>3;
+	g_viewLeafVis.assign(row, 0);
+
+	// No vis data, everything is visible
+	byte* in = pleaf->compressed_vis;
+	if(!in)
+	{
+		g_viewLeafVis.assign(row, 0xFF);
+		return;
+	}
+
+	byte* out = g_viewLeafVis.data();
+	byte* end = out + row;
+	while(out < end)
+	{
+		if(*in)
+		{
+			*out++ = *in++;
+			continue;
+		}
+
+		int c = in[1];
+		in += 2;
+		out += c;
+	}
+}
+
+/*
+====================
+SVD_BoxInPVS
+
+====================
+*/
+bool SVD_BoxInPVS( model_t* pworld, mnode_t* pnode, const Vector& mins, const Vector& maxs )
+{
+	if(pnode->contents == CONTENTS_SOLID)
+		return false;
+
+	if(pnode->contents < 0)
+	{
+		int leafnum = (mleaf_t*)pnode - pworld->leafs - 1;
+		if(leafnum < 0 || (leafnum>>3) >= (int)g_viewLeafVis.size())
+			return true;
+
+		return (g_viewLeafVis[leafnum>>3] & (1<<(leafnum&7))) != 0;
+	}
+
+	int sides = BoxOnPlaneSide(mins, maxs, pnode->plane);
+	if((sides & 1) && SVD_BoxInPVS(pworld, pnode->children[0], mins, maxs))
+		return true;
+
+	if((sides & 2) && SVD_BoxInPVS(pworld, pnode->children[1], mins, maxs))
+		return true;
+
+	return false;
+}
+
+/*
+====================
+SVD_SetupViewCulling
+
+Sets up the frustum and PVS SVD_CullViewBox tests against
+====================
+*/
+void SVD_SetupViewCulling( ref_params_t* pparams )
+{
+	g_viewCullingValid = false;
+
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+	if(!pworld)
+		return;
+
+	Vector origin = pparams->vieworg;
+	Vector angles = pparams->viewangles;
+
+	// The PVS only changes with the view leaf
+	mleaf_t* pviewleaf = Mod_PointInLeaf(origin, pworld);
+	if(pviewleaf != g_viewVisLeaf)
+	{
+		SVD_DecompressViewVis(pworld, pviewleaf);
+		g_viewVisLeaf = pviewleaf;
+	}
+
+	// default_fov is the 4:3 horizontal fov, widen it to the screen aspect
+	// and use it on both axes so the frustum stays conservative
+	float fov = gHUD.m_iFOV;
+	if(ScreenHeight > 0)
+	{
+		float aspect = ((float)ScreenWidth / (float)ScreenHeight) * 0.75f;
+		if(aspect > 1.0f)
+			fov = atan(tan(DEG2RAD(fov) * 0.5f) * aspect) * 360.0f / M_PI;
+	}
+
+	if(fov > 170.0f)
+		fov = 170.0f;
+	Frustum_SetFromView(&g_viewFrustum, angles, origin, fov);
+
+	g_viewCullingValid = true;
+}
+
+/*
+====================
+SVD_GetViewFrustum
+
+Returns NULL until SVD_SetupViewCulling has run for this view
+====================
+*/
+const frustum_t* SVD_GetViewFrustum( void )
+{
+	return g_viewCullingValid ? &g_viewFrustum : nullptr;
+}
+
+/*
+====================
+SVD_BoxInViewPVS
+
+====================
+*/
+bool SVD_BoxInViewPVS( const Vector& mins, const Vector& maxs )
+{
+	if(!g_viewCullingValid)
+		return true;
+
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+	return SVD_BoxInPVS(pworld, pworld->nodes, mins, maxs);
+}
+
+/*
+====================
+SVD_CullViewBox
+
+====================
+*/
+bool SVD_CullViewBox( const Vector& mins, const Vector& maxs )
+{
+	if(!g_viewCullingValid)
+		return false;
+
+	if(Frustum_CullBox(&g_viewFrustum, mins, maxs))
+		return true;
+
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+	return !SVD_BoxInPVS(pworld, pworld->nodes, mins, maxs);
+}
+
+/*
+====================
+SVD_BuildShadowVisibility
+
+Runs the view occlusion trace once per visible shadow caster.
+Casters outside the view stay unknown, and are traced when drawn
+====================
+*/
+void SVD_BuildShadowVisibility( void )
+{
+	if(g_shadowCasters.empty())
+		return;
+
+	model_t* pworld = IEngineStudio.GetModelByIndex(1);
+	if(!pworld)
+		return;
+
+	// Uses the frustum and PVS from SVD_SetupViewCulling
+	if(!g_viewCullingValid)
+		return;
+
+	g_cullEntities.clear();
+	for(int i = 0; i < 3; i++)
+	{
+		g_cullMins[i].clear();
+		g_cullMaxs[i].clear();
+	}
+
+	for(auto& caster : g_shadowCasters)
+	{
+		cl_entity_t* pentity = caster.first;
+		model_t* pmodel = pentity->model;
+
+		caster.second = SHADOW_CASTER_UNKNOWN;
+
+		g_cullEntities.push_back(pentity);
+		for(int i = 0; i < 3; i++)
+		{
+			g_cullMins[i].push_back(pentity->origin[i] - pmodel->radius);
+			g_cullMaxs[i].push_back(pentity->origin[i] + pmodel->radius);
+		}
+	}
+
+	const float* pmins[3] = { g_cullMins[0].data(), g_cullMins[1].data(), g_cullMins[2].data() };
+	const float* pmaxs[3] = { g_cullMaxs[0].data(), g_cullMaxs[1].data(), g_cullMaxs[2].data() };
+
+	g_cullVisible.resize(g_cullEntities.size());
+	int numvisible = Frustum_CullBoxes(&g_viewFrustum, pmins, pmaxs, g_cullEntities.size(), g_cullVisible.data());
+
+	gEngfuncs.pEventAPI->EV_SetTraceHull( 2 );
+
+	for(int i = 0; i < numvisible; i++)
+	{
+		int index = g_cullVisible[i];
+		cl_entity_t* pentity = g_cullEntities[index];
+
+		Vector mins(g_cullMins[0][index], g_cullMins[1][index], g_cullMins[2][index]);
+		Vector maxs(g_cullMaxs[0][index], g_cullMaxs[1][index], g_cullMaxs[2][index]);
+		if(!SVD_BoxInPVS(pworld, pworld->nodes, mins, maxs))
+			continue;
+
+		pmtrace_t tr;
+		gEngfuncs.pEventAPI->EV_PlayerTrace( g_viewOrigin, pentity->origin+Vector(0, 0, 1), PM_WORLD_ONLY, -1, &tr );
+
+		g_shadowCasters[pentity] = (tr.fraction != 1.0) ? SHADOW_CASTER_HIDDEN : SHADOW_CASTER_VISIBLE;
+	}
+}
+
 /*
 ====================
 SVD_CalcRefDef
@@ -668,15 +1557,22 @@ void SVD_CalcRefDef ( ref_params_t* pparams )
 	if(g_StudioRenderer.m_pCvarDrawStencilShadows->value < 1)
 		return;
 
+	// Resolve which shadow casters are occluded in one go
+	SVD_BuildShadowVisibility();
+
 	if(g_bFBOSupported)
 	{
 		// Get previous FBO binding, as Steam HL's MSAA might be enabled
 		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &g_steamHLBoundFBO);
+		SVD_SelectFBOPath();
 
 		// Bind the FBO to use
-		glBindFramebuffer(GL_FRAMEBUFFER, g_stencilFBO);
-		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, ScreenWidth, ScreenHeight);
+		if(g_fboPath != FBO_PATH_DIRECT)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, g_stencilFBO);
+			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+			glViewport(0, 0, ScreenWidth, ScreenHeight);
+		}
 	}
 
 	// Might be using hacky DLL
@@ -685,38 +1581,50 @@ void SVD_CalcRefDef ( ref_params_t* pparams )
 
 /*
 ====================
-SVD_DrawTransparentTriangles
+SVD_DrawScreenResolve
 
+Darkens every stenciled pixel with one full-screen quad, so brush
+entities and models receive shadows as well as the world
 ====================
 */
-void SVD_DrawTransparentTriangles ( void )
+void SVD_DrawScreenResolve( void )
 {
-	if(g_StudioRenderer.m_pCvarDrawStencilShadows->value < 1)
-		return;
-
-	if(IEngineStudio.IsHardware() != 1)
-		return;
-
-	glPushAttrib(GL_TEXTURE_BIT);
-
-	// buz: workaround half-life's bug, when multitexturing left enabled after
-	// rendering brush entities
-	glActiveTexture( GL_TEXTURE1_ARB );
-	glDisable(GL_TEXTURE_2D);
-	glActiveTexture( GL_TEXTURE0_ARB );
-
-	glDepthMask(GL_FALSE);
-	glDisable(GL_TEXTURE_2D);
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glColor4f(GL_ZERO, GL_ZERO, GL_ZERO, 0.5);
-	glDepthFunc(GL_EQUAL);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, 1, 0, 1, -1, 1);
+
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	glBegin(GL_QUADS);
+	glVertex2f(0, 0);
+	glVertex2f(1, 0);
+	glVertex2f(1, 1);
+	glVertex2f(0, 1);
+	glEnd();
+
+	glEnable(GL_DEPTH_TEST);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+}
 
-	glStencilFunc(GL_NOTEQUAL, 0, ~0);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-	glEnable(GL_STENCIL_TEST);
+/*
+====================
+SVD_DrawWorldResolve
 
+Darkens stenciled pixels by drawing the visible world again
+====================
+*/
+void SVD_DrawWorldResolve( void )
+{
 	// get current visframe number
 	g_pWorld = IEngineStudio.GetModelByIndex(1);
 	mleaf_t *pleaf = Mod_PointInLeaf ( g_viewOrigin, g_pWorld );
@@ -726,11 +1634,12 @@ void SVD_DrawTransparentTriangles ( void )
 	g_frameCount = g_StudioRenderer.m_nFrameCount;
 
 	// draw world
-	SVD_RecursiveDrawWorld( g_pWorld->nodes );
+	if(!SVD_DrawWorldBuffer())
+		SVD_RecursiveDrawWorld( g_pWorld->nodes );
 	
 #if 0 // Unfortunately there is a bug with some brushmodels, so this is not supported until I find a fix
 	// Now draw brushmodels
-	R_SetFrustum(g_viewAngles, g_viewOrigin, gHUD.m_iFOV, 16384);
+	Frustum_SetFromView(&g_viewFrustum, g_viewAngles, g_viewOrigin, gHUD.m_iFOV);
 
 	// Get local player
 	cl_entity_t* plocalplayer = gEngfuncs.GetLocalPlayer();
@@ -753,6 +1662,47 @@ void SVD_DrawTransparentTriangles ( void )
 		SVD_DrawBrushModel(pentity);
 	}
 #endif
+}
+
+/*
+====================
+SVD_DrawTransparentTriangles
+
+====================
+*/
+void SVD_DrawTransparentTriangles ( void )
+{
+	if(g_StudioRenderer.m_pCvarDrawStencilShadows->value < 1)
+		return;
+
+	if(IEngineStudio.IsHardware() != 1)
+		return;
+
+	glPushAttrib(GL_TEXTURE_BIT);
+
+	// buz: workaround half-life's bug, when multitexturing left enabled after
+	// rendering brush entities
+	glActiveTexture( GL_TEXTURE1_ARB );
+	glDisable(GL_TEXTURE_2D);
+	glActiveTexture( GL_TEXTURE0_ARB );
+
+	glDepthMask(GL_FALSE);
+	glDisable(GL_TEXTURE_2D);
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glColor4f(GL_ZERO, GL_ZERO, GL_ZERO, 0.5);
+	glDepthFunc(GL_EQUAL);
+
+	glStencilFunc(GL_NOTEQUAL, 0, ~0);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glEnable(GL_STENCIL_TEST);
+
+	if(g_StudioRenderer.m_pCvarShadowResolve->value >= 1)
+		SVD_DrawScreenResolve();
+	else
+		SVD_DrawWorldResolve();
+
 	glDepthMask(GL_TRUE);
 	glEnable(GL_CULL_FACE);
 	glDisable(GL_BLEND);
@@ -776,92 +1726,54 @@ void SVD_PerformFBOBlit ( void )
 	if(!g_bFBOSupported)
 		return;
 
-	// Blit from main FBO to main renderbuffer or intermediate
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, g_stencilFBO);
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	g_fboBytesCopied = 0;
 
-	if(g_useMSAA && g_msaaSetting > 0)
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_intermediateFBO);
-	else if(g_steamHLBoundFBO)
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_steamHLBoundFBO);
-	else
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-	glBlitFramebuffer(0, 0, ScreenWidth, ScreenHeight, 0, 0, ScreenWidth, ScreenHeight, GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-
-	if(g_useMSAA && g_msaaSetting > 0)
+	if(g_fboPath != FBO_PATH_DIRECT)
 	{
-		// Blit from intermediate to target
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, g_intermediateFBO);
-
-		if(g_steamHLBoundFBO)
+		// Blit from main FBO to main renderbuffer or intermediate
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, g_stencilFBO);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+		if(g_fboPath == FBO_PATH_TWO_BLITS && g_useMSAA && g_msaaSetting > 0)
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_intermediateFBO);
+		else if(g_steamHLBoundFBO)
 			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_steamHLBoundFBO);
 		else
 			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
 		glBlitFramebuffer(0, 0, ScreenWidth, ScreenHeight, 0, 0, ScreenWidth, ScreenHeight, GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-	}
-
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-	if(g_steamHLBoundFBO)
-		glBindFramebuffer(GL_FRAMEBUFFER, g_steamHLBoundFBO);
-	else
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-/*
-====================
-R_DetermineSurfaceStructSize
-
-====================
-*/
-int R_DetermineSurfaceStructSize( void )
-{
-	model_t* pworld = IEngineStudio.GetModelByIndex(1);
-	assert(pworld);
 
-	mplane_t* pplanes = pworld->planes;
-	msurface_t* psurfaces = pworld->surfaces;
+		// Color and packed depth-stencil for every sample read
+		int samples = (g_useMSAA && g_msaaSetting > 0) ? g_msaaSetting : 1;
+		g_fboBytesCopied += ScreenWidth * ScreenHeight * 8 * samples;
 
-	// Try to find second texinfo ptr
-	byte* psecondsurfbytedata = reinterpret_cast<byte*>(&psurfaces[1]);
+		if(g_fboPath == FBO_PATH_TWO_BLITS && g_useMSAA && g_msaaSetting > 0)
+		{
+			// Blit from intermediate to target
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, g_intermediateFBO);
 
-	// Size of msurface_t with that stupid displaylist junk
-	static const int MAXOFS = 108;
+			if(g_steamHLBoundFBO)
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_steamHLBoundFBO);
+			else
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-	int byteoffs = 0;
-	while(byteoffs <= MAXOFS)
-	{
-		mplane_t **pplaneptr = reinterpret_cast<mplane_t**>(psecondsurfbytedata+byteoffs);
-		
-		int i = 0;
-		for(; i < pworld->numplanes; i++)
-		{
-			if(&pplanes[i] == *pplaneptr)
-				break;
+			glBlitFramebuffer(0, 0, ScreenWidth, ScreenHeight, 0, 0, ScreenWidth, ScreenHeight, GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+			g_fboBytesCopied += ScreenWidth * ScreenHeight * 8;
 		}
 
-		if(i != pworld->numplanes)
-		{
-			break;
-		}
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-		byteoffs++;
+		if(g_steamHLBoundFBO)
+			glBindFramebuffer(GL_FRAMEBUFFER, g_steamHLBoundFBO);
+		else
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
-	if(byteoffs >= MAXOFS)
-	{
-		gEngfuncs.Con_Printf("%s - Failed to determine msurface_t struct size.\n");
-		return sizeof(msurface_t);
-	}
-	else
+	if(g_StudioRenderer.m_pCvarShadowFBOStats->value > 0)
 	{
-		mplane_t** pfirstsurftexinfoptr = &psurfaces[0].plane;
-		byte* psecondptr = reinterpret_cast<byte*>(psecondsurfbytedata) + byteoffs;
-		byte* ptr = reinterpret_cast<byte*>(pfirstsurftexinfoptr);
-		return ((unsigned int)psecondptr - (unsigned int)ptr);
+		static const char* pathNames[] = { "two blits", "one blit", "direct" };
+		gEngfuncs.Con_NPrintf(21, "Shadow FBO path: %s, %d KB copied", pathNames[g_fboPath], g_fboBytesCopied / 1024);
 	}
-}
\ No newline at end of file
+}
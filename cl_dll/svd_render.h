@@ -9,6 +9,26 @@
 #define SVD_RENDER_H
 
 #include "ref_params.h"
+#include "com_model.h"
+
+// World surface fields the shadow code reads, copied out of the
+// engine's msurface_t array so walks over them stay sequential
+struct svdsurface_t
+{
+	mplane_t* plane;
+	glpoly_t* polys;
+	mtexinfo_t* texinfo;
+	int flags;
+	msurface_t* psurface; // For fields the engine changes every frame
+};
+
+// Result of the per-frame shadow caster visibility pass
+enum shadowcasterstate_t
+{
+	SHADOW_CASTER_UNKNOWN = 0,
+	SHADOW_CASTER_HIDDEN,
+	SHADOW_CASTER_VISIBLE
+};
 
 extern void SVD_Init();
 extern void SVD_VidInit();
@@ -16,8 +36,23 @@ extern void SVD_Frame();
 extern void SVD_Shutdown();
 extern void SVD_CreateStencilFBO();
 
+extern bool SVD_BindShadowBuffers();
+extern void SVD_UnbindShadowBuffers();
+extern const void* SVD_StreamShadowVertexes( const void* pdata, int size );
+extern const void* SVD_StreamShadowIndexes( const void* pdata, int size );
+
+extern bool SVD_PointSeesSky( const Vector& point, const Vector& skyVec );
+
+extern void SVD_AddShadowCaster( struct cl_entity_s* pentity );
+extern int SVD_GetShadowCasterState( struct cl_entity_s* pentity );
+
 extern void SVD_CalcRefDef( ref_params_t* pparams );
+extern void SVD_SetupViewCulling( ref_params_t* pparams );
+extern bool SVD_CullViewBox( const Vector& mins, const Vector& maxs );
+extern const struct frustum_t* SVD_GetViewFrustum();
+extern bool SVD_BoxInViewPVS( const Vector& mins, const Vector& maxs );
 extern void SVD_DrawTransparentTriangles();
 extern void SVD_PerformFBOBlit();
-extern int R_DetermineSurfaceStructSize();
+extern const svdsurface_t* SVD_GetWorldSurfaces( int* pnumsurfaces = nullptr );
+extern int SVD_GetWorldSurfaceIndex( const msurface_t* psurface );
 #endif
\ No newline at end of file
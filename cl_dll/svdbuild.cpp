@@ -0,0 +1,940 @@
+//========= Copyright  1996-2002, Valve LLC, All rights reserved. ============
+//
+// Purpose: Shadow volume data construction. Kept free of engine calls so
+// that the client and the offline svdgen tool build identical files.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include <string.h>
+#include <memory.h>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "mathlib.h"
+#include "vector.h"
+#include "steam/steamtypes.h"
+
+// studio.h needs byte, which otherwise only comes in through the client headers
+typedef unsigned char byte;
+
+#include "svdformat.h"
+
+// Buffer an SVD is being constructed in
+struct svdbuild_t
+{
+	byte* pbuffer;
+	int offset;
+};
+
+// Open edges keyed on their (min,max) vertex pair, see SVD_EdgeKey
+typedef std::unordered_map<unsigned int, int> svdedgemap_t;
+
+// Candidate move of vertex0 onto vertex1 during decimation
+struct svdcollapse_t
+{
+	float cost;
+	int vertex0;
+	int vertex1;
+
+	// Cheapest collapse on top of the priority queue
+	bool operator<( const svdcollapse_t& other ) const
+	{
+		return cost > other.cost;
+	}
+};
+
+// Mesh being reduced by edge collapses. Vertexes never move, a collapse
+// moves every face of one vertex onto a neighbour, so LODs only use a
+// subset of the submodel's own vertexes.
+struct svddecimate_t
+{
+	const Vector* pverts;
+	const byte* pvertbones;
+
+	// Three vertexes per face, unshifted
+	std::vector<int> faces;
+	std::vector<bool> facealive;
+	int numalive;
+
+	// Faces using each vertex, may list dead ones
+	std::vector<std::vector<int>> vertfaces;
+	std::vector<bool> vertremoved;
+	// Vertexes on an open edge are kept to preserve the outline
+	std::vector<bool> vertboundary;
+	// Faces using each edge of the source mesh, keyed by SVD_EdgeKey
+	std::unordered_map<unsigned int, int> sourceedgeuses;
+
+	// Scratch lists for SVD_CollapseKeepsManifold
+	std::vector<int> neighbours0;
+	std::vector<int> neighbours1;
+
+	std::priority_queue<svdcollapse_t> queue;
+};
+
+// Reduced mesh of a single LOD
+struct svdlodmesh_t
+{
+	std::vector<Vector> verts;
+	std::vector<byte> vertbones;
+	std::vector<int> faces;
+};
+
+/*
+====================
+SVD_CountFaces
+
+====================
+*/
+static int SVD_CountFaces( const mstudiomodel_t* pstudiosubmodel, const studiohdr_t* phdr )
+{
+	int numfaces = 0;
+
+	mstudiomesh_t *pmeshes = (mstudiomesh_t *)((byte *)phdr + pstudiosubmodel->meshindex);
+	for (int i = 0; i < pstudiosubmodel->nummesh; i++)
+	{
+		int j;
+		short *ptricmds = (short *)((byte *)phdr + pmeshes[i].triindex);
+		while (j = *(ptricmds++))
+		{
+			if (j < 0)
+				j *= -1;
+
+			numfaces += (j - 2);
+			ptricmds += 4 * j;
+		}
+	}
+
+	return numfaces;
+}
+
+/*
+====================
+SVD_GetBufferSize
+
+Upper bound on the size of the built data, every
+face is assumed to contribute three open edges
+====================
+*/
+static int SVD_GetBufferSize( const studiohdr_t* phdr )
+{
+	int size = sizeof(svdheader_t) + sizeof(svdbodypart_t)*phdr->numbodyparts;
+	for (int i = 0; i < phdr->numbodyparts; i++)
+	{
+		mstudiobodyparts_t* pstbodypart = (mstudiobodyparts_t *)((byte *)phdr + phdr->bodypartindex) + i;
+		size += sizeof(svdsubmodel_t)*pstbodypart->nummodels;
+
+		for (int j = 0; j < pstbodypart->nummodels; j++)
+		{
+			mstudiomodel_t *pstsubmodel = (mstudiomodel_t *)((byte *)phdr + pstbodypart->modelindex) + j;
+			int numfaces = SVD_CountFaces(pstsubmodel, phdr);
+
+			size += (sizeof(Vector) + sizeof(byte))*pstsubmodel->numverts;
+			size += sizeof(svdface_t)*numfaces;
+			size += sizeof(svdedge_t)*numfaces*3;
+
+			// LODs are never larger than the full mesh
+			size += (sizeof(svdsubmodel_t) + (sizeof(Vector) + sizeof(byte))*pstsubmodel->numverts
+				+ sizeof(svdface_t)*numfaces + sizeof(svdedge_t)*numfaces*3) * SVD_MAX_LODS;
+		}
+	}
+
+	return size;
+}
+
+/*
+====================
+SVD_BuildFaces
+
+====================
+*/
+static void SVD_BuildFaces( svdbuild_t* pbuild, svdsubmodel_t* psubmodel, const mstudiomodel_t* pstudiosubmodel, const studiohdr_t* phdr )
+{
+	// get number of triangles in all meshes
+	mstudiomesh_t *pmeshes = (mstudiomesh_t *)((byte *)phdr + pstudiosubmodel->meshindex);
+	psubmodel->numfaces = SVD_CountFaces(pstudiosubmodel, phdr);
+
+	// No faces in this submodel
+	if (psubmodel->numfaces == 0)
+		return;
+
+	// Allocate spot for face data
+	psubmodel->faceindex = pbuild->offset;
+	pbuild->offset += sizeof(svdface_t)*psubmodel->numfaces;
+
+	// Copy over data
+	int faceindex = 0;
+	svdface_t* pfaces = (svdface_t *)(pbuild->pbuffer + psubmodel->faceindex);
+
+	for (int i = 0; i < pstudiosubmodel->nummesh; i++)
+	{
+		short *ptricmds = (short *)((byte *)phdr + pmeshes[i].triindex);
+
+		int j;
+		while (j = *(ptricmds++))
+		{
+			if (j > 0)
+			{
+				// convert triangle strip
+				j -= 3;
+
+				short indices[3];
+				indices[0] = ptricmds[0]; ptricmds += 4;
+				indices[1] = ptricmds[0]; ptricmds += 4;
+				indices[2] = ptricmds[0]; ptricmds += 4;
+
+				// Add the face
+				pfaces[faceindex].vertex0 = indices[0];
+				pfaces[faceindex].vertex1 = indices[1];
+				pfaces[faceindex].vertex2 = indices[2];
+				faceindex++;
+
+				bool reverse = false;
+				for( ; j > 0; j--, ptricmds += 4)
+				{
+					indices[0] = indices[1];
+					indices[1] = indices[2];
+					indices[2] = ptricmds[0];
+
+					// Add the face
+					if (!reverse)
+					{
+						pfaces[faceindex].vertex0 = indices[2];
+						pfaces[faceindex].vertex1 = indices[1];
+						pfaces[faceindex].vertex2 = indices[0];
+						faceindex++;
+					}
+					else
+					{
+						pfaces[faceindex].vertex0 = indices[0];
+						pfaces[faceindex].vertex1 = indices[1];
+						pfaces[faceindex].vertex2 = indices[2];
+						faceindex++;
+					}
+
+					// Switch the order
+					reverse = !reverse;
+				}
+			}
+			else
+			{
+				// convert triangle fan
+				j = -j - 3;
+
+				short indices[3];
+				indices[0] = ptricmds[0]; ptricmds += 4;
+				indices[1] = ptricmds[0]; ptricmds += 4;
+				indices[2] = ptricmds[0]; ptricmds += 4;
+
+				// Add the face
+				pfaces[faceindex].vertex0 = indices[0];
+				pfaces[faceindex].vertex1 = indices[1];
+				pfaces[faceindex].vertex2 = indices[2];
+				faceindex++;
+
+				for( ; j > 0; j--, ptricmds += 4)
+				{
+					indices[1] = indices[2];
+					indices[2] = ptricmds[0];
+
+					// Add the face
+					pfaces[faceindex].vertex0 = indices[0];
+					pfaces[faceindex].vertex1 = indices[1];
+					pfaces[faceindex].vertex2 = indices[2];
+					faceindex++;
+				}
+			}
+		}
+	}
+}
+
+//=============================================
+// @brief Builds the hash key shared by both
+// orientations of an edge
+//
+//=============================================
+static inline unsigned int SVD_EdgeKey( int v0, int v1 )
+{
+	// Studio vertex indexes are below MAXSTUDIOVERTS, so both fit in 16 bits
+	if (v0 > v1)
+		return ((unsigned int)v1 << 16) | (unsigned int)v0;
+	else
+		return ((unsigned int)v0 << 16) | (unsigned int)v1;
+}
+
+/*
+====================
+SVD_AddEdge
+
+====================
+*/
+static void SVD_AddEdge( svdedge_t* pedgebuffer, int* pnextedge, int* pnumedges, svdedgemap_t& edgemap, int face, int v0, int v1 )
+{
+	// first look for face's neighbour, only edges sharing both
+	// vertexes are chained under the key, oldest edge first
+	unsigned int key = SVD_EdgeKey(v0, v1);
+	svdedgemap_t::iterator it = edgemap.find(key);
+
+	int last = -1;
+	if (it != edgemap.end())
+	{
+		for (int i = it->second; i != -1; i = pnextedge[i])
+		{
+			if ((pedgebuffer[i].vertex0 == v1) && (pedgebuffer[i].vertex1 == v0) && (pedgebuffer[i].face1 == -1))
+			{
+				pedgebuffer[i].face1 = face;
+				return;
+			}
+
+			last = i;
+		}
+	}
+
+	// add new edge to list
+	int index = (*pnumedges);
+	svdedge_t* pnew = &pedgebuffer[index];
+	(*pnumedges)++;
+
+	pnew->face0 = face;
+	pnew->face1 = -1;
+	pnew->vertex0 = v0;
+	pnew->vertex1 = v1;
+
+	// Append to the chain so the match order is the same as a linear scan
+	pnextedge[index] = -1;
+	if (last != -1)
+		pnextedge[last] = index;
+	else
+		edgemap.emplace(key, index);
+}
+
+/*
+====================
+SVD_BuildEdges
+
+====================
+*/
+static void SVD_BuildEdges( svdbuild_t* pbuild, svdsubmodel_t* psubmodel )
+{
+	if(!psubmodel->numfaces)
+		return;
+
+	// Allocate a temporary buffer
+	int maxedges = psubmodel->numfaces*3;
+	svdedge_t* pedgebuffer = new svdedge_t[maxedges];
+	int* pnextedge = new int[maxedges];
+
+	svdedgemap_t edgemap;
+	edgemap.reserve(maxedges);
+
+	// Process each face
+	svdface_t* pfaces = (svdface_t *)(pbuild->pbuffer + psubmodel->faceindex);
+	for (int i = 0; i < psubmodel->numfaces; i++)
+	{
+		SVD_AddEdge(pedgebuffer, pnextedge, &psubmodel->numedges, edgemap, i, pfaces[i].vertex0, pfaces[i].vertex1);
+		SVD_AddEdge(pedgebuffer, pnextedge, &psubmodel->numedges, edgemap, i, pfaces[i].vertex1, pfaces[i].vertex2);
+		SVD_AddEdge(pedgebuffer, pnextedge, &psubmodel->numedges, edgemap, i, pfaces[i].vertex2, pfaces[i].vertex0);
+	}
+
+	// Allocate spot for edges
+	psubmodel->edgeindex = pbuild->offset;
+	pbuild->offset += sizeof(svdedge_t)*psubmodel->numedges;
+
+	// Copy over data
+	svdedge_t* poutedges = (svdedge_t *)(pbuild->pbuffer + psubmodel->edgeindex);
+	memcpy(poutedges, pedgebuffer, sizeof(svdedge_t)*psubmodel->numedges);
+
+	// Free edges
+	delete [] pnextedge;
+	delete [] pedgebuffer;
+}
+
+/*
+====================
+SVD_IndexShift
+
+====================
+*/
+static void SVD_IndexShift( svdbuild_t* pbuild, svdsubmodel_t* psubmodel )
+{
+	svdface_t* pfaces = (svdface_t *)(pbuild->pbuffer + psubmodel->faceindex);
+	for (int i = 0; i < psubmodel->numfaces; i++)
+	{
+		pfaces[i].vertex0 *= 2;
+		pfaces[i].vertex1 *= 2;
+		pfaces[i].vertex2 *= 2;
+	}
+
+	svdedge_t* pedges = (svdedge_t *)(pbuild->pbuffer + psubmodel->edgeindex);
+	for (int i = 0; i < psubmodel->numedges; i++)
+	{
+		pedges[i].vertex0 *= 2;
+		pedges[i].vertex1 *= 2;
+	}
+}
+
+/*
+====================
+SVD_SetVertexes
+
+====================
+*/
+static void SVD_SetVertexes( svdbuild_t* pbuild, svdsubmodel_t* psubmodel, const mstudiomodel_t* pstsubmodel, const studiohdr_t* phdr )
+{
+	// Get pointers to vertex data
+	Vector* pstudioverts = (Vector*)((byte*)phdr + pstsubmodel->vertindex);
+	byte* pvertbones = ((byte *)phdr + pstsubmodel->vertinfoindex);
+
+	// Allocate and copy vertex data
+	psubmodel->vertexindex = pbuild->offset;
+	psubmodel->numverts = pstsubmodel->numverts;
+
+	Vector* pdestverts = (Vector*)(pbuild->pbuffer + pbuild->offset);
+	pbuild->offset += sizeof(Vector) * psubmodel->numverts;
+
+	memcpy(pdestverts, pstudioverts, sizeof(Vector) * psubmodel->numverts);
+
+	// Allocate and copy vertex bone info
+	psubmodel->vertinfoindex = pbuild->offset;
+	byte* pdestvertbones = (pbuild->pbuffer + pbuild->offset);
+	pbuild->offset += sizeof(byte)*psubmodel->numverts;
+
+	memcpy(pdestvertbones, pvertbones, sizeof(byte)*psubmodel->numverts);
+}
+
+//=============================================
+// @brief Queues moving vertex0 onto vertex1, only
+// within a bone so animation can't tear the mesh
+//
+//=============================================
+static void SVD_QueueCollapse( svddecimate_t& mesh, int v0, int v1 )
+{
+	if (v0 == v1 || mesh.vertboundary[v0])
+		return;
+
+	if (mesh.pvertbones[v0] != mesh.pvertbones[v1])
+		return;
+
+	// Vertexes of one bone share a space, so distances are meaningful
+	Vector delta = mesh.pverts[v1] - mesh.pverts[v0];
+
+	svdcollapse_t collapse;
+	collapse.cost = DotProduct(delta, delta);
+	collapse.vertex0 = v0;
+	collapse.vertex1 = v1;
+	mesh.queue.push(collapse);
+}
+
+//=============================================
+// @brief Returns the face normal with vertex
+// 'from' replaced by vertex 'to'
+//
+//=============================================
+static Vector SVD_FaceNormal( const svddecimate_t& mesh, int face, int from, int to )
+{
+	Vector verts[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int vertex = mesh.faces[face*3+i];
+		verts[i] = mesh.pverts[vertex == from ? to : vertex];
+	}
+
+	return CrossProduct(verts[1] - verts[0], verts[2] - verts[0]);
+}
+
+//=============================================
+// @brief Gathers the vertexes that share a live
+// face with vertex, sorted
+//
+//=============================================
+static void SVD_VertexNeighbours( const svddecimate_t& mesh, int vertex, std::vector<int>& neighbours )
+{
+	neighbours.clear();
+	for (int face : mesh.vertfaces[vertex])
+	{
+		if (!mesh.facealive[face])
+			continue;
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (mesh.faces[face*3+i] != vertex)
+				neighbours.push_back(mesh.faces[face*3+i]);
+		}
+	}
+
+	std::sort(neighbours.begin(), neighbours.end());
+	neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+}
+
+//=============================================
+// @brief Link condition for collapsing the edge
+// v0-v1: the edge has two faces, and the only
+// vertexes next to both ends are the third
+// vertexes of those faces. Anything else would
+// fold the surface into edges of three or more
+// faces, or open it up
+//
+//=============================================
+static bool SVD_CollapseKeepsManifold( svddecimate_t& mesh, int v0, int v1 )
+{
+	int opposite[2];
+	int numshared = 0;
+	for (int face : mesh.vertfaces[v0])
+	{
+		if (!mesh.facealive[face])
+			continue;
+
+		const int* pface = &mesh.faces[face*3];
+		if (pface[0] != v1 && pface[1] != v1 && pface[2] != v1)
+			continue;
+
+		if (numshared == 2)
+			return false;
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (pface[i] != v0 && pface[i] != v1)
+				opposite[numshared] = pface[i];
+		}
+
+		numshared++;
+	}
+
+	if (numshared != 2 || opposite[0] == opposite[1])
+		return false;
+
+	std::vector<int>& neighbours0 = mesh.neighbours0;
+	std::vector<int>& neighbours1 = mesh.neighbours1;
+	SVD_VertexNeighbours(mesh, v0, neighbours0);
+	SVD_VertexNeighbours(mesh, v1, neighbours1);
+
+	int numcommon = 0;
+	int numunion = 0;
+	for (size_t i = 0, j = 0; i < neighbours0.size() || j < neighbours1.size(); numunion++)
+	{
+		if (j == neighbours1.size() || (i < neighbours0.size() && neighbours0[i] < neighbours1[j]))
+		{
+			i++;
+			continue;
+		}
+
+		if (i == neighbours0.size() || neighbours1[j] < neighbours0[i])
+		{
+			j++;
+			continue;
+		}
+
+		if (neighbours0[i] != opposite[0] && neighbours0[i] != opposite[1])
+			return false;
+
+		numcommon++;
+		i++;
+		j++;
+	}
+
+	// Both ends are in each other's lists, fewer than three others
+	// left means a tetrahedron flattening into a double sided sheet
+	return numcommon == 2 && numunion - 2 >= 3;
+}
+
+/*
+====================
+SVD_TryCollapse
+
+====================
+*/
+static bool SVD_TryCollapse( svddecimate_t& mesh, int v0, int v1 )
+{
+	if (!SVD_CollapseKeepsManifold(mesh, v0, v1))
+		return false;
+
+	for (int face : mesh.vertfaces[v0])
+	{
+		if (!mesh.facealive[face])
+			continue;
+
+		const int* pface = &mesh.faces[face*3];
+		if (pface[0] == v1 || pface[1] == v1 || pface[2] == v1)
+			continue;
+
+		// Faces spanning bones have no common space to test in
+		if (mesh.pvertbones[pface[0]] != mesh.pvertbones[pface[1]] || mesh.pvertbones[pface[0]] != mesh.pvertbones[pface[2]])
+			return false;
+
+		// Reject collapses that flip or squash a surviving face
+		Vector before = SVD_FaceNormal(mesh, face, v0, v0);
+		Vector after = SVD_FaceNormal(mesh, face, v0, v1);
+
+		if (DotProduct(before, after) <= 0 || DotProduct(after, after) < DotProduct(before, before) * 0.01f)
+			return false;
+	}
+
+	std::vector<int>& faces0 = mesh.vertfaces[v0];
+	std::vector<int>& faces1 = mesh.vertfaces[v1];
+
+	for (int face : faces0)
+	{
+		if (!mesh.facealive[face])
+			continue;
+
+		int* pface = &mesh.faces[face*3];
+		if (pface[0] == v1 || pface[1] == v1 || pface[2] == v1)
+		{
+			// Shared faces collapse to nothing
+			mesh.facealive[face] = false;
+			mesh.numalive--;
+			continue;
+		}
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (pface[i] == v0)
+				pface[i] = v1;
+		}
+
+		faces1.push_back(face);
+
+		// The face's other vertexes are new neighbours of v1
+		for (int i = 0; i < 3; i++)
+		{
+			SVD_QueueCollapse(mesh, pface[i], v1);
+			SVD_QueueCollapse(mesh, v1, pface[i]);
+		}
+	}
+
+	faces0.clear();
+	mesh.vertremoved[v0] = true;
+	return true;
+}
+
+/*
+====================
+SVD_InitDecimate
+
+====================
+*/
+static void SVD_InitDecimate( svddecimate_t& mesh, const Vector* pverts, const byte* pvertbones, int numverts, const svdface_t* pfaces, int numfaces )
+{
+	mesh.pverts = pverts;
+	mesh.pvertbones = pvertbones;
+	mesh.numalive = numfaces;
+
+	mesh.faces.resize(numfaces*3);
+	mesh.facealive.assign(numfaces, true);
+	mesh.vertfaces.assign(numverts, std::vector<int>());
+	mesh.vertremoved.assign(numverts, false);
+	mesh.vertboundary.assign(numverts, false);
+
+	// Count how many faces use each edge to find open ones
+	std::unordered_map<unsigned int, int>& edgeuses = mesh.sourceedgeuses;
+	edgeuses.clear();
+	for (int i = 0; i < numfaces; i++)
+	{
+		const int face[3] = { pfaces[i].vertex0, pfaces[i].vertex1, pfaces[i].vertex2 };
+
+		// Strips can carry degenerate faces, they add nothing to a volume
+		if (face[0] == face[1] || face[1] == face[2] || face[2] == face[0])
+		{
+			mesh.facealive[i] = false;
+			mesh.numalive--;
+		}
+
+		for (int j = 0; j < 3; j++)
+		{
+			mesh.faces[i*3+j] = face[j];
+			mesh.vertfaces[face[j]].push_back(i);
+			edgeuses[SVD_EdgeKey(face[j], face[(j+1)%3])]++;
+		}
+	}
+
+	for (int i = 0; i < numfaces; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int v0 = mesh.faces[i*3+j];
+			int v1 = mesh.faces[i*3+(j+1)%3];
+
+			if (edgeuses[SVD_EdgeKey(v0, v1)] != 2)
+			{
+				mesh.vertboundary[v0] = true;
+				mesh.vertboundary[v1] = true;
+			}
+		}
+	}
+
+	for (int i = 0; i < numfaces; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int v0 = mesh.faces[i*3+j];
+			int v1 = mesh.faces[i*3+(j+1)%3];
+
+			SVD_QueueCollapse(mesh, v0, v1);
+			SVD_QueueCollapse(mesh, v1, v0);
+		}
+	}
+}
+
+/*
+====================
+SVD_Decimate
+
+Collapses the shortest edges until the mesh is down to targetfaces,
+returns false if it can't get there
+====================
+*/
+static bool SVD_Decimate( svddecimate_t& mesh, int targetfaces )
+{
+	while (mesh.numalive > targetfaces && !mesh.queue.empty())
+	{
+		svdcollapse_t collapse = mesh.queue.top();
+		mesh.queue.pop();
+
+		if (mesh.vertremoved[collapse.vertex0] || mesh.vertremoved[collapse.vertex1])
+			continue;
+
+		SVD_TryCollapse(mesh, collapse.vertex0, collapse.vertex1);
+	}
+
+	return mesh.numalive <= targetfaces;
+}
+
+/*
+====================
+SVD_CheckManifold
+
+True if every edge of the mesh is shared by two faces running opposite
+ways, the way shadow volumes need it. Edges that were open or shared by
+more faces in the source mesh only have to keep their count, those are
+silhouettes in the full detail volume too
+====================
+*/
+static bool SVD_CheckManifold( const svddecimate_t& mesh )
+{
+	std::unordered_map<unsigned int, int> edgeuses;
+	std::unordered_map<unsigned int, int> edgedirections;
+
+	for (size_t i = 0; i < mesh.facealive.size(); i++)
+	{
+		if (!mesh.facealive[i])
+			continue;
+
+		for (int j = 0; j < 3; j++)
+		{
+			int v0 = mesh.faces[i*3+j];
+			int v1 = mesh.faces[i*3+(j+1)%3];
+			unsigned int key = SVD_EdgeKey(v0, v1);
+
+			edgeuses[key]++;
+			edgedirections[key] += v0 < v1 ? 1 : -1;
+		}
+	}
+
+	for (const auto& edge : edgeuses)
+	{
+		auto source = mesh.sourceedgeuses.find(edge.first);
+		if (source != mesh.sourceedgeuses.end() && source->second != 2)
+		{
+			if (edge.second != source->second)
+				return false;
+
+			continue;
+		}
+
+		if (edge.second != 2 || edgedirections[edge.first] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+====================
+SVD_ExtractLOD
+
+====================
+*/
+static void SVD_ExtractLOD( const svddecimate_t& mesh, svdlodmesh_t& lod )
+{
+	// Keep the used vertexes in their original order
+	std::vector<int> remap(mesh.vertfaces.size(), -1);
+	for (size_t i = 0; i < mesh.facealive.size(); i++)
+	{
+		if (!mesh.facealive[i])
+			continue;
+
+		for (int j = 0; j < 3; j++)
+			remap[mesh.faces[i*3+j]] = 0;
+	}
+
+	for (size_t i = 0; i < remap.size(); i++)
+	{
+		if (remap[i] == -1)
+			continue;
+
+		remap[i] = lod.verts.size();
+		lod.verts.push_back(mesh.pverts[i]);
+		lod.vertbones.push_back(mesh.pvertbones[i]);
+	}
+
+	for (size_t i = 0; i < mesh.facealive.size(); i++)
+	{
+		if (!mesh.facealive[i])
+			continue;
+
+		for (int j = 0; j < 3; j++)
+			lod.faces.push_back(remap[mesh.faces[i*3+j]]);
+	}
+}
+
+/*
+====================
+SVD_BuildLODs
+
+Must run before the submodel's indexes are shifted
+====================
+*/
+static void SVD_BuildLODs( svdbuild_t* pbuild, svdsubmodel_t* psubmodel )
+{
+	if (psubmodel->numfaces < SVD_LOD_MIN_FACES)
+		return;
+
+	Vector* pverts = (Vector*)(pbuild->pbuffer + psubmodel->vertexindex);
+	byte* pvertbones = (pbuild->pbuffer + psubmodel->vertinfoindex);
+	svdface_t* pfaces = (svdface_t *)(pbuild->pbuffer + psubmodel->faceindex);
+
+	svddecimate_t mesh;
+	SVD_InitDecimate(mesh, pverts, pvertbones, psubmodel->numverts, pfaces, psubmodel->numfaces);
+
+	// Each level carries on from the previous one
+	svdlodmesh_t lods[SVD_MAX_LODS];
+	int numlods = 0;
+	for (int i = 0; i < SVD_MAX_LODS; i++)
+	{
+		int previousfaces = mesh.numalive;
+		int targetfaces = (int)(previousfaces * SVD_LOD_RATIO);
+
+		SVD_Decimate(mesh, targetfaces);
+
+		// Not worth a level if it barely got any smaller
+		if (mesh.numalive > previousfaces * 0.8f)
+			break;
+
+		// A volume with holes leaks, stay at the previous level
+		if (!SVD_CheckManifold(mesh))
+			break;
+
+		SVD_ExtractLOD(mesh, lods[numlods]);
+		numlods++;
+	}
+
+	if (!numlods)
+		return;
+
+	psubmodel->lodindex = pbuild->offset;
+	psubmodel->numlods = numlods;
+	pbuild->offset += sizeof(svdsubmodel_t)*numlods;
+
+	for (int i = 0; i < numlods; i++)
+	{
+		// The buffer doesn't move, but keep no pointers across writes anyway
+		svdsubmodel_t* plod = (svdsubmodel_t *)(pbuild->pbuffer + psubmodel->lodindex) + i;
+		svdlodmesh_t& lod = lods[i];
+
+		plod->numverts = lod.verts.size();
+		plod->vertexindex = pbuild->offset;
+		memcpy(pbuild->pbuffer + pbuild->offset, lod.verts.data(), sizeof(Vector)*plod->numverts);
+		pbuild->offset += sizeof(Vector)*plod->numverts;
+
+		plod->vertinfoindex = pbuild->offset;
+		memcpy(pbuild->pbuffer + pbuild->offset, lod.vertbones.data(), sizeof(byte)*plod->numverts);
+		pbuild->offset += sizeof(byte)*plod->numverts;
+
+		plod->numfaces = lod.faces.size() / 3;
+		plod->faceindex = pbuild->offset;
+		pbuild->offset += sizeof(svdface_t)*plod->numfaces;
+
+		svdface_t* plodfaces = (svdface_t *)(pbuild->pbuffer + plod->faceindex);
+		for (int j = 0; j < plod->numfaces; j++)
+		{
+			plodfaces[j].vertex0 = lod.faces[j*3];
+			plodfaces[j].vertex1 = lod.faces[j*3+1];
+			plodfaces[j].vertex2 = lod.faces[j*3+2];
+		}
+
+		SVD_BuildEdges(pbuild, plod);
+		SVD_IndexShift(pbuild, plod);
+	}
+}
+
+/*
+====================
+SVD_BuildModel
+
+====================
+*/
+svdheader_t* SVD_BuildModel( const studiohdr_t* phdr, const char* modelname, int* psize )
+{
+	// Fail if no bodyparts
+	if (phdr->numbodyparts == 0)
+		return nullptr;
+
+	// Allocate the buffer, sized for this model so it can be handed out as is
+	int buffersize = SVD_GetBufferSize(phdr);
+
+	svdbuild_t build;
+	build.offset = 0;
+	build.pbuffer = new byte[buffersize];
+	memset(build.pbuffer, 0, sizeof(byte)*buffersize);
+
+	// Get header
+	svdheader_t* pheader = (svdheader_t *)build.pbuffer;
+	build.offset += sizeof(svdheader_t);
+
+	// Set basics
+	strncpy(pheader->modelname, modelname, sizeof(pheader->modelname) - 1);
+	pheader->mdl_size = phdr->length;
+	pheader->version = SVD_VERSION;
+
+	// Allocate submodels
+	svdbodypart_t *pbodyparts = (svdbodypart_t *)(build.pbuffer + build.offset);
+	pheader->bodypartindex = build.offset;
+	pheader->numbodyparts = phdr->numbodyparts;
+	build.offset += sizeof(svdbodypart_t)*phdr->numbodyparts;
+
+	// convert strips and fans to triangles, generate adjacency info
+	for (int i = 0; i < phdr->numbodyparts; i++)
+	{
+		mstudiobodyparts_t* pstbodypart = (mstudiobodyparts_t *)((byte *)phdr + phdr->bodypartindex) + i;
+
+		// Set bodypart info
+		pbodyparts[i].submodelindex = build.offset;
+		pbodyparts[i].numsubmodels = pstbodypart->nummodels;
+		pbodyparts[i].base = pstbodypart->base;
+
+		// Allocate submodel data
+		svdsubmodel_t *psubmodels = (svdsubmodel_t *)(build.pbuffer + build.offset);
+		build.offset += sizeof(svdsubmodel_t)*pstbodypart->nummodels;
+
+		for (int j = 0; j < pstbodypart->nummodels; j++)
+		{
+			mstudiomodel_t *pstsubmodel = (mstudiomodel_t *)((byte *)phdr + pstbodypart->modelindex) + j;
+
+			SVD_SetVertexes(&build, &psubmodels[j], pstsubmodel, phdr);
+			SVD_BuildFaces(&build, &psubmodels[j], pstsubmodel, phdr);
+			SVD_BuildEdges(&build, &psubmodels[j]);
+			SVD_BuildLODs(&build, &psubmodels[j]);
+			SVD_IndexShift(&build, &psubmodels[j]);
+
+			pheader->num_faces += psubmodels[j].numfaces;
+			pheader->num_edges += psubmodels[j].numedges;
+		}
+	}
+
+	if (psize)
+		*psize = build.offset;
+
+	return pheader;
+}
@@ -31,355 +31,435 @@
 #include "lightlist.h"
 #include "svdformat.h"
 
-// Temporary buffer size for SVDs
-#define SVD_TEMP_BUFFER_SIZE 1024*1024*4
-
-// Pointers used for data construction
-int				g_iSVDDataOffset;
-byte*			g_pSVDBufferData;
-svdheader_t*	g_pSVDHeader;
+#include "PlatformHeaders.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Svd data owned by the client, pack data is never listed here
+struct svdfile_t
+{
+	svdheader_t* pheader;
+	// Buffer came from COM_LoadFile, otherwise it was built with new[]
+	bool enginefile;
+};
 
 // Structure holding pointers to svd data
-svdheader_t*	g_pSVDHeaders[MAX_SVD_FILES];
+svdfile_t		g_SVDFiles[MAX_SVD_FILES];
 int				g_iNumSVDFiles;
 
-// Boolean to signal that we need to load svds
-bool			g_bNeedLoadSVD;
+// Read-only mapping of SVD_PACK_FILENAME
+const byte*		g_pSVDPackData;
+int				g_iSVDPackSize;
+bool			g_bSVDPackChecked;
+#ifdef WIN32
+HANDLE			g_hSVDPackFile = INVALID_HANDLE_VALUE;
+HANDLE			g_hSVDPackMapping;
+#endif
+
+enum svdstate_t
+{
+	SVD_STATE_READY = 0,
+	SVD_STATE_PENDING,
+	SVD_STATE_FAILED
+};
+
+// Models svd data was asked for since the last SVD_Clear
+std::unordered_map<model_t*, svdstate_t> g_SVDModelStates;
+
+// Incremented by SVD_Clear so builds from the previous map get thrown away
+int				g_iSVDGeneration;
+
+// A model waiting on, or done with, the build thread
+struct svdbuildjob_t
+{
+	model_t* pmodel;
+	int generation;
+
+	// Private copy of the studio model, the engine cache may move it
+	byte* pstudiodata;
+	char modelname[MAX_MODEL_NAME];
+	char outpath[_MAX_PATH];
+
+	// Built data, NULL if building failed
+	svdheader_t* pheader;
+};
+
+struct svdbuildthread_t
+{
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool quittingtime = false;
+
+	std::deque<svdbuildjob_t*> jobs;
+	std::vector<svdbuildjob_t*> finished;
+};
+
+svdbuildthread_t g_SVDBuildThread;
 
 extern engine_studio_api_t IEngineStudio;
 
 /*
 ====================
-SVD_BuildFaces
+SVD_FreeBuildJob
 
 ====================
 */
-void SVD_BuildFaces( svdsubmodel_t* psubmodel, mstudiomodel_t* pstudiosubmodel, studiohdr_t* phdr )
+void SVD_FreeBuildJob( svdbuildjob_t* pjob )
 {
-	// get number of triangles in all meshes
-	mstudiomesh_t *pmeshes = (mstudiomesh_t *)((byte *)phdr + pstudiosubmodel->meshindex);
-	for (int i = 0; i < pstudiosubmodel->nummesh; i++) 
+	delete [] pjob->pstudiodata;
+	delete [] (byte*)pjob->pheader;
+	delete pjob;
+}
+
+/*
+====================
+SVD_BuildThreadFunction
+
+Builds svds queued by SVD_GetModelSVD and writes them
+to the disk, only touches data owned by the job
+====================
+*/
+void SVD_BuildThreadFunction( void )
+{
+	while(true)
 	{
-		int j;
-		short *ptricmds = (short *)((byte *)phdr + pmeshes[i].triindex);		
-		while (j = *(ptricmds++))
+		svdbuildjob_t* pjob;
 		{
-			if (j < 0) 
-				j *= -1;
+			std::unique_lock lock{g_SVDBuildThread.mutex};
+			g_SVDBuildThread.condition.wait(lock, []()
+				{ return g_SVDBuildThread.quittingtime || !g_SVDBuildThread.jobs.empty(); });
 
-			psubmodel->numfaces += (j - 2);
-			ptricmds += 4 * j;
-		}
-	}
+			if(g_SVDBuildThread.quittingtime)
+				break;
 
-	// No faces in this submodel
-	if (psubmodel->numfaces == 0)  
-		return;
+			pjob = g_SVDBuildThread.jobs.front();
+			g_SVDBuildThread.jobs.pop_front();
+		}
 
-	// Allocate spot for face data
-	psubmodel->faceindex = g_iSVDDataOffset;
-	g_iSVDDataOffset += sizeof(svdface_t)*psubmodel->numfaces;
+		int dataSize = 0;
+		pjob->pheader = SVD_BuildModel((studiohdr_t*)pjob->pstudiodata, pjob->modelname, &dataSize);
 
-	// Copy over data
-	int faceindex = 0;
-	svdface_t* pfaces = (svdface_t *)((byte *)(svdheader_t *)g_pSVDHeader + psubmodel->faceindex);
+		delete [] pjob->pstudiodata;
+		pjob->pstudiodata = NULL;
 
-	for (int i = 0; i < pstudiosubmodel->nummesh; i++) 
-	{
-		short *ptricmds = (short *)((byte *)phdr + pmeshes[i].triindex);
-
-		int j;
-		while (j = *(ptricmds++))
-		{	
-			if (j > 0) 
-			{
-				// convert triangle strip
-				j -= 3;
-
-				short indices[3];
-				indices[0] = ptricmds[0]; ptricmds += 4;
-				indices[1] = ptricmds[0]; ptricmds += 4;
-				indices[2] = ptricmds[0]; ptricmds += 4;
-				
-				// Add the face
-				pfaces[faceindex].vertex0 = indices[0];
-				pfaces[faceindex].vertex1 = indices[1];
-				pfaces[faceindex].vertex2 = indices[2];
-				faceindex++;
-
-				bool reverse = false;
-				for( ; j > 0; j--, ptricmds += 4)
-				{
-					indices[0] = indices[1];
-					indices[1] = indices[2];
-					indices[2] = ptricmds[0];
-
-					// Add the face
-					if (!reverse)
-					{
-						pfaces[faceindex].vertex0 = indices[2];
-						pfaces[faceindex].vertex1 = indices[1];
-						pfaces[faceindex].vertex2 = indices[0];
-						faceindex++;
-					}
-					else
-					{
-						pfaces[faceindex].vertex0 = indices[0];
-						pfaces[faceindex].vertex1 = indices[1];
-						pfaces[faceindex].vertex2 = indices[2];
-						faceindex++;
-					}
-
-					// Switch the order
-					reverse = !reverse;
-				}
-			}
-			else
+		// Save the data to the disk
+		if(pjob->pheader)
+		{
+			FILE *pFile = fopen(pjob->outpath, "wb");
+			if(pFile)
 			{
-				// convert triangle fan
-				j = -j - 3;
-
-				short indices[3];
-				indices[0] = ptricmds[0]; ptricmds += 4;
-				indices[1] = ptricmds[0]; ptricmds += 4;
-				indices[2] = ptricmds[0]; ptricmds += 4;
-
-				// Add the face
-				pfaces[faceindex].vertex0 = indices[0];
-				pfaces[faceindex].vertex1 = indices[1];
-				pfaces[faceindex].vertex2 = indices[2];
-				faceindex++;
-
-				for( ; j > 0; j--, ptricmds += 4)
-				{
-					indices[1] = indices[2];
-					indices[2] = ptricmds[0];
-
-					// Add the face
-					pfaces[faceindex].vertex0 = indices[0];
-					pfaces[faceindex].vertex1 = indices[1];
-					pfaces[faceindex].vertex2 = indices[2];
-					faceindex++;
-				}
+				fwrite(pjob->pheader, sizeof(byte)*dataSize, 1, pFile);
+				fclose(pFile);
 			}
 		}
+
+		std::lock_guard guard{g_SVDBuildThread.mutex};
+		g_SVDBuildThread.finished.push_back(pjob);
 	}
 }
 
 /*
 ====================
-SVD_BuildEdges
+SVD_QueueBuild
 
 ====================
 */
-void SVD_BuildEdges( svdsubmodel_t* psubmodel )
+bool SVD_QueueBuild( model_t* pmodel, const char* filename )
 {
-	if(!psubmodel->numfaces)
-		return;
+	studiohdr_t *pstudiohdr = (studiohdr_t *)IEngineStudio.Mod_Extradata(pmodel);
 
-	// Allocate a temporary buffer
-	svdedge_t* pedgebuffer = new svdedge_t[psubmodel->numfaces*3];
-	memset(pedgebuffer, 0, sizeof(svdedge_t)*psubmodel->numfaces*3);
-	
-	// Process each face
-	svdface_t* pfaces = (svdface_t *)((byte *)(svdheader_t *)g_pSVDHeader + psubmodel->faceindex);
-	for (int i = 0; i < psubmodel->numfaces; i++)
+	// Fail if no bodyparts
+	if (!pstudiohdr || pstudiohdr->numbodyparts == 0)
 	{
-		SVD_AddEdge(pedgebuffer, &psubmodel->numedges, i, pfaces[i].vertex0, pfaces[i].vertex1);
-		SVD_AddEdge(pedgebuffer, &psubmodel->numedges, i, pfaces[i].vertex1, pfaces[i].vertex2);
-		SVD_AddEdge(pedgebuffer, &psubmodel->numedges, i, pfaces[i].vertex2, pfaces[i].vertex0);
+		gEngfuncs.Con_Printf("Error: model %s has 0 submodels\n", pmodel->name);
+		return false;
 	}
 
-	// Allocate spot for edges
-	psubmodel->edgeindex = g_iSVDDataOffset;
-	g_iSVDDataOffset += sizeof(svdedge_t)*psubmodel->numedges;
+	svdbuildjob_t* pjob = new svdbuildjob_t;
+	pjob->pmodel = pmodel;
+	pjob->generation = g_iSVDGeneration;
+	pjob->pheader = NULL;
+
+	pjob->pstudiodata = new byte[pstudiohdr->length];
+	memcpy(pjob->pstudiodata, pstudiohdr, pstudiohdr->length);
 
-	// Copy over data
-	svdedge_t* poutedges = (svdedge_t *)((byte *)(svdheader_t *)g_pSVDHeader + psubmodel->edgeindex);
-	memcpy(poutedges, pedgebuffer, sizeof(svdedge_t)*psubmodel->numedges);
+	strcpy(pjob->modelname, pmodel->name);
+	sprintf(pjob->outpath, "%s/%s", gEngfuncs.pfnGetGameDirectory(), filename);
+
+	if(!g_SVDBuildThread.thread.joinable())
+	{
+		g_SVDBuildThread.quittingtime = false;
+		g_SVDBuildThread.thread = std::thread{&SVD_BuildThreadFunction};
+	}
+
+	{
+		std::lock_guard guard{g_SVDBuildThread.mutex};
+		g_SVDBuildThread.jobs.push_back(pjob);
+	}
 
-	// Free edges
-	delete [] pedgebuffer;
+	g_SVDBuildThread.condition.notify_one();
+	return true;
 }
 
 /*
 ====================
-SVD_AddEdge
+SVD_StopBuildThread
 
 ====================
 */
-void SVD_AddEdge( svdedge_t* pedgebuffer, int* pnumedges, int face, int v0, int v1 )
+void SVD_StopBuildThread( void )
 {
-	// first look for face's neighbour
-	for (int i = 0; i < (*pnumedges); i++)
+	if(!g_SVDBuildThread.thread.joinable())
+		return;
+
 	{
-		if ((pedgebuffer[i].vertex0 == v1) && (pedgebuffer[i].vertex1 == v0) && (pedgebuffer[i].face1 == -1))
-		{
-			pedgebuffer[i].face1 = face;
-			return;
-		}
+		std::lock_guard guard{g_SVDBuildThread.mutex};
+		g_SVDBuildThread.quittingtime = true;
 	}
 
-	// add new edge to list
-	svdedge_t* pnew = &pedgebuffer[(*pnumedges)];
-	(*pnumedges)++;
-
-	pnew->face0 = face;
-	pnew->face1 = -1;
-	pnew->vertex0 = v0;
-	pnew->vertex1 = v1;
+	g_SVDBuildThread.condition.notify_one();
+	g_SVDBuildThread.thread.join();
 }
 
 /*
 ====================
-SVD_IndexShift
+SVD_CollectBuilds
 
+Hands finished builds to their models, main thread only
 ====================
 */
-void SVD_IndexShift( svdsubmodel_t* psubmodel )
+void SVD_CollectBuilds( void )
 {
-	svdface_t* pfaces = (svdface_t *)((byte *)g_pSVDHeader + psubmodel->faceindex);
-	for (int i = 0; i < psubmodel->numfaces; i++)
+	std::vector<svdbuildjob_t*> finished;
 	{
-		pfaces[i].vertex0 *= 2;
-		pfaces[i].vertex1 *= 2;
-		pfaces[i].vertex2 *= 2;
+		std::lock_guard guard{g_SVDBuildThread.mutex};
+		finished.swap(g_SVDBuildThread.finished);
 	}
 
-	svdedge_t* pedges = (svdedge_t *)((byte *)g_pSVDHeader + psubmodel->edgeindex);
-	for (int i = 0; i < psubmodel->numedges; i++)
+	for(svdbuildjob_t* pjob : finished)
 	{
-		pedges[i].vertex0 *= 2;
-		pedges[i].vertex1 *= 2;
+		// Queued before the last SVD_Clear
+		if(pjob->generation != g_iSVDGeneration)
+		{
+			SVD_FreeBuildJob(pjob);
+			continue;
+		}
+
+		if(!pjob->pheader || g_iNumSVDFiles == MAX_SVD_FILES)
+		{
+			gEngfuncs.Con_Printf("Failed to set SVD data for %s\n", pjob->pmodel->name);
+			g_SVDModelStates[pjob->pmodel] = SVD_STATE_FAILED;
+			SVD_FreeBuildJob(pjob);
+			continue;
+		}
+
+		g_SVDFiles[g_iNumSVDFiles].pheader = pjob->pheader;
+		g_SVDFiles[g_iNumSVDFiles].enginefile = false;
+		g_iNumSVDFiles++;
+
+		pjob->pmodel->visdata = (byte*)pjob->pheader;
+		g_SVDModelStates[pjob->pmodel] = SVD_STATE_READY;
+
+		pjob->pheader = NULL;
+		SVD_FreeBuildJob(pjob);
 	}
 }
 
 /*
 ====================
-SVD_SetVertexes
+SVD_OpenPack
 
 ====================
 */
-void SVD_SetVertexes( svdsubmodel_t* psubmodel, mstudiomodel_t* pstsubmodel, studiohdr_t* phdr )
+void SVD_OpenPack( void )
 {
-	// Get pointers to vertex data
-	Vector* pstudioverts = (Vector*)((byte*)phdr + pstsubmodel->vertindex);
-	byte* pvertbones = (byte *)((byte *)phdr + pstsubmodel->vertinfoindex);
+	if(g_bSVDPackChecked)
+		return;
+
+	g_bSVDPackChecked = true;
 
-	// Allocate and copy vertex data
-	psubmodel->vertexindex = g_iSVDDataOffset;
-	psubmodel->numverts = pstsubmodel->numverts;
+	char packPath[_MAX_PATH];
+	sprintf(packPath, "%s/%s", gEngfuncs.pfnGetGameDirectory(), SVD_PACK_FILENAME);
+
+	const byte* pdata = NULL;
+	int size = 0;
+
+#ifdef WIN32
+	g_hSVDPackFile = CreateFileA(packPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(g_hSVDPackFile == INVALID_HANDLE_VALUE)
+		return;
+
+	size = (int)GetFileSize(g_hSVDPackFile, NULL);
+	g_hSVDPackMapping = CreateFileMappingA(g_hSVDPackFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(g_hSVDPackMapping)
+		pdata = (const byte*)MapViewOfFile(g_hSVDPackMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = open(packPath, O_RDONLY);
+	if(fd == -1)
+		return;
+
+	struct stat st;
+	if(fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		size = (int)st.st_size;
+		void* pmap = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if(pmap != MAP_FAILED)
+			pdata = (const byte*)pmap;
+	}
 
-	Vector* pdestverts = (Vector*)((byte*)g_pSVDBufferData + g_iSVDDataOffset);
-	g_iSVDDataOffset += sizeof(Vector) * psubmodel->numverts;
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+#endif
 
-	memcpy(pdestverts, pstudioverts, sizeof(Vector) * psubmodel->numverts);
+	g_pSVDPackData = pdata;
+	g_iSVDPackSize = size;
 
-	// Allocate and copy vertex bone info
-	psubmodel->vertinfoindex = g_iSVDDataOffset;
-	byte* pdestvertbones = ((byte *)g_pSVDBufferData + g_iSVDDataOffset);
-	g_iSVDDataOffset += sizeof(byte)*psubmodel->numverts;
+	if(!g_pSVDPackData)
+	{
+		gEngfuncs.Con_Printf("Failed to map %s\n", packPath);
+		SVD_ClosePack();
+		return;
+	}
 
-	memcpy(pdestvertbones, pvertbones, sizeof(byte)*psubmodel->numverts);
+	const svdpackheader_t* pheader = (const svdpackheader_t*)g_pSVDPackData;
+	if(g_iSVDPackSize < (int)sizeof(svdpackheader_t)
+		|| pheader->ident != SVD_PACK_IDENT
+		|| pheader->version != SVD_PACK_VERSION
+		|| pheader->entryindex < (int)sizeof(svdpackheader_t)
+		|| pheader->numentries < 0
+		|| pheader->entryindex + pheader->numentries * (int)sizeof(svdpackentry_t) > g_iSVDPackSize)
+	{
+		gEngfuncs.Con_Printf("%s is not a valid svd pack\n", packPath);
+		SVD_ClosePack();
+		return;
+	}
 }
 
 /*
 ====================
-SVD_SetupModel
+SVD_ClosePack
 
 ====================
 */
-svdheader_t* SVD_Create( char* filename, model_t* pmodel )
+void SVD_ClosePack( void )
 {
-	studiohdr_t *pstudiohdr = (studiohdr_t *)IEngineStudio.Mod_Extradata(pmodel);
+#ifdef WIN32
+	if(g_pSVDPackData)
+		UnmapViewOfFile(g_pSVDPackData);
 
-	// Fail if no bodyparts
-	if (pstudiohdr->numbodyparts == 0)
+	if(g_hSVDPackMapping)
 	{
-		gEngfuncs.Con_Printf("Error: model %s has 0 submodels\n", pmodel->name);
-		return nullptr;
+		CloseHandle(g_hSVDPackMapping);
+		g_hSVDPackMapping = NULL;
 	}
-	
-	// Allocate the buffer
-	g_iSVDDataOffset = 0;
-	g_pSVDBufferData = new byte[SVD_TEMP_BUFFER_SIZE];
-	memset(g_pSVDBufferData, 0, sizeof(byte)*SVD_TEMP_BUFFER_SIZE);
-
-	// Get header
-	g_pSVDHeader = (svdheader_t *)g_pSVDBufferData;
-	g_iSVDDataOffset += sizeof(svdheader_t);
-
-	// Set basics
-	strcpy(g_pSVDHeader->modelname, pmodel->name);
-	g_pSVDHeader->mdl_size = pstudiohdr->length;
-	g_pSVDHeader->version = SVD_VERSION;
-
-	// Allocate submodels
-	svdbodypart_t *pbodyparts = (svdbodypart_t *)(g_pSVDBufferData + g_iSVDDataOffset);
-	g_pSVDHeader->bodypartindex = g_iSVDDataOffset;
-	g_pSVDHeader->numbodyparts = pstudiohdr->numbodyparts;
-	g_iSVDDataOffset += sizeof(svdbodypart_t)*pstudiohdr->numbodyparts;
-
-	// convert strips and fans to triangles, generate adjacency info
-	for (int i = 0; i < pstudiohdr->numbodyparts; i++)
+
+	if(g_hSVDPackFile != INVALID_HANDLE_VALUE)
 	{
-		mstudiobodyparts_t* pstbodypart = (mstudiobodyparts_t *)((byte *)pstudiohdr + pstudiohdr->bodypartindex) + i;
+		CloseHandle(g_hSVDPackFile);
+		g_hSVDPackFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if(g_pSVDPackData)
+		munmap((void*)g_pSVDPackData, g_iSVDPackSize);
+#endif
 
-		// Set bodypart info
-		pbodyparts[i].submodelindex = g_iSVDDataOffset;
-		pbodyparts[i].numsubmodels = pstbodypart->nummodels;
-		pbodyparts[i].base = pstbodypart->base;
+	g_pSVDPackData = NULL;
+	g_iSVDPackSize = 0;
+}
 
-		// Allocate submodel data
-		svdsubmodel_t *psubmodels = (svdsubmodel_t *)(g_pSVDBufferData + g_iSVDDataOffset);
-		g_iSVDDataOffset += sizeof(svdsubmodel_t)*pstbodypart->nummodels;
+/*
+====================
+SVD_FindPackedSVD
 
-		for (int j = 0; j < pstbodypart->nummodels; j++)
-		{
-			mstudiomodel_t *pstsubmodel = (mstudiomodel_t *)((byte *)pstudiohdr + pstbodypart->modelindex) + j;
-			
-			SVD_SetVertexes(&psubmodels[j], pstsubmodel, pstudiohdr);
-			SVD_BuildFaces(&psubmodels[j], pstsubmodel, pstudiohdr);
-			SVD_BuildEdges(&psubmodels[j]);
-			SVD_IndexShift(&psubmodels[j]);
-			
-			g_pSVDHeader->num_faces += psubmodels[j].numfaces;
-			g_pSVDHeader->num_edges += psubmodels[j].numedges;
-		}
-	}
+====================
+*/
+svdheader_t* SVD_FindPackedSVD( const char* modelname )
+{
+	if(!g_pSVDPackData)
+		return NULL;
 
-	// Save the data to the disk
-	char outPath[_MAX_PATH];
-	sprintf(outPath, "%s/%s", gEngfuncs.pfnGetGameDirectory(), filename);
+	const svdpackheader_t* pheader = (const svdpackheader_t*)g_pSVDPackData;
+	const svdpackentry_t* pentries = (const svdpackentry_t*)(g_pSVDPackData + pheader->entryindex);
 
-	FILE *pFile = fopen(outPath, "wb");
-	if(!pFile)
+	// svdgen writes the names lowercase, the engine keeps whatever case the model was asked for in
+	char name[sizeof(pentries->modelname)];
+	if(strlen(modelname) >= sizeof(name))
 		return NULL;
 
-	fwrite(g_pSVDBufferData, sizeof(byte)*g_iSVDDataOffset, 1, pFile);
-	fclose(pFile);
+	strcpy(name, modelname);
+	for(char* pstr = name; *pstr; pstr++)
+		*pstr = tolower(*pstr);
 
-	// Allocate the return data
-	byte* pbuffer = new byte[g_iSVDDataOffset];
-	memcpy(pbuffer, g_pSVDBufferData, sizeof(byte)*g_iSVDDataOffset);
+	// Binary search, svdgen writes the entries sorted
+	int low = 0;
+	int high = pheader->numentries - 1;
+	while(low <= high)
+	{
+		int mid = (low + high) / 2;
+		int cmp = strcmp(name, pentries[mid].modelname);
 
-	// Free temp buffer
-	delete [] g_pSVDBufferData;
-	g_pSVDBufferData = NULL;
+		if(cmp < 0)
+		{
+			high = mid - 1;
+		}
+		else if(cmp > 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			const svdpackentry_t* pentry = &pentries[mid];
+			if(pentry->dataindex < 0 || pentry->datasize < (int)sizeof(svdheader_t)
+				|| pentry->dataindex + pentry->datasize > g_iSVDPackSize)
+				return NULL;
 
-	return (svdheader_t*)pbuffer;
+			// The engine wants a non-const pointer in model_t, the data is never written
+			return (svdheader_t*)(g_pSVDPackData + pentry->dataindex);
+		}
+	}
+
+	return NULL;
 }
 
 /*
 ====================
-SVD_SetupModel
+SVD_LoadSVDForModel
 
+Resolves the model from the pack or a loose file,
+and queues a build if neither is usable
 ====================
 */
-bool SVD_LoadSVDForModel( model_t* pmodel )
+svdstate_t SVD_LoadSVDForModel( model_t* pmodel )
 {
+	studiohdr_t* pstudiohdr = (studiohdr_t *)IEngineStudio.Mod_Extradata( pmodel );
+	if(!pstudiohdr)
+		return SVD_STATE_FAILED;
+
+	// Look in the pack first, the header points straight into the mapping
+	svdheader_t* ppackheader = SVD_FindPackedSVD(pmodel->name);
+	if(ppackheader && ppackheader->version == SVD_VERSION
+		&& ppackheader->mdl_size == pstudiohdr->length
+		&& !stricmp(ppackheader->modelname, pmodel->name))
+	{
+		pmodel->visdata = (byte*)ppackheader;
+		return SVD_STATE_READY;
+	}
+
 	if(g_iNumSVDFiles == MAX_SVD_FILES)
-		return false;
+		return SVD_STATE_FAILED;
 
 	// Try and load the model from the disk
 	char outName[_MAX_PATH];
@@ -389,73 +469,74 @@ bool SVD_LoadSVDForModel( model_t* pmodel )
 	int fileSize = 0;
 	byte* pFile = gEngfuncs.COM_LoadFile(outName, 5, &fileSize);
 
-	// Pointer to svd header
-	svdheader_t* psvdheader = NULL;
-
 	// File was found, verify that sizes match
 	if(pFile)
 	{
 		svdheader_t *pfileheader = (svdheader_t *)pFile;
-		studiohdr_t* pstudiohdr = (studiohdr_t *)IEngineStudio.Mod_Extradata( pmodel );
 
-		if(pfileheader->version == SVD_VERSION
+		if(fileSize >= (int)sizeof(svdheader_t)
+			&& pfileheader->version == SVD_VERSION
 			&& pfileheader->mdl_size == pstudiohdr->length
 			&& !strcmp(pfileheader->modelname, pmodel->name))
 		{
-			// Allocate new buffer
-			byte* pbuffer = new byte[fileSize];
-			memcpy(pbuffer, pFile, fileSize);
-			
-			// Set the pointer
-			psvdheader = (svdheader_t*)pbuffer;
+			// Keep the engine's buffer, it's freed in SVD_Clear
+			g_SVDFiles[g_iNumSVDFiles].pheader = pfileheader;
+			g_SVDFiles[g_iNumSVDFiles].enginefile = true;
+			g_iNumSVDFiles++;
+
+			pmodel->visdata = (byte*)pfileheader;
+			return SVD_STATE_READY;
 		}
 
 		gEngfuncs.COM_FreeFile(pFile);
 	}
 
 	// Failed for some reason, so create
-	if(!psvdheader)
-		psvdheader = SVD_Create(outName, pmodel);
-
-	// Total failure
-	if(!psvdheader)
-		return false;
+	if(!SVD_QueueBuild(pmodel, outName))
+		return SVD_STATE_FAILED;
 
-	// Add it to the array
-	g_pSVDHeaders[g_iNumSVDFiles] = psvdheader;
-	g_iNumSVDFiles++;
-
-	// Set pointer in model
-	pmodel->visdata = (byte*)psvdheader;
-	return true;
+	return SVD_STATE_PENDING;
 }
 
 /*
 ====================
-SVD_CheckInit
+SVD_GetModelSVD
 
 ====================
 */
-void SVD_CheckInit( void )
+svdheader_t* SVD_GetModelSVD( model_t* pmodel )
 {
-	if(!g_bNeedLoadSVD)
-		return;
-
-	model_t* pmodel = NULL;
-	for(int i = 0; i < MAX_SVD_FILES; i++)
+	auto it = g_SVDModelStates.find(pmodel);
+	if(it != g_SVDModelStates.end())
 	{
-		pmodel = IEngineStudio.GetModelByIndex(i+1);
-		if(!pmodel)
-			break;
+		if(it->second != SVD_STATE_READY)
+			return NULL;
 
-		if(pmodel->type != mod_studio)
-			continue;
-
-		if(!SVD_LoadSVDForModel(pmodel))
-			gEngfuncs.Con_Printf("Failed to set SVD data for %s\n", pmodel->name);
+		return (svdheader_t*)pmodel->visdata;
 	}
 
-	g_bNeedLoadSVD = false;
+	svdstate_t state = SVD_LoadSVDForModel(pmodel);
+	g_SVDModelStates[pmodel] = state;
+
+	if(state == SVD_STATE_FAILED)
+		gEngfuncs.Con_Printf("Failed to set SVD data for %s\n", pmodel->name);
+
+	if(state != SVD_STATE_READY)
+		return NULL;
+
+	return (svdheader_t*)pmodel->visdata;
+}
+
+/*
+====================
+SVD_CheckInit
+
+====================
+*/
+void SVD_CheckInit( void )
+{
+	SVD_OpenPack();
+	SVD_CollectBuilds();
 }
 
 /*
@@ -468,12 +549,37 @@ void SVD_Clear( void )
 {
 	for(int i = 0; i < g_iNumSVDFiles; i++)
 	{
-		delete g_pSVDHeaders[i];
-		g_pSVDHeaders[i] = NULL;
+		if(g_SVDFiles[i].enginefile)
+			gEngfuncs.COM_FreeFile(g_SVDFiles[i].pheader);
+		else
+			delete [] (byte*)g_SVDFiles[i].pheader;
+
+		g_SVDFiles[i].pheader = NULL;
 	}
 
-	g_iNumSVDFiles = NULL;
+	g_iNumSVDFiles = 0;
+
+	// Models keep their model_t across maps, so don't leave them pointing at freed data
+	for(auto& it : g_SVDModelStates)
+	{
+		if(it.second == SVD_STATE_READY)
+			it.first->visdata = NULL;
+	}
+
+	g_SVDModelStates.clear();
+
+	// Drop builds that haven't started, running ones are thrown away when collected
+	{
+		std::lock_guard guard{g_SVDBuildThread.mutex};
+		for(svdbuildjob_t* pjob : g_SVDBuildThread.jobs)
+			SVD_FreeBuildJob(pjob);
+
+		for(svdbuildjob_t* pjob : g_SVDBuildThread.finished)
+			SVD_FreeBuildJob(pjob);
+
+		g_SVDBuildThread.jobs.clear();
+		g_SVDBuildThread.finished.clear();
+	}
 
-	// Flag for next load
-	g_bNeedLoadSVD = true;
+	g_iSVDGeneration++;
 }
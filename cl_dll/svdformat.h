@@ -8,11 +8,26 @@
 #ifndef SVD_FORMAT_HEADER
 #define SVD_FORMAT_HEADER
 
-#include "com_model.h"
 #include "studio.h"
 
+struct model_s;
+
 #define MAX_SVD_FILES	512
-#define SVD_VERSION		4
+#define SVD_VERSION		6
+
+// Reduced shadow meshes built for every submodel
+#define SVD_MAX_LODS		2
+// Each LOD aims for this fraction of the previous level's faces
+#define SVD_LOD_RATIO		0.5f
+// Submodels with fewer faces are drawn at full detail only
+#define SVD_LOD_MIN_FACES	64
+
+// Packed archive holding the svds of a whole mod, mapped read-only by the client
+#define SVD_PACK_IDENT		(('P'<<24)+('D'<<16)+('V'<<8)+'S') // little-endian "SVDP"
+#define SVD_PACK_VERSION	2
+#define SVD_PACK_FILENAME	"models/shadows.svp"
+// Every svd in the pack starts on this boundary
+#define SVD_PACK_ALIGN		16
 
 struct svdedge_t
 {
@@ -40,6 +55,11 @@ struct svdsubmodel_t
 	int vertinfoindex;
 	int vertexindex;
 	int numverts;
+
+	// Reduced versions of this submodel, coarsest last. Each
+	// is a complete submodel of its own without further LODs
+	int lodindex;
+	int numlods;
 };
 
 struct svdbodypart_t
@@ -62,11 +82,34 @@ struct svdheader_t
 	int num_edges;
 };
 
-svdheader_t* SVD_Create( char* filename, model_t* pmodel );
-bool SVD_LoadSVDForModel( model_t* pmodel );
-void SVD_BuildFaces ( svdsubmodel_t* psubmodel, mstudiomodel_t* pstudiosubmodel, studiohdr_t* phdr );
-void SVD_BuildEdges ( svdsubmodel_t* psubmodel );
-void SVD_AddEdge ( svdedge_t* pedgebuffer, int* pnumedges, int face, int v0, int v1 );
+// Entries are sorted by model name, which is lowercase
+struct svdpackentry_t
+{
+	char modelname[64];
+	int dataindex;
+	int datasize;
+};
+
+struct svdpackheader_t
+{
+	int ident;
+	int version;
+
+	int entryindex;
+	int numentries;
+};
+
+// Builds shadow volume data from a studio header, does not depend on the engine
+// so the offline svdgen tool can share it. Returns a new[]'d buffer or NULL.
+svdheader_t* SVD_BuildModel( const studiohdr_t* phdr, const char* modelname, int* psize );
+
+// Returns the model's svd data, or NULL while it's still being built. The
+// first call for a model loads it or queues a build on a worker thread.
+svdheader_t* SVD_GetModelSVD( struct model_s* pmodel );
+void SVD_StopBuildThread( void );
+
+void SVD_OpenPack( void );
+void SVD_ClosePack( void );
 
 void SVD_VidInit( void );
 void SVD_Clear( void );
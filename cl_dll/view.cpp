@@ -1648,6 +1648,7 @@ void DLLEXPORT V_CalcRefdef(struct ref_params_s* pparams)
 		V_CalcNormalRefdef(pparams);
 	}
 
+	SVD_SetupViewCulling(pparams);
 	gLightList.CalcRefDef();
 	SVD_CalcRefDef(pparams);
 }
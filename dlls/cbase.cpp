@@ -22,6 +22,7 @@
 #include "gamerules.h"
 #include "game.h"
 #include "pm_shared.h"
+#include "entitygrid.h"
 
 void EntvarsKeyvalue(entvars_t* pev, KeyValueData* pkvd);
 
@@ -160,6 +161,9 @@ int DispatchSpawn(edict_t* pent)
 
 		if (pEntity)
 		{
+			// Some entities only link through SET_MODEL
+			g_EntityGrid.Link(pent);
+
 			if (g_pGameRules && !g_pGameRules->IsAllowedToSpawn(pEntity))
 				return -1; // return that this entity should be deleted
 			if ((pEntity->pev->flags & FL_KILLME) != 0)
@@ -292,6 +296,8 @@ void DispatchSave(edict_t* pent, SAVERESTOREDATA* pSaveData)
 
 void OnFreeEntPrivateData(edict_s* pEdict)
 {
+	g_EntityGrid.Unlink(pEdict);
+
 	if (pEdict && pEdict->pvPrivateData)
 	{
 		auto entity = reinterpret_cast<CBaseEntity*>(pEdict->pvPrivateData);
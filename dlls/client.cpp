@@ -47,6 +47,8 @@
 #include "pm_shared.h"
 #include "pm_defs.h"
 #include "UserMessages.h"
+#include "entitygrid.h"
+#include "perception.h"
 
 DLL_GLOBAL unsigned int g_ulFrameCount;
 
@@ -701,6 +703,8 @@ void ServerDeactivate()
 
 	// Peform any shutdown operations here...
 	//
+	g_EntityGrid.Clear();
+	g_Perception.Clear();
 }
 
 void ServerActivate(edict_t* pEdictList, int edictCount, int clientMax)
@@ -888,6 +892,9 @@ static bool g_LastAllowBunnyHoppingState = false;
 //
 void StartFrame()
 {
+	g_EntityGrid.Frame();
+	g_Perception.Frame();
+
 	if (g_pGameRules)
 		g_pGameRules->Think();
 
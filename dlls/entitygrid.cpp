@@ -0,0 +1,322 @@
+/***
+*
+*	Copyright (c) 1996-2001, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include "extdll.h"
+#include "util.h"
+#include "cbase.h"
+#include "game.h"
+#include "entitygrid.h"
+
+CEntityGrid g_EntityGrid;
+
+static int EntityGrid_Cell(float coord)
+{
+	return static_cast<int>(std::floor(coord / ENTITYGRID_CELL_SIZE));
+}
+
+bool CEntityGrid::IsActive()
+{
+	return sv_entitygrid.value != 0 && !m_Entities.empty();
+}
+
+void CEntityGrid::RemoveFromCells(int index)
+{
+	gridentity_t& entity = m_Entities[index];
+
+	if (entity.incells)
+	{
+		for (int x = entity.cellmins[0]; x <= entity.cellmaxs[0]; x++)
+		{
+			for (int y = entity.cellmins[1]; y <= entity.cellmaxs[1]; y++)
+			{
+				std::vector<int>& cell = m_Cells[x & (ENTITYGRID_CELLS - 1)][y & (ENTITYGRID_CELLS - 1)];
+
+				auto it = std::find(cell.begin(), cell.end(), index);
+				if (it != cell.end())
+				{
+					*it = cell.back();
+					cell.pop_back();
+				}
+			}
+		}
+
+		entity.incells = false;
+	}
+
+	if (entity.scanslot != -1)
+	{
+		const int last = m_Scanned.back();
+		m_Scanned[entity.scanslot] = last;
+		m_Entities[last].scanslot = entity.scanslot;
+		m_Scanned.pop_back();
+
+		entity.scanslot = -1;
+	}
+}
+
+void CEntityGrid::Link(edict_t* pent)
+{
+	if (m_Entities.empty() || !pent)
+		return;
+
+	const int index = ENTINDEX(pent);
+	if (index <= 0 || index >= static_cast<int>(m_Entities.size()))
+		return;
+
+	if (0 != pent->free)
+	{
+		Unlink(pent);
+		return;
+	}
+
+	gridentity_t& entity = m_Entities[index];
+
+	RemoveFromCells(index);
+
+	entity.linked = true;
+	entity.absmin = pent->v.absmin;
+	entity.absmax = pent->v.absmax;
+	entity.origin = pent->v.origin;
+
+	m_iLinkCount++;
+
+	// UTIL_MonstersInSphere goes by the origin, so it has to be covered too
+	int numcells = 1;
+	for (int i = 0; i < 2; i++)
+	{
+		entity.spanmins[i] = std::min({entity.absmin[i], entity.absmax[i], entity.origin[i]});
+		entity.spanmaxs[i] = std::max({entity.absmin[i], entity.absmax[i], entity.origin[i]});
+
+		// Also catches bounds too far out to fit in a cell index
+		if (!(entity.spanmaxs[i] - entity.spanmins[i] < ENTITYGRID_MAX_CELLS * ENTITYGRID_CELL_SIZE)
+			|| !(std::fabs(entity.spanmins[i]) < INT_MAX / 2) || !(std::fabs(entity.spanmaxs[i]) < INT_MAX / 2))
+		{
+			numcells = ENTITYGRID_MAX_CELLS + 1;
+			break;
+		}
+
+		entity.cellmins[i] = EntityGrid_Cell(entity.spanmins[i]);
+		entity.cellmaxs[i] = EntityGrid_Cell(entity.spanmaxs[i]);
+		numcells *= entity.cellmaxs[i] - entity.cellmins[i] + 1;
+	}
+
+	if (entity.moving || numcells > ENTITYGRID_MAX_CELLS)
+	{
+		entity.scanslot = m_Scanned.size();
+		m_Scanned.push_back(index);
+		return;
+	}
+
+	for (int x = entity.cellmins[0]; x <= entity.cellmaxs[0]; x++)
+	{
+		for (int y = entity.cellmins[1]; y <= entity.cellmaxs[1]; y++)
+		{
+			m_Cells[x & (ENTITYGRID_CELLS - 1)][y & (ENTITYGRID_CELLS - 1)].push_back(index);
+		}
+	}
+
+	entity.incells = true;
+}
+
+void CEntityGrid::Unlink(edict_t* pent)
+{
+	if (m_Entities.empty() || !pent)
+		return;
+
+	const int index = ENTINDEX(pent);
+	if (index <= 0 || index >= static_cast<int>(m_Entities.size()))
+		return;
+
+	gridentity_t& entity = m_Entities[index];
+	if (!entity.linked)
+		return;
+
+	RemoveFromCells(index);
+
+	entity.linked = false;
+	entity.moving = false;
+
+	m_iLinkCount++;
+}
+
+bool CEntityGrid::EntityIsMoving(edict_t* pent)
+{
+	const entvars_t& v = pent->v;
+
+	// Players are moved by their commands, outside of the physics
+	if ((v.flags & FL_CLIENT) != 0)
+		return true;
+
+	if (v.velocity != g_vecZero || v.avelocity != g_vecZero || v.basevelocity != g_vecZero)
+		return true;
+
+	if (v.movetype == MOVETYPE_FOLLOW)
+		return true;
+
+	// Riding a train or a platform
+	if (!FNullEnt(v.groundentity) && (v.groundentity->v.velocity != g_vecZero || v.groundentity->v.avelocity != g_vecZero))
+		return true;
+
+	return false;
+}
+
+void CEntityGrid::Frame()
+{
+	if (sv_entitygrid.value == 0)
+	{
+		if (!m_Entities.empty())
+			Clear();
+
+		return;
+	}
+
+	edict_t* pEdictList = UTIL_GetEntityList();
+	if (!pEdictList)
+		return;
+
+	if (static_cast<int>(m_Entities.size()) != gpGlobals->maxEntities)
+	{
+		Clear();
+
+		gridentity_t entity{};
+		entity.scanslot = -1;
+		m_Entities.assign(gpGlobals->maxEntities, entity);
+	}
+
+	for (int i = 1; i < gpGlobals->maxEntities; i++)
+	{
+		edict_t* pent = pEdictList + i;
+		gridentity_t& entity = m_Entities[i];
+
+		if (0 != pent->free)
+		{
+			if (entity.linked)
+				Unlink(pent);
+
+			continue;
+		}
+
+		// Moved by the engine since it was linked, likely to keep moving
+		const bool changed = entity.linked && (entity.absmin != pent->v.absmin || entity.absmax != pent->v.absmax || entity.origin != pent->v.origin);
+		const bool moving = changed || EntityIsMoving(pent);
+
+		if (!entity.linked || changed || moving != entity.moving)
+		{
+			entity.moving = moving;
+			Link(pent);
+		}
+	}
+}
+
+void CEntityGrid::Clear()
+{
+	for (auto& column : m_Cells)
+	{
+		for (auto& cell : column)
+		{
+			cell.clear();
+		}
+	}
+
+	m_Scanned.clear();
+	m_Entities.clear();
+
+	m_iLinkCount++;
+}
+
+void CEntityGrid::Query(const Vector& mins, const Vector& maxs, std::vector<int>& indexes)
+{
+	indexes.clear();
+
+	if (m_iQueryStamp == INT_MAX)
+	{
+		for (auto& entity : m_Entities)
+		{
+			entity.querystamp = 0;
+		}
+
+		m_iQueryStamp = 0;
+	}
+
+	const int stamp = ++m_iQueryStamp;
+
+	// Entities may have moved this much since they were linked
+	float querymins[2], querymaxs[2];
+	int cellmins[2], cellmaxs[2];
+	bool wholegrid = false;
+
+	for (int i = 0; i < 2; i++)
+	{
+		querymins[i] = std::min(mins[i], maxs[i]) - ENTITYGRID_SLACK;
+		querymaxs[i] = std::max(mins[i], maxs[i]) + ENTITYGRID_SLACK;
+
+		if (!(querymaxs[i] - querymins[i] < ENTITYGRID_CELLS * ENTITYGRID_CELL_SIZE)
+			|| !(std::fabs(querymins[i]) < INT_MAX / 2) || !(std::fabs(querymaxs[i]) < INT_MAX / 2))
+		{
+			wholegrid = true;
+			break;
+		}
+
+		cellmins[i] = EntityGrid_Cell(querymins[i]);
+		cellmaxs[i] = EntityGrid_Cell(querymaxs[i]);
+	}
+
+	if (wholegrid)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			cellmins[i] = 0;
+			cellmaxs[i] = ENTITYGRID_CELLS - 1;
+		}
+	}
+
+	for (int x = cellmins[0]; x <= cellmaxs[0]; x++)
+	{
+		for (int y = cellmins[1]; y <= cellmaxs[1]; y++)
+		{
+			for (int index : m_Cells[x & (ENTITYGRID_CELLS - 1)][y & (ENTITYGRID_CELLS - 1)])
+			{
+				gridentity_t& entity = m_Entities[index];
+				if (entity.querystamp == stamp)
+					continue;
+
+				entity.querystamp = stamp;
+
+				// Cells wrap around, skip entities on the far side of the map
+				if (!wholegrid && (entity.spanmins[0] > querymaxs[0] || entity.spanmins[1] > querymaxs[1] || entity.spanmaxs[0] < querymins[0] || entity.spanmaxs[1] < querymins[1]))
+					continue;
+
+				indexes.push_back(index);
+			}
+		}
+	}
+
+	for (int index : m_Scanned)
+	{
+		gridentity_t& entity = m_Entities[index];
+		if (entity.querystamp == stamp)
+			continue;
+
+		entity.querystamp = stamp;
+		indexes.push_back(index);
+	}
+
+	// Same order as a scan over the edicts
+	std::sort(indexes.begin(), indexes.end());
+}
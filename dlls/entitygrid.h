@@ -0,0 +1,91 @@
+/***
+*
+*	Copyright (c) 1996-2001, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+
+#pragma once
+
+#include <vector>
+
+#define ENTITYGRID_CELL_SIZE 256
+#define ENTITYGRID_CELLS 64		   // Cells per axis, positions further apart than this wrap around
+#define ENTITYGRID_MAX_CELLS 64	   // Entities that cover more cells than this are tested by every query
+#define ENTITYGRID_SLACK 64		   // How far an entity can move without the grid hearing of it
+
+//
+// Loose uniform grid over the x and y of every entity's absmin/absmax and origin, so the
+// UTIL_ search helpers only look at entities near the area they search.
+//
+// The engine doesn't tell the game when it relinks an entity, so entities are linked by
+// UTIL_SetOrigin, UTIL_SetSize and DispatchSpawn, and StartFrame relinks anything that changed
+// since the last frame. Entities that are moving aren't put in cells, every query tests them.
+// Queries only return candidates, callers still test the entities' current fields.
+//
+class CEntityGrid
+{
+public:
+	bool IsActive();
+
+	void Link(edict_t* pent);
+	void Unlink(edict_t* pent);
+
+	// Relinks entities that moved, once per frame
+	void Frame();
+	void Clear();
+
+	// Indexes of the entities that may touch the box, in ascending order
+	void Query(const Vector& mins, const Vector& maxs, std::vector<int>& indexes);
+
+	// Bumped whenever an entity is linked or unlinked, for callers that keep query results
+	int GetLinkCount() { return m_iLinkCount; }
+
+private:
+	struct gridentity_t
+	{
+		bool linked;
+		bool moving;
+
+		// Bounds and origin when the entity was linked
+		Vector absmin;
+		Vector absmax;
+		Vector origin;
+
+		// Area the cells were picked from, x and y of the bounds and the origin
+		float spanmins[2];
+		float spanmaxs[2];
+
+		// Cells it's in, before wrapping around
+		bool incells;
+		int cellmins[2];
+		int cellmaxs[2];
+
+		// Slot in m_Scanned, or -1
+		int scanslot;
+
+		int querystamp;
+	};
+
+	bool EntityIsMoving(edict_t* pent);
+	void RemoveFromCells(int index);
+
+	std::vector<gridentity_t> m_Entities;
+	std::vector<int> m_Cells[ENTITYGRID_CELLS][ENTITYGRID_CELLS];
+
+	// Moving and oversized entities
+	std::vector<int> m_Scanned;
+
+	int m_iQueryStamp = 0;
+	int m_iLinkCount = 0;
+};
+
+extern CEntityGrid g_EntityGrid;
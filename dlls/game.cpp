@@ -47,6 +47,10 @@ cvar_t mp_chattime = {"mp_chattime", "10", FCVAR_SERVER};
 
 cvar_t sv_allowbunnyhopping = {"sv_allowbunnyhopping", "0", FCVAR_SERVER};
 
+cvar_t sv_entitygrid = {"sv_entitygrid", "1"}; // 0 makes the entity search helpers scan every edict
+
+cvar_t sv_sightcache = {"sv_sightcache", "0.1"}; // Seconds monsters share line of sight traces for, 0 traces every time
+
 //CVARS FOR SKILL LEVEL SETTINGS
 // Agrunt
 cvar_t sk_agrunt_health1 = {"sk_agrunt_health1", "0"};
@@ -523,6 +527,10 @@ void GameDLLInit()
 
 	CVAR_REGISTER(&sv_allowbunnyhopping);
 
+	CVAR_REGISTER(&sv_entitygrid);
+
+	CVAR_REGISTER(&sv_sightcache);
+
 	// REGISTER CVARS FOR SKILL LEVEL STUFF
 	// Agrunt
 	CVAR_REGISTER(&sk_agrunt_health1); // {"sk_agrunt_health1","0"};
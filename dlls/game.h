@@ -43,6 +43,10 @@ extern cvar_t mp_chattime;
 
 extern cvar_t sv_allowbunnyhopping;
 
+extern cvar_t sv_entitygrid;
+
+extern cvar_t sv_sightcache;
+
 extern cvar_t sv_busters;
 
 // Engine Cvars
@@ -33,6 +33,7 @@
 #include "decals.h"
 #include "soundent.h"
 #include "gamerules.h"
+#include "perception.h"
 
 #define MONSTER_CUT_CORNER_DIST 8 // 8 means the monster's bounding box is contained without the box of the node in WC
 
@@ -323,9 +324,12 @@ void CBaseMonster::Look(int iDistance)
 				!FBitSet(pSightEnt->pev->spawnflags, SF_MONSTER_PRISONER) &&
 				pSightEnt->pev->health > 0)
 			{
+				const int relationship = IRelationship(pSightEnt);
+
 				// the looker will want to consider this entity
 				// don't check anything else about an entity that can't be seen, or an entity that you don't care about.
-				if (IRelationship(pSightEnt) != R_NO && FInViewCone(pSightEnt) && !FBitSet(pSightEnt->pev->flags, FL_NOTARGET) && FVisible(pSightEnt))
+				// the line of sight may already have been traced this frame by another monster looking around.
+				if (relationship != R_NO && FInViewCone(pSightEnt) && !FBitSet(pSightEnt->pev->flags, FL_NOTARGET) && g_Perception.FVisible(this, pSightEnt))
 				{
 					if (pSightEnt->IsPlayer())
 					{
@@ -362,7 +366,7 @@ void CBaseMonster::Look(int iDistance)
 
 					// don't add the Enemy's relationship to the conditions. We only want to worry about conditions when
 					// we see monsters other than the Enemy.
-					switch (IRelationship(pSightEnt))
+					switch (relationship)
 					{
 					case R_NM:
 						iSighted |= bits_COND_SEE_NEMESIS;
@@ -0,0 +1,135 @@
+/***
+*
+*	Copyright (c) 1996-2001, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+
+#include <algorithm>
+
+#include "extdll.h"
+#include "util.h"
+#include "cbase.h"
+#include "game.h"
+#include "perception.h"
+
+CPerception g_Perception;
+
+bool CPerception::CanShare(CBaseEntity* pEntity)
+{
+	// The trace ignores the looker and anything it owns, which only matters for brush entities
+	if (pEntity->pev->solid == SOLID_BSP)
+		return false;
+
+	if (!FNullEnt(pEntity->pev->owner) && pEntity->pev->owner->v.solid == SOLID_BSP)
+		return false;
+
+	return true;
+}
+
+bool CPerception::FVisible(CBaseEntity* pLooker, CBaseEntity* pTarget)
+{
+	if (sv_sightcache.value <= 0 || !CanShare(pLooker) || !CanShare(pTarget))
+		return pLooker->FVisible(pTarget);
+
+	// Same early outs as CBaseEntity::FVisible, they're cheaper than a lookup
+	if (FBitSet(pTarget->pev->flags, FL_NOTARGET))
+		return false;
+
+	if ((pLooker->pev->waterlevel != 3 && pTarget->pev->waterlevel == 3) || (pLooker->pev->waterlevel == 3 && pTarget->pev->waterlevel == 0))
+		return false;
+
+	edict_t* pentLooker = pLooker->edict();
+	edict_t* pentTarget = pTarget->edict();
+
+	const Vector vecLookerOrigin = pLooker->pev->origin + pLooker->pev->view_ofs;
+	const Vector vecTargetOrigin = pTarget->EyePosition();
+
+	const int lookerIndex = ENTINDEX(pentLooker);
+	const int targetIndex = ENTINDEX(pentTarget);
+
+	// Slot of the looker in the entry
+	const int looker = lookerIndex < targetIndex ? 0 : 1;
+
+	edict_t* pents[2] = {pentLooker, pentTarget};
+	Vector eyes[2] = {vecLookerOrigin, vecTargetOrigin};
+
+	if (looker == 1)
+	{
+		std::swap(pents[0], pents[1]);
+		std::swap(eyes[0], eyes[1]);
+	}
+
+	const std::uint32_t key = (static_cast<std::uint32_t>(std::min(lookerIndex, targetIndex)) << 16) | static_cast<std::uint32_t>(std::max(lookerIndex, targetIndex));
+
+	auto it = m_Sights.find(key);
+	if (it != m_Sights.end())
+	{
+		const sightentry_t& entry = it->second;
+		const float age = gpGlobals->time - entry.time;
+
+		bool reuse = age >= 0 && age <= sv_sightcache.value && (entry.looker == looker || entry.symmetric);
+
+		for (int i = 0; reuse && i < 2; i++)
+		{
+			// Edict was reused, or its end moved too far
+			if (entry.serialnumbers[i] != pents[i]->serialnumber || (entry.eyes[i] - eyes[i]).Length() > PERCEPTION_EYE_TOLERANCE)
+				reuse = false;
+		}
+
+		if (reuse)
+			return entry.visible;
+	}
+
+	TraceResult tr;
+	UTIL_TraceLine(vecLookerOrigin, vecTargetOrigin, ignore_monsters, ignore_glass, pentLooker, &tr);
+
+	sightentry_t& entry = m_Sights[key];
+	entry.time = gpGlobals->time;
+	entry.looker = looker;
+	entry.visible = tr.flFraction == 1.0;
+	entry.symmetric = entry.visible && 0 == tr.fStartSolid;
+
+	for (int i = 0; i < 2; i++)
+	{
+		entry.serialnumbers[i] = pents[i]->serialnumber;
+		entry.eyes[i] = eyes[i];
+	}
+
+	return entry.visible;
+}
+
+void CPerception::Frame()
+{
+	if (m_Sights.empty())
+		return;
+
+	if (sv_sightcache.value <= 0)
+	{
+		Clear();
+		return;
+	}
+
+	for (auto it = m_Sights.begin(); it != m_Sights.end();)
+	{
+		const float age = gpGlobals->time - it->second.time;
+
+		if (age < 0 || age > sv_sightcache.value)
+			it = m_Sights.erase(it);
+		else
+			++it;
+	}
+}
+
+void CPerception::Clear()
+{
+	m_Sights.clear();
+}
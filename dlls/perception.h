@@ -0,0 +1,64 @@
+/***
+*
+*	Copyright (c) 1996-2001, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+*   Use, distribution, and modification of this source code and/or resulting
+*   object code is restricted to non-commercial enhancements to products from
+*   Valve LLC.  All other use, distribution, or modification is prohibited
+*   without written permission from Valve LLC.
+*
+****/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#define PERCEPTION_EYE_TOLERANCE 8 // How far either end can move before a cached trace is redone
+
+//
+// Line of sight results shared by every monster's Look. In a fight most monsters look at
+// the same few entities, so a pair of monsters that can see each other only needs one trace
+// between them, and a monster that looks again before anything moved reuses its last one.
+//
+// Results are kept for sv_sightcache seconds, as long as neither end moved further than
+// PERCEPTION_EYE_TOLERANCE. A trace only answers for the reverse direction when it was clear,
+// a blocked trace can still be clear the other way round if it ends inside something solid.
+//
+class CPerception
+{
+public:
+	// Same result as pLooker->FVisible(pTarget)
+	bool FVisible(CBaseEntity* pLooker, CBaseEntity* pTarget);
+
+	// Drops results that are too old, once per frame
+	void Frame();
+	void Clear();
+
+private:
+	struct sightentry_t
+	{
+		float time;
+
+		// Edicts the trace was between, lowest index first
+		int serialnumbers[2];
+		Vector eyes[2];
+
+		// Which of the two the trace was done from
+		int looker;
+		bool visible;
+
+		// Clear and didn't start inside anything, good for both directions
+		bool symmetric;
+	};
+
+	bool CanShare(CBaseEntity* pEntity);
+
+	std::unordered_map<std::uint32_t, sightentry_t> m_Sights;
+};
+
+extern CPerception g_Perception;
@@ -25,12 +25,15 @@
 #include "cbase.h"
 #include "saverestore.h"
 #include <time.h>
+#include <algorithm>
+#include <vector>
 #include "shake.h"
 #include "decals.h"
 #include "player.h"
 #include "weapons.h"
 #include "gamerules.h"
 #include "UserMessages.h"
+#include "entitygrid.h"
 
 float UTIL_WeaponTimeBase()
 {
@@ -415,6 +418,26 @@ void UTIL_MoveToOrigin(edict_t* pent, const Vector& vecGoal, float flDist, int i
 }
 
 
+// Whether UTIL_EntitiesInBox should return the edict
+static bool UTIL_EdictInBox(edict_t* pEdict, const Vector& mins, const Vector& maxs, int flagMask)
+{
+	if (0 != pEdict->free) // Not in use
+		return false;
+
+	if (0 != flagMask && (pEdict->v.flags & flagMask) == 0) // Does it meet the criteria?
+		return false;
+
+	if (mins.x > pEdict->v.absmax.x ||
+		mins.y > pEdict->v.absmax.y ||
+		mins.z > pEdict->v.absmax.z ||
+		maxs.x < pEdict->v.absmin.x ||
+		maxs.y < pEdict->v.absmin.y ||
+		maxs.z < pEdict->v.absmin.z)
+		return false;
+
+	return true;
+}
+
 int UTIL_EntitiesInBox(CBaseEntity** pList, int listMax, const Vector& mins, const Vector& maxs, int flagMask)
 {
 	edict_t* pEdict = UTIL_GetEntityList();
@@ -426,23 +449,37 @@ int UTIL_EntitiesInBox(CBaseEntity** pList, int listMax, const Vector& mins, con
 	if (!pEdict)
 		return count;
 
+	// Only look at the entities near the box, in the same order as the scan below
+	if (g_EntityGrid.IsActive())
+	{
+		static std::vector<int> indexes;
+		g_EntityGrid.Query(mins, maxs, indexes);
+
+		for (int index : indexes)
+		{
+			if (!UTIL_EdictInBox(pEdict + index, mins, maxs, flagMask))
+				continue;
+
+			pEntity = CBaseEntity::Instance(pEdict + index);
+			if (!pEntity)
+				continue;
+
+			pList[count] = pEntity;
+			count++;
+
+			if (count >= listMax)
+				return count;
+		}
+
+		return count;
+	}
+
 	// Ignore world.
 	++pEdict;
 
 	for (int i = 1; i < gpGlobals->maxEntities; i++, pEdict++)
 	{
-		if (0 != pEdict->free) // Not in use
-			continue;
-
-		if (0 != flagMask && (pEdict->v.flags & flagMask) == 0) // Does it meet the criteria?
-			continue;
-
-		if (mins.x > pEdict->v.absmax.x ||
-			mins.y > pEdict->v.absmax.y ||
-			mins.z > pEdict->v.absmax.z ||
-			maxs.x < pEdict->v.absmin.x ||
-			maxs.y < pEdict->v.absmin.y ||
-			maxs.z < pEdict->v.absmin.z)
+		if (!UTIL_EdictInBox(pEdict, mins, maxs, flagMask))
 			continue;
 
 		pEntity = CBaseEntity::Instance(pEdict);
@@ -460,12 +497,50 @@ int UTIL_EntitiesInBox(CBaseEntity** pList, int listMax, const Vector& mins, con
 }
 
 
+// Whether UTIL_MonstersInSphere should return the edict
+static bool UTIL_MonsterInSphere(edict_t* pEdict, const Vector& center, float radiusSquared)
+{
+	float distance, delta;
+
+	if (0 != pEdict->free) // Not in use
+		return false;
+
+	if ((pEdict->v.flags & (FL_CLIENT | FL_MONSTER)) == 0) // Not a client/monster ?
+		return false;
+
+	// Use origin for X & Y since they are centered for all monsters
+	// Now X
+	delta = center.x - pEdict->v.origin.x; //(pEdict->v.absmin.x + pEdict->v.absmax.x)*0.5;
+	delta *= delta;
+
+	if (delta > radiusSquared)
+		return false;
+	distance = delta;
+
+	// Now Y
+	delta = center.y - pEdict->v.origin.y; //(pEdict->v.absmin.y + pEdict->v.absmax.y)*0.5;
+	delta *= delta;
+
+	distance += delta;
+	if (distance > radiusSquared)
+		return false;
+
+	// Now Z
+	delta = center.z - (pEdict->v.absmin.z + pEdict->v.absmax.z) * 0.5;
+	delta *= delta;
+
+	distance += delta;
+	if (distance > radiusSquared)
+		return false;
+
+	return true;
+}
+
 int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center, float radius)
 {
 	edict_t* pEdict = UTIL_GetEntityList();
 	CBaseEntity* pEntity;
 	int count;
-	float distance, delta;
 
 	count = 0;
 	float radiusSquared = radius * radius;
@@ -473,40 +548,38 @@ int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center
 	if (!pEdict)
 		return count;
 
-	// Ignore world.
-	++pEdict;
-
-	for (int i = 1; i < gpGlobals->maxEntities; i++, pEdict++)
+	// The grid also covers origins, which is what the x and y tests use
+	if (g_EntityGrid.IsActive())
 	{
-		if (0 != pEdict->free) // Not in use
-			continue;
+		static std::vector<int> indexes;
+		const Vector extents(fabs(radius), fabs(radius), fabs(radius));
+		g_EntityGrid.Query(center - extents, center + extents, indexes);
 
-		if ((pEdict->v.flags & (FL_CLIENT | FL_MONSTER)) == 0) // Not a client/monster ?
-			continue;
+		for (int index : indexes)
+		{
+			if (!UTIL_MonsterInSphere(pEdict + index, center, radiusSquared))
+				continue;
 
-		// Use origin for X & Y since they are centered for all monsters
-		// Now X
-		delta = center.x - pEdict->v.origin.x; //(pEdict->v.absmin.x + pEdict->v.absmax.x)*0.5;
-		delta *= delta;
+			pEntity = CBaseEntity::Instance(pEdict + index);
+			if (!pEntity)
+				continue;
 
-		if (delta > radiusSquared)
-			continue;
-		distance = delta;
+			pList[count] = pEntity;
+			count++;
 
-		// Now Y
-		delta = center.y - pEdict->v.origin.y; //(pEdict->v.absmin.y + pEdict->v.absmax.y)*0.5;
-		delta *= delta;
+			if (count >= listMax)
+				return count;
+		}
 
-		distance += delta;
-		if (distance > radiusSquared)
-			continue;
+		return count;
+	}
 
-		// Now Z
-		delta = center.z - (pEdict->v.absmin.z + pEdict->v.absmax.z) * 0.5;
-		delta *= delta;
+	// Ignore world.
+	++pEdict;
 
-		distance += delta;
-		if (distance > radiusSquared)
+	for (int i = 1; i < gpGlobals->maxEntities; i++, pEdict++)
+	{
+		if (!UTIL_MonsterInSphere(pEdict, center, radiusSquared))
 			continue;
 
 		pEntity = CBaseEntity::Instance(pEdict);
@@ -525,6 +598,65 @@ int UTIL_MonstersInSphere(CBaseEntity** pList, int listMax, const Vector& center
 }
 
 
+// FIND_ENTITY_IN_SPHERE over the entities the grid has near the sphere.
+// Loops over the results ask for the same sphere again and again, so the
+// candidates are kept until the grid changes.
+// The engine skips player slots whose client isn't active, which the game can't
+// ask about. Slots that were never put in the server have no private data or
+// FL_CLIENT and are skipped here too, but a slot whose player has left may
+// still have both, so for those the result can differ from FIND_ENTITY_IN_SPHERE
+static edict_t* UTIL_GridFindEntityInSphere(edict_t* pStartEdict, const Vector& vecCenter, float flRadius)
+{
+	static std::vector<int> indexes;
+	static Vector lastCenter;
+	static float lastRadius = -1;
+	static int lastLinkCount = -1;
+
+	if (g_EntityGrid.GetLinkCount() != lastLinkCount || vecCenter != lastCenter || flRadius != lastRadius)
+	{
+		const Vector extents(fabs(flRadius), fabs(flRadius), fabs(flRadius));
+		g_EntityGrid.Query(vecCenter - extents, vecCenter + extents, indexes);
+
+		lastLinkCount = g_EntityGrid.GetLinkCount();
+		lastCenter = vecCenter;
+		lastRadius = flRadius;
+	}
+
+	edict_t* pEdictList = UTIL_GetEntityList();
+	const int startIndex = pStartEdict ? ENTINDEX(pStartEdict) : 0;
+	const float radiusSquared = flRadius * flRadius;
+
+	for (auto it = std::upper_bound(indexes.begin(), indexes.end(), startIndex); it != indexes.end(); ++it)
+	{
+		edict_t* pEdict = pEdictList + *it;
+
+		if (0 != pEdict->free || FStringNull(pEdict->v.classname))
+			continue;
+
+		// Player slots without a player in the game
+		if (*it <= gpGlobals->maxClients && (!pEdict->pvPrivateData || (pEdict->v.flags & FL_CLIENT) == 0))
+			continue;
+
+		// Distance to the nearest point of the bounds
+		float distSquared = 0;
+		for (int j = 0; j < 3 && distSquared <= radiusSquared; j++)
+		{
+			float delta = 0;
+			if (vecCenter[j] < pEdict->v.absmin[j])
+				delta = vecCenter[j] - pEdict->v.absmin[j];
+			else if (vecCenter[j] > pEdict->v.absmax[j])
+				delta = vecCenter[j] - pEdict->v.absmax[j];
+
+			distSquared += delta * delta;
+		}
+
+		if (distSquared <= radiusSquared)
+			return pEdict;
+	}
+
+	return NULL;
+}
+
 CBaseEntity* UTIL_FindEntityInSphere(CBaseEntity* pStartEntity, const Vector& vecCenter, float flRadius)
 {
 	edict_t* pentEntity;
@@ -534,7 +666,10 @@ CBaseEntity* UTIL_FindEntityInSphere(CBaseEntity* pStartEntity, const Vector& ve
 	else
 		pentEntity = NULL;
 
-	pentEntity = FIND_ENTITY_IN_SPHERE(pentEntity, vecCenter, flRadius);
+	if (g_EntityGrid.IsActive())
+		pentEntity = UTIL_GridFindEntityInSphere(pentEntity, vecCenter, flRadius);
+	else
+		pentEntity = FIND_ENTITY_IN_SPHERE(pentEntity, vecCenter, flRadius);
 
 	if (!FNullEnt(pentEntity))
 		return CBaseEntity::Instance(pentEntity);
@@ -579,6 +714,38 @@ CBaseEntity* UTIL_FindEntityGeneric(const char* szWhatever, Vector& vecSrc, floa
 
 	CBaseEntity* pSearch = NULL;
 	float flMaxDist2 = flRadius * flRadius;
+
+	// Only entities with their origin inside the radius can be picked
+	if (g_EntityGrid.IsActive())
+	{
+		static std::vector<int> indexes;
+		const Vector extents(fabs(flRadius), fabs(flRadius), fabs(flRadius));
+		g_EntityGrid.Query(vecSrc - extents, vecSrc + extents, indexes);
+
+		edict_t* pEdictList = UTIL_GetEntityList();
+
+		for (int index : indexes)
+		{
+			edict_t* pEdict = pEdictList + index;
+			if (0 != pEdict->free || !FClassnameIs(pEdict, szWhatever))
+				continue;
+
+			pSearch = CBaseEntity::Instance(pEdict);
+			if (!pSearch)
+				continue;
+
+			float flDist2 = (pSearch->pev->origin - vecSrc).Length();
+			flDist2 = flDist2 * flDist2;
+			if (flMaxDist2 > flDist2)
+			{
+				pEntity = pSearch;
+				flMaxDist2 = flDist2;
+			}
+		}
+
+		return pEntity;
+	}
+
 	while ((pSearch = UTIL_FindEntityByClassname(pSearch, szWhatever)) != NULL)
 	{
 		float flDist2 = (pSearch->pev->origin - vecSrc).Length();
@@ -1011,6 +1178,7 @@ TraceResult UTIL_GetGlobalTrace()
 void UTIL_SetSize(entvars_t* pev, const Vector& vecMin, const Vector& vecMax)
 {
 	SET_SIZE(ENT(pev), vecMin, vecMax);
+	g_EntityGrid.Link(ENT(pev));
 }
 
 
@@ -1024,7 +1192,10 @@ void UTIL_SetOrigin(entvars_t* pev, const Vector& vecOrigin)
 {
 	edict_t* ent = ENT(pev);
 	if (ent)
+	{
 		SET_ORIGIN(ent, vecOrigin);
+		g_EntityGrid.Link(ent);
+	}
 }
 
 void UTIL_ParticleEffect(const Vector& vecOrigin, const Vector& vecDirection, unsigned int ulColor, unsigned int ulCount)
@@ -0,0 +1,338 @@
+/***
+*
+*	Copyright (c) 1996-2002, Valve LLC. All rights reserved.
+*
+*	This product contains software technology licensed from Id
+*	Software, Inc. ("Id Technology").  Id Technology (c) 1996 Id Software, Inc.
+*	All Rights Reserved.
+*
+****/
+
+// svdgen.cpp: bakes stencil shadow volume data (.svd) for every studio
+// model under <game>/models, so the client never has to build them at load
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "cmdlib.h"
+#include "mathlib.h"
+#include "threads.h"
+#include "vector.h"
+#include "steam/steamtypes.h"
+#include "studio.h"
+#include "svdformat.h"
+
+#define IDSTUDIOHEADER (('T' << 24) + ('S' << 16) + ('D' << 8) + 'I')
+
+char gamedir[1024];
+qboolean forcebuild;
+qboolean nopack;
+
+std::vector<std::string> modelnames;
+
+// Svd data for each model, kept around so it can be packed
+std::vector<byte*> modeldata;
+std::vector<int> modeldatasize;
+
+int numbuilt;
+int numskipped;
+int numfailed;
+
+/*
+==============
+LoadCurrentSVD
+
+Same test the client uses before it rebuilds an svd,
+returns the file contents if it can be reused
+==============
+*/
+byte* LoadCurrentSVD(const char* svdpath, const char* modelname, const studiohdr_t* phdr, int* psize)
+{
+	if (FileTime(svdpath) == -1)
+		return NULL;
+
+	byte* pdata;
+	int length = LoadFile(svdpath, (void**)&pdata);
+
+	svdheader_t* pheader = (svdheader_t*)pdata;
+	if (length < (int)sizeof(svdheader_t)
+		|| pheader->version != SVD_VERSION
+		|| pheader->mdl_size != phdr->length
+		|| strcmp(pheader->modelname, modelname))
+	{
+		free(pdata);
+		return NULL;
+	}
+
+	*psize = length;
+	return pdata;
+}
+
+/*
+==============
+BuildSVDForModel
+
+==============
+*/
+void BuildSVDForModel(int modelnum)
+{
+	const char* modelname = modelnames[modelnum].c_str();
+
+	char mdlpath[1024];
+	sprintf(mdlpath, "%s/%s", gamedir, modelname);
+
+	char svdpath[1024];
+	strcpy(svdpath, mdlpath);
+	strcpy(&svdpath[strlen(svdpath) - 3], "svd");
+
+	studiohdr_t* phdr;
+	int length = LoadFile(mdlpath, (void**)&phdr);
+
+	// Texture and sequence group files don't carry any geometry
+	if (length < (int)sizeof(studiohdr_t) || phdr->id != IDSTUDIOHEADER || phdr->numbodyparts == 0)
+	{
+		free(phdr);
+		return;
+	}
+
+	int size = 0;
+	byte* pcurrent = forcebuild ? NULL : LoadCurrentSVD(svdpath, modelname, phdr, &size);
+	if (pcurrent)
+	{
+		free(phdr);
+
+		ThreadLock();
+		modeldata[modelnum] = pcurrent;
+		modeldatasize[modelnum] = size;
+		numskipped++;
+		ThreadUnlock();
+		return;
+	}
+
+	svdheader_t* psvd = SVD_BuildModel(phdr, modelname, &size);
+	free(phdr);
+
+	if (!psvd)
+	{
+		ThreadLock();
+		printf("failed to build %s\n", modelname);
+		numfailed++;
+		ThreadUnlock();
+		return;
+	}
+
+	SaveFile(svdpath, psvd, size);
+
+	ThreadLock();
+	qprintf("%s: %i faces, %i edges\n", svdpath, psvd->num_faces, psvd->num_edges);
+	modeldata[modelnum] = (byte*)psvd;
+	modeldatasize[modelnum] = size;
+	numbuilt++;
+	ThreadUnlock();
+}
+
+/*
+==============
+PackName
+
+Name a model is stored under in the pack, lowercase since
+the engine keeps whatever case the model was asked for in
+==============
+*/
+std::string PackName(const std::string& modelname)
+{
+	std::string name = modelname;
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+		{ return static_cast<char>(tolower(c)); });
+	return name;
+}
+
+/*
+==============
+WritePack
+
+Packs every svd into SVD_PACK_FILENAME, which the client maps
+read-only and points model data straight into
+==============
+*/
+void WritePack(void)
+{
+	char packpath[1024];
+	sprintf(packpath, "%s/%s", gamedir, SVD_PACK_FILENAME);
+
+	std::vector<svdpackentry_t> entries;
+	std::vector<int> entrymodels;
+
+	// Model names are already sorted on their pack names, so the entries are too
+	for (size_t i = 0; i < modelnames.size(); i++)
+	{
+		if (!modeldata[i])
+			continue;
+
+		svdpackentry_t entry;
+		memset(&entry, 0, sizeof(entry));
+
+		std::string name = PackName(modelnames[i]);
+		if (name.size() >= sizeof(entry.modelname))
+		{
+			printf("%s: name too long to pack\n", modelnames[i].c_str());
+			continue;
+		}
+
+		// Only differs from the last one by case
+		if (!entries.empty() && !strcmp(entries.back().modelname, name.c_str()))
+		{
+			printf("%s: name already packed\n", modelnames[i].c_str());
+			continue;
+		}
+
+		strcpy(entry.modelname, name.c_str());
+		entry.datasize = modeldatasize[i];
+		entries.push_back(entry);
+		entrymodels.push_back(i);
+	}
+
+	svdpackheader_t header;
+	header.ident = SVD_PACK_IDENT;
+	header.version = SVD_PACK_VERSION;
+	header.entryindex = sizeof(svdpackheader_t);
+	header.numentries = entries.size();
+
+	int offset = header.entryindex + sizeof(svdpackentry_t) * header.numentries;
+	for (auto& entry : entries)
+	{
+		offset = (offset + SVD_PACK_ALIGN - 1) & ~(SVD_PACK_ALIGN - 1);
+		entry.dataindex = offset;
+		offset += entry.datasize;
+	}
+
+	FILE* f = SafeOpenWrite(packpath);
+	SafeWrite(f, &header, sizeof(header));
+	if (!entries.empty())
+		SafeWrite(f, entries.data(), sizeof(svdpackentry_t) * entries.size());
+
+	byte padding[SVD_PACK_ALIGN] = {};
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		int pad = entries[i].dataindex - ftell(f);
+		if (pad > 0)
+			SafeWrite(f, padding, pad);
+
+		SafeWrite(f, modeldata[entrymodels[i]], entries[i].datasize);
+	}
+
+	fclose(f);
+
+	printf("%s: %i models, %i bytes\n", packpath, header.numentries, offset);
+}
+
+/*
+==============
+FindModels
+
+Collects game directory relative names, which is what the engine
+stores in model_t::name and the svd header is checked against
+==============
+*/
+void FindModels(void)
+{
+	std::filesystem::path root(gamedir);
+	std::error_code ec;
+
+	for (std::filesystem::recursive_directory_iterator it(root / "models", ec), end; !ec && it != end; it.increment(ec))
+	{
+		if (!it->is_regular_file())
+			continue;
+
+		std::string ext = it->path().extension().string();
+		if (Q_strcasecmp(ext.c_str(), ".mdl"))
+			continue;
+
+		std::string name = it->path().lexically_relative(root).generic_string();
+		modelnames.push_back(name);
+	}
+
+	if (ec)
+		Error("couldn't read %s/models: %s", gamedir, ec.message().c_str());
+
+	// The pack is searched with a binary search on the lowercase name
+	std::sort(modelnames.begin(), modelnames.end(), [](const std::string& a, const std::string& b)
+		{
+			std::string packa = PackName(a);
+			std::string packb = PackName(b);
+			return packa != packb ? packa < packb : a < b;
+		});
+
+	modeldata.resize(modelnames.size());
+	modeldatasize.resize(modelnames.size());
+}
+
+int main(int argc, char** argv)
+{
+	int i;
+	double start, end;
+
+	printf("svdgen.exe v1.0 (%s)\n", __DATE__);
+	printf("---- svdgen ----\n");
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-threads"))
+		{
+			if (++i < argc)
+			{
+				numthreads = atoi(argv[i]);
+				if (numthreads <= 0)
+				{
+					fprintf(stderr, "Error: expected positive value after '-threads'\n");
+					return 1;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "Error: expected a value after '-threads'\n");
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "-force"))
+		{
+			forcebuild = true;
+		}
+		else if (!strcmp(argv[i], "-nopack"))
+		{
+			nopack = true;
+		}
+		else if (!strcmp(argv[i], "-verbose"))
+		{
+			verbose = true;
+		}
+		else if (argv[i][0] == '-')
+			Error("Unknown option \"%s\"", argv[i]);
+		else
+			break;
+	}
+
+	if (i != argc - 1)
+		Error("usage: svdgen [-threads #] [-force] [-nopack] [-verbose] gamedir");
+
+	strcpy(gamedir, argv[i]);
+
+	ThreadSetDefault();
+
+	start = I_FloatTime();
+
+	FindModels();
+	RunThreadsOnIndividual(modelnames.size(), true, BuildSVDForModel);
+
+	if (!nopack)
+		WritePack();
+
+	end = I_FloatTime();
+
+	printf("%i built, %i up to date, %i failed\n", numbuilt, numskipped, numfailed);
+	printf("%5.1f seconds elapsed\n", end - start);
+
+	return numfailed ? 1 : 0;
+}